@@ -0,0 +1,379 @@
+/*
+ * Run analysis_s or analysis_m on the given corpora over a matrix of
+ * thread counts, chunk sizes, strategies and counting engines, a number
+ * of trials each, and report the median and 95th percentile of wall
+ * time, throughput and peak RSS as CSV
+ *
+ * qingtao.cao.au@gmail.com
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <getopt.h>
+#include "lib.h"
+#include "token.h"
+
+#define TRIALS_DEF		5
+
+/* The most values along each dimension of the matrix */
+#define VALUES_MAX		16
+
+/* The most extra arguments passed to the program under test */
+#define EXTRA_MAX		16
+
+typedef struct values {
+	const char *v[VALUES_MAX];
+	int num;
+} values_t;
+
+typedef struct bench {
+	const char *program;
+	int multi;
+
+	/* Arguments passed as is to every run */
+	char *extra[EXTRA_MAX];
+	int extra_num;
+
+	values_t threads, chunks, strategies, engines;
+	int trials;
+	FILE *csv;
+} bench_t;
+
+static const struct option options[] = {
+	{ "trials", required_argument, NULL, 'n' },
+	{ "threads", required_argument, NULL, 'T' },
+	{ "chunk", required_argument, NULL, 'k' },
+	{ "strategy", required_argument, NULL, 'S' },
+	{ "engine", required_argument, NULL, 'e' },
+	{ "extra", required_argument, NULL, 'x' },
+	{ "output", required_argument, NULL, 'o' },
+	{ NULL, 0, NULL, 0 }
+};
+
+/*
+ * Split the comma-separated list in place into values
+ */
+static int split_values(char *arg, values_t *values)
+{
+	char *saveptr, *p;
+
+	for (p = strtok_r(arg, ",", &saveptr); p;
+		 p = strtok_r(NULL, ",", &saveptr)) {
+		if (values->num == VALUES_MAX) {
+			return -1;
+		}
+
+		values->v[values->num++] = p;
+	}
+
+	return values->num > 0 ? 0 : -1;
+}
+
+/*
+ * Count the tokens in the given corpus the same way as the programs
+ * under test, to tell their throughput in tokens per second
+ */
+static errcode_t count_tokens(const char *path, size_t *size, size_t *num)
+{
+	token_t tokens[TOKENS_BATCH];
+	struct stat statbuf;
+	const char *start;
+	char *data;
+	int fd, n;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return ERR_BAD_FILE;
+	}
+
+	if (fstat(fd, &statbuf) < 0 || statbuf.st_size == 0) {
+		close(fd);
+		return ERR_BAD_FILE;
+	}
+
+	if (!(data = map_file(fd, statbuf.st_size))) {
+		close(fd);
+		return ERR_IO;
+	}
+
+	for (*num = 0, start = data;
+		 (n = tokenize(&start, data + statbuf.st_size, tokens,
+					   TOKENS_BATCH)) > 0; *num += n);
+
+	*size = statbuf.st_size;
+	unmap_file(data, statbuf.st_size);
+	close(fd);
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Run the program once with the given arguments, its output discarded,
+ * and return its wall time in ns and peak RSS in KB
+ */
+static errcode_t run_once(char *const args[], uint64_t *elapsed, long *rss)
+{
+	struct rusage usage;
+	uint64_t begin;
+	pid_t pid;
+	int status, fd;
+
+	begin = get_ns();
+
+	if ((pid = fork()) < 0) {
+		return ERR_NO_MEM;
+	} else if (pid == 0) {
+		if ((fd = open("/dev/null", O_WRONLY)) >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+
+		execv(args[0], args);
+		_exit(127);
+	}
+
+	if (wait4(pid, &status, 0, &usage) < 0) {
+		return ERR_IO;
+	}
+
+	*elapsed = get_ns() - begin;
+	*rss = usage.ru_maxrss;
+
+	return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ?
+		   ERR_SUCCESS : ERR_BAD_PARAM;
+}
+
+/* The name of the program without its directory */
+static const char *program_name(const char *path)
+{
+	const char *p = strrchr(path, '/');
+
+	return p ? p + 1 : path;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Run one point of the matrix for all trials and report it, any of the
+ * thread count, chunk size, strategy and engine may be NULL for the
+ * default of the program
+ */
+static errcode_t run_point(bench_t *bench, const char *corpus,
+						   const size_t size, const size_t tokens,
+						   const char *threads, const char *chunk,
+						   const char *strategy, const char *engine)
+{
+	char *args[EXTRA_MAX + 10];
+	uint64_t times[bench->trials];
+	double median, p95;
+	long rss, peak = 0;
+	errcode_t ret;
+	int num = 0, i;
+
+	args[num++] = (char *)bench->program;
+
+	for (i = 0; i < bench->extra_num; i++) {
+		args[num++] = bench->extra[i];
+	}
+
+	if (strategy) {
+		args[num++] = "--strategy";
+		args[num++] = (char *)strategy;
+	}
+
+	if (engine) {
+		args[num++] = "--engine";
+		args[num++] = (char *)engine;
+	}
+
+	/*
+	 * The chunk size is an option of analysis_m, whose trailing argument
+	 * is the number of threads, but the trailing one of analysis_s
+	 */
+	if (bench->multi && chunk) {
+		args[num++] = "--chunk";
+		args[num++] = (char *)chunk;
+	}
+
+	args[num++] = (char *)corpus;
+
+	if (bench->multi ? threads != NULL : chunk != NULL) {
+		args[num++] = (char *)(bench->multi ? threads : chunk);
+	}
+
+	args[num] = NULL;
+
+	for (i = 0; i < bench->trials; i++) {
+		if ((ret = run_once(args, &times[i], &rss)) != ERR_SUCCESS) {
+			fprintf(stderr, "Failed to run %s on %s\n", bench->program,
+					corpus);
+			return ret;
+		}
+
+		if (rss > peak) {
+			peak = rss;
+		}
+	}
+
+	qsort(times, bench->trials, sizeof(uint64_t), compare_u64);
+
+	median = (bench->trials % 2) ? times[bench->trials / 2] :
+			 (times[bench->trials / 2 - 1] + times[bench->trials / 2]) / 2.0;
+	median /= 1e9;
+	p95 = times[(bench->trials * 95 + 99) / 100 - 1] / 1e9;
+
+	fprintf(bench->csv,
+			"%s,%s,%zu,%zu,%s,%s,%s,%s,%d,%.6f,%.6f,%.0f,%.2f,%ld\n",
+			program_name(bench->program), corpus, size, tokens,
+			threads ? threads : "", chunk ? chunk : "",
+			strategy ? strategy : "", engine ? engine : "", bench->trials,
+			median, p95,
+			tokens / median, size / median / (1 << 20), peak);
+	fflush(bench->csv);
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Walk through the matrix for the given corpus, a dimension without
+ * values stands for the default of the program
+ */
+static errcode_t run_corpus(bench_t *bench, const char *corpus)
+{
+	size_t size, tokens;
+	errcode_t ret;
+	int t, k, s, e;
+
+	if ((ret = count_tokens(corpus, &size, &tokens)) != ERR_SUCCESS) {
+		fprintf(stderr, "Illegal text file : %s\n", corpus);
+		return ret;
+	}
+
+	for (t = 0; t < (bench->threads.num ? bench->threads.num : 1); t++) {
+		for (k = 0; k < (bench->chunks.num ? bench->chunks.num : 1); k++) {
+			for (s = 0; s < (bench->strategies.num ?
+							 bench->strategies.num : 1); s++) {
+				for (e = 0; e < (bench->engines.num ?
+								 bench->engines.num : 1); e++) {
+					ret = run_point(bench, corpus, size, tokens,
+									bench->threads.num ?
+									bench->threads.v[t] : NULL,
+									bench->chunks.num ?
+									bench->chunks.v[k] : NULL,
+									bench->strategies.num ?
+									bench->strategies.v[s] : NULL,
+									bench->engines.num ?
+									bench->engines.v[e] : NULL);
+					if (ret != ERR_SUCCESS) {
+						return ret;
+					}
+				}
+			}
+		}
+	}
+
+	return ERR_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	bench_t bench;
+	char *saveptr, *p;
+	int opt, i, ret = ERR_SUCCESS;
+
+	memset(&bench, 0, sizeof(bench_t));
+	bench.trials = TRIALS_DEF;
+	bench.csv = stdout;
+
+	while ((opt = getopt_long(argc, argv, "n:T:k:S:e:x:o:", options,
+							  NULL)) != -1) {
+		switch (opt) {
+		case 'n':
+			if ((bench.trials = atoi(optarg)) <= 0) {
+				goto usage;
+			}
+			break;
+		case 'T':
+			if (split_values(optarg, &bench.threads) < 0) {
+				goto usage;
+			}
+			break;
+		case 'k':
+			if (split_values(optarg, &bench.chunks) < 0) {
+				goto usage;
+			}
+			break;
+		case 'S':
+			if (split_values(optarg, &bench.strategies) < 0) {
+				goto usage;
+			}
+			break;
+		case 'e':
+			if (split_values(optarg, &bench.engines) < 0) {
+				goto usage;
+			}
+			break;
+		case 'x':
+			for (p = strtok_r(optarg, " ", &saveptr); p;
+				 p = strtok_r(NULL, " ", &saveptr)) {
+				if (bench.extra_num == EXTRA_MAX) {
+					goto usage;
+				}
+
+				bench.extra[bench.extra_num++] = p;
+			}
+			break;
+		case 'o':
+			if (!(bench.csv = fopen(optarg, "w"))) {
+				printf("Failed to open file : %s\n", optarg);
+				return ERR_IO;
+			}
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (argc - optind < 2) {
+usage:
+		printf("Usage: %s [--trials <n>] [--threads <n,...>] "
+			   "[--chunk <size,...>] [--strategy <name,...>] "
+			   "[--engine <name,...>] "
+			   "[--extra \"<options>\"] [--output <csv file>] "
+			   "<path of analysis_s|analysis_m> <corpus>...\n", argv[0]);
+		return ERR_BAD_PARAM;
+	}
+
+	bench.program = argv[optind];
+	bench.multi = strstr(program_name(argv[optind]), "analysis_m") != NULL;
+
+	/* Threads and strategies only make sense to analysis_m */
+	if (!bench.multi && (bench.threads.num || bench.strategies.num)) {
+		goto usage;
+	}
+
+	fprintf(bench.csv, "program,corpus,bytes,tokens,threads,chunk,strategy,engine,"
+			"trials,median_s,p95_s,tokens_per_s,mb_per_s,peak_rss_kb\n");
+
+	for (i = optind + 1; i < argc; i++) {
+		if ((ret = run_corpus(&bench, argv[i])) != ERR_SUCCESS) {
+			break;
+		}
+	}
+
+	if (bench.csv != stdout) {
+		fclose(bench.csv);
+	}
+
+	return ret;
+}
@@ -0,0 +1,241 @@
+/*
+ * Generate a synthetic text corpus of about the given size, whose words
+ * are drawn from a fixed vocabulary by a Zipf distribution, so that
+ * benchmarks could be run on reproducible inputs of any size and skew
+ *
+ * qingtao.cao.au@gmail.com
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include "lib.h"
+
+#define SEED_DEF		1
+#define VOCAB_DEF		100000
+#define ZIPF_DEF		1.0
+
+/* The longest word ever generated, well below WORD_LEN_MAX */
+#define LEN_MAX			32
+
+/*
+ * The relative frequency of words of 1, 2, 3... letters by default,
+ * roughly that of English text
+ */
+static const char *lengths_def = "3,17,21,16,11,9,8,6,4,3,1,1";
+
+static const struct option options[] = {
+	{ "seed", required_argument, NULL, 'r' },
+	{ "vocab", required_argument, NULL, 'v' },
+	{ "zipf", required_argument, NULL, 'z' },
+	{ "lengths", required_argument, NULL, 'l' },
+	{ NULL, 0, NULL, 0 }
+};
+
+/*
+ * splitmix64, tiny and good enough, and above all the same sequence on
+ * every platform for the same seed
+ */
+static uint64_t next_rand(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return z ^ (z >> 31);
+}
+
+/* A uniform random number in [0, 1) */
+static double next_double(uint64_t *state)
+{
+	return (next_rand(state) >> 11) * (1.0 / (1ULL << 53));
+}
+
+/*
+ * Return the index of the first one in the ascending cdf not less than
+ * the given value
+ */
+static int search_cdf(const double *cdf, const int num, const double value)
+{
+	int lo = 0, hi = num - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+
+		if (cdf[mid] < value) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/*
+ * Parse the comma-separated weights of word lengths into a cdf, return
+ * the number of lengths or -1 if malformed
+ */
+static int parse_lengths(const char *arg, double *cdf)
+{
+	const char *p = arg;
+	char *end;
+	double sum = 0;
+	int num = 0, i;
+
+	while (*p && num < LEN_MAX) {
+		if ((cdf[num] = strtod(p, &end)) < 0 || end == p) {
+			return -1;
+		}
+
+		sum += cdf[num++];
+		p = (*end == ',') ? end + 1 : end;
+
+		if (*end && *end != ',') {
+			return -1;
+		}
+	}
+
+	if (num == 0 || *p || sum <= 0) {
+		return -1;
+	}
+
+	for (i = 0; i < num; i++) {
+		cdf[i] = (i ? cdf[i - 1] : 0) + cdf[i] / sum;
+	}
+
+	return num;
+}
+
+int main(int argc, char *argv[])
+{
+	double len_cdf[LEN_MAX], *rank_cdf, zipf = ZIPF_DEF, sum;
+	uint64_t state = SEED_DEF;
+	const char *lengths = lengths_def;
+	char *words, *w, line[LEN_MAX * 2];
+	int *offs, vocab = VOCAB_DEF, lens_num, len, opt, i;
+	size_t size, done, words_num = 0;
+	FILE *fp = stdout;
+
+	while ((opt = getopt_long(argc, argv, "r:v:z:l:", options, NULL)) != -1) {
+		switch (opt) {
+		case 'r':
+			state = strtoull(optarg, NULL, 0);
+			break;
+		case 'v':
+			if ((vocab = atoi(optarg)) <= 0) {
+				goto usage;
+			}
+			break;
+		case 'z':
+			if ((zipf = atof(optarg)) < 0) {
+				goto usage;
+			}
+			break;
+		case 'l':
+			lengths = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (argc - optind < 1 || argc - optind > 2 ||
+		(size = strtoull(argv[optind], NULL, 0)) == 0 ||
+		(lens_num = parse_lengths(lengths, len_cdf)) < 0) {
+usage:
+		printf("Usage: %s [--seed <n>] [--vocab <distinct words>] "
+			   "[--zipf <exponent>] [--lengths <weight of 1,2,3... letters>] "
+			   "<size in bytes> [output file]\n", argv[0]);
+		return ERR_BAD_PARAM;
+	}
+
+	if (argc - optind == 2 && !(fp = fopen(argv[optind + 1], "w"))) {
+		printf("Failed to open file : %s\n", argv[optind + 1]);
+		return ERR_IO;
+	}
+
+	if (!(words = (char *)malloc((size_t)vocab * (lens_num + 1))) ||
+		!(offs = (int *)malloc(sizeof(int) * (vocab + 1))) ||
+		!(rank_cdf = (double *)malloc(sizeof(double) * vocab))) {
+		printf("Failed to allocate vocabulary of %d words\n", vocab);
+		return ERR_NO_MEM;
+	}
+
+	/*
+	 * The word of rank i shows up in proportion to 1 / i^zipf, a zipf
+	 * of 0 makes all words equally likely. Letters are random, so two
+	 * short words may happen to be spelt the same and counted as one
+	 */
+	for (i = 0, w = words, sum = 0; i < vocab; i++) {
+		offs[i] = w - words;
+		len = search_cdf(len_cdf, lens_num, next_double(&state)) + 1;
+
+		while (len-- > 0) {
+			*w++ = 'a' + next_rand(&state) % 26;
+		}
+
+		sum += pow(i + 1, -zipf);
+		rank_cdf[i] = sum;
+	}
+
+	offs[vocab] = w - words;
+
+	for (i = 0; i < vocab; i++) {
+		rank_cdf[i] /= sum;
+	}
+
+	/*
+	 * Words are mostly separated by spaces, with a line break every 12
+	 * words on average and some punctuation and capitals here and there
+	 */
+	for (done = 0; done < size; done += len) {
+		i = search_cdf(rank_cdf, vocab, next_double(&state));
+		len = offs[i + 1] - offs[i];
+		memcpy(line, words + offs[i], len);
+
+		if (next_rand(&state) % 16 == 0) {
+			line[0] += 'A' - 'a';
+		}
+
+		switch (next_rand(&state) % 24) {
+		case 0:
+		case 1:
+			line[len++] = '\n';
+			break;
+		case 2:
+			line[len++] = ',';
+			line[len++] = ' ';
+			break;
+		case 3:
+			line[len++] = '.';
+			line[len++] = ' ';
+			break;
+		default:
+			line[len++] = ' ';
+			break;
+		}
+
+		if (fwrite(line, 1, len, fp) != len) {
+			printf("Failed to write corpus\n");
+			return ERR_IO;
+		}
+
+		words_num++;
+	}
+
+	fprintf(stderr, "bytes=%zu\nwords=%zu\n", done, words_num);
+
+	free(rank_cdf);
+	free(offs);
+	free(words);
+
+	if (fp != stdout && fclose(fp) != 0) {
+		return ERR_IO;
+	}
+
+	return ERR_SUCCESS;
+}
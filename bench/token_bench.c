@@ -0,0 +1,110 @@
+/*
+ * Measure the throughput of every tokenizer implementation on the given
+ * text file, against strtok_r() which used to do the job
+ *
+ * qingtao.cao.au@gmail.com
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include "lib.h"
+#include "token.h"
+
+#define ROUNDS_DEF		10
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report(const char *name, const size_t size, const int rounds,
+				   const double elapsed, const size_t tokens,
+				   const size_t bytes)
+{
+	printf("%-8s %8.3f GB/s %12zu tokens %14zu bytes\n", name,
+		   (double)size * rounds / elapsed / 1e9, tokens / rounds,
+		   bytes / rounds);
+}
+
+int main(int argc, char *argv[])
+{
+	token_t tokens[TOKENS_BATCH];
+	struct stat statbuf;
+	const char *start;
+	char *data, *copy, *token, *saveptr;
+	size_t num, bytes;
+	double begin;
+	int fd, rounds = ROUNDS_DEF, impl, n, i, r;
+
+	if (argc < 2 || argc > 3) {
+		printf("Usage: %s <text file path> [rounds]\n", argv[0]);
+		return ERR_BAD_PARAM;
+	}
+
+	if (argc == 3 && (rounds = atoi(argv[2])) <= 0) {
+		rounds = ROUNDS_DEF;
+	}
+
+	if ((fd = open(argv[1], O_RDONLY)) < 0 || fstat(fd, &statbuf) < 0 ||
+		statbuf.st_size == 0) {
+		printf("Illegal text file : %s\n", argv[1]);
+		return ERR_BAD_FILE;
+	}
+
+	if (!(data = map_file(fd, statbuf.st_size)) ||
+		!(copy = (char *)malloc(statbuf.st_size + 1))) {
+		printf("Failed to load file : %s\n", argv[1]);
+		return ERR_NO_MEM;
+	}
+
+	/* strtok_r() mutates its input, so have it work on a fresh copy */
+	for (r = 0, num = bytes = 0, begin = now(); r < rounds; r++) {
+		memcpy(copy, data, statbuf.st_size);
+		copy[statbuf.st_size] = '\0';
+
+		for (token = strtok_r(copy, DELIMITER, &saveptr); token;
+			 token = strtok_r(NULL, DELIMITER, &saveptr)) {
+			num++;
+			bytes += strlen(token);
+		}
+	}
+
+	report("strtok_r", statbuf.st_size, rounds, now() - begin, num, bytes);
+
+	for (impl = 0; impl < TOKENIZER_NUM; impl++) {
+		if (impl > tokenizer_best()) {
+			break;
+		}
+
+		for (r = 0, num = bytes = 0, begin = now(); r < rounds; r++) {
+			start = data;
+
+			while ((n = tokenize_with(impl, &start, data + statbuf.st_size,
+									  tokens, TOKENS_BATCH)) > 0) {
+				for (i = 0; i < n; i++) {
+					bytes += tokens[i].len;
+				}
+
+				num += n;
+			}
+		}
+
+		report(tokenizer_names[impl], statbuf.st_size, rounds,
+			   now() - begin, num, bytes);
+	}
+
+	free(copy);
+	unmap_file(data, statbuf.st_size);
+	close(fd);
+
+	return 0;
+}
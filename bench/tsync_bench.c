@@ -0,0 +1,255 @@
+/*
+ * Measure the throughput of the readers-writer lock of tsync over a
+ * matrix of thread counts and shares of writers, each thread entering
+ * as a reader or a writer at random for a while, until the lock is shut
+ * down. Built once for each implementation of tsync, and reported as
+ * CSV along with the number of torn reads seen, which MUST be 0
+ *
+ * qingtao.cao.au@gmail.com
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include "lib.h"
+#include "tsync.h"
+
+#ifdef FUTEX_TSYNC
+#define TSYNC_IMPL		"futex"
+#else
+#define TSYNC_IMPL		"cond"
+#endif
+
+#define DURATION_DEF	200
+#define THREADS_DEF		"1,2,4,8"
+#define WRITES_DEF		"0,1,10,50"
+
+/* The most values along each dimension of the matrix */
+#define VALUES_MAX		16
+
+/* The words read or written by every thread in the critical section */
+#define DATA_WORDS		8
+
+typedef struct shared {
+	tsync_t sync;
+
+	/* Written by writers in the order of a, data[], b, read backwards */
+	long a, data[DATA_WORDS], b;
+
+	/* The chance of entering as a writer, in parts per million */
+	int writes;
+} shared_t;
+
+typedef struct worker {
+	pthread_t id;
+	shared_t *shared;
+	uint64_t state;
+	size_t reads, writes, torn;
+} worker_t;
+
+static const struct option options[] = {
+	{ "threads", required_argument, NULL, 'T' },
+	{ "writes", required_argument, NULL, 'w' },
+	{ "ms", required_argument, NULL, 'd' },
+	{ NULL, 0, NULL, 0 }
+};
+
+/* xorshift64, just to pick readers and writers */
+static uint64_t next_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return *state;
+}
+
+static void *work(void *arg)
+{
+	worker_t *worker = (worker_t *)arg;
+	shared_t *shared = worker->shared;
+	long a, b, sum;
+	int i;
+
+	for (;;) {
+		if (next_rand(&worker->state) % 1000000 < shared->writes) {
+			if (tsync_writer_entry(&shared->sync) < 0) {
+				break;
+			}
+
+			shared->a++;
+
+			for (i = 0; i < DATA_WORDS; i++) {
+				shared->data[i]++;
+			}
+
+			shared->b++;
+			tsync_writer_exit(&shared->sync);
+			worker->writes++;
+			continue;
+		}
+
+		if (tsync_reader_entry(&shared->sync) < 0) {
+			break;
+		}
+
+		b = shared->b;
+
+		for (i = 0, sum = 0; i < DATA_WORDS; i++) {
+			sum += shared->data[i];
+		}
+
+		a = shared->a;
+		tsync_reader_exit(&shared->sync);
+
+		if (a != b || sum != a * DATA_WORDS) {
+			worker->torn++;
+		}
+
+		worker->reads++;
+	}
+
+	return NULL;
+}
+
+/*
+ * Run the given number of threads for the given time, then shut down
+ * the lock, which stops them, and report their throughput
+ */
+static errcode_t run_point(const int threads, const double writes,
+						   const int ms)
+{
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	size_t reads_sum = 0, writes_sum = 0, torn = 0;
+	worker_t workers[threads];
+	shared_t *shared;
+	uint64_t begin, elapsed;
+	int i;
+
+	if (posix_memalign((void **)&shared, 64, sizeof(shared_t)) != 0) {
+		return ERR_NO_MEM;
+	}
+
+	memset(shared, 0, sizeof(shared_t));
+	tsync_init(&shared->sync);
+	shared->writes = writes * 10000;
+
+	begin = get_ns();
+
+	for (i = 0; i < threads; i++) {
+		memset(&workers[i], 0, sizeof(worker_t));
+		workers[i].shared = shared;
+		workers[i].state = 0x9e3779b97f4a7c15ULL * (i + 1);
+
+		if (pthread_create(&workers[i].id, NULL, work, &workers[i]) != 0) {
+			printf("Failed to start thread %d\n", i);
+			exit(ERR_NO_MEM);
+		}
+	}
+
+	nanosleep(&ts, NULL);
+
+	if (tsync_shutdown_entry(&shared->sync) < 0) {
+		printf("Failed to shut down\n");
+	}
+
+	elapsed = get_ns() - begin;
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i].id, NULL);
+		reads_sum += workers[i].reads;
+		writes_sum += workers[i].writes;
+		torn += workers[i].torn;
+	}
+
+	printf("%s,%d,%g,%d,%.0f,%.0f,%.0f,%zu\n", TSYNC_IMPL, threads, writes,
+		   ms, reads_sum / (elapsed / 1e9), writes_sum / (elapsed / 1e9),
+		   (reads_sum + writes_sum) / (elapsed / 1e9), torn);
+	fflush(stdout);
+
+	tsync_shutdown_revoke(&shared->sync);
+	tsync_cleanup(&shared->sync);
+	free(shared);
+
+	return torn ? ERR_BAD_PARAM : ERR_SUCCESS;
+}
+
+/*
+ * Split the comma-separated list in place into numbers
+ */
+static int split_values(char *arg, double *values)
+{
+	char *saveptr, *p;
+	int num = 0;
+
+	for (p = strtok_r(arg, ",", &saveptr); p;
+		 p = strtok_r(NULL, ",", &saveptr)) {
+		if (num == VALUES_MAX) {
+			return -1;
+		}
+
+		values[num++] = atof(p);
+	}
+
+	return num;
+}
+
+int main(int argc, char *argv[])
+{
+	char threads_def[] = THREADS_DEF, writes_def[] = WRITES_DEF;
+	double threads[VALUES_MAX], writes[VALUES_MAX];
+	int threads_num, writes_num, ms = DURATION_DEF, opt, t, w;
+	errcode_t ret = ERR_SUCCESS;
+
+	threads_num = split_values(threads_def, threads);
+	writes_num = split_values(writes_def, writes);
+
+	while ((opt = getopt_long(argc, argv, "T:w:d:", options, NULL)) != -1) {
+		switch (opt) {
+		case 'T':
+			if ((threads_num = split_values(optarg, threads)) <= 0) {
+				goto usage;
+			}
+			break;
+		case 'w':
+			if ((writes_num = split_values(optarg, writes)) <= 0) {
+				goto usage;
+			}
+			break;
+		case 'd':
+			if ((ms = atoi(optarg)) <= 0) {
+				goto usage;
+			}
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind != argc) {
+usage:
+		printf("Usage: %s [--threads <n,...>] [--writes <percent,...>] "
+			   "[--ms <duration of each run>]\n", argv[0]);
+		return ERR_BAD_PARAM;
+	}
+
+	printf("impl,threads,writes_pct,ms,reads_per_s,writes_per_s,ops_per_s,"
+		   "torn\n");
+
+	for (t = 0; t < threads_num; t++) {
+		for (w = 0; w < writes_num; w++) {
+			if (threads[t] < 1 || writes[w] < 0 || writes[w] > 100) {
+				goto usage;
+			}
+
+			if (run_point(threads[t], writes[w], ms) != ERR_SUCCESS) {
+				ret = ERR_BAD_PARAM;
+			}
+		}
+	}
+
+	return ret;
+}
@@ -9,29 +9,163 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <string.h>
 #include <pthread.h>
+#include <getopt.h>
 #include "node.h"
+#include "token.h"
+#include "cache.h"
+#include "sched.h"
+#include "stream.h"
+#include "topk.h"
+#include "snapshot.h"
+#include "input.h"
+#include "stats.h"
+#include "numa.h"
+#include "query.h"
+#include "ngram.h"
+#include "table.h"
+#include "dawg.h"
 
 /* The more threads, the more contention on mutex */
 #define THREADS_NUM_MIN		2
 #define THREADS_NUM_DEF		4
 
+/*
+ * The input is split into chunks of about this size which are scheduled
+ * among threads, the smaller the better balanced but the more overhead
+ */
+#define CHUNK_SIZE_DEF		(1 << 20)
+
+/*
+ * Strategies to synchronise threads building up the shared subtrees
+ */
+typedef enum {
+	STRATEGY_MUTEX = 0,		/* One mutex for each subtree */
+	STRATEGY_LOCKFREE,		/* Compare-and-swap and atomic counters */
+	STRATEGY_LOCAL,			/* Private trees merged in the end */
+	STRATEGY_NUM
+} strategy_t;
+
+static const char *strategy_names[STRATEGY_NUM] = {
+	"mutex", "lockfree", "local"
+};
+
 struct analysis;
+struct thread;
+
+typedef errcode_t (*insert_t)(struct thread *, const char *, const int,
+							  const int);
+
+/*
+ * Each round of work handed to the pool of threads either builds up the
+ * shared subtrees from all of its chunks, or counts each of its small
+ * files as a whole in a private tree for its own output, or reads in a
+ * slice of each file loaded for the next round
+ */
+typedef enum {
+	ROUND_SHARED = 0,
+	ROUND_PRIVATE,
+	ROUND_LOAD
+} round_t;
+
+/*
+ * Point to the first byte of a chunk of data in the data buffer of an
+ * input file and the byte right after it, which is a delimiter unless
+ * it is the end of the data buffer. Both are NULL if the file is small
+ * enough to be read in as a whole by the thread picking it up.
+ *
+ * If n-grams are counted, the words right before the chunk making up the
+ * n-grams ending in its first words start from lead, which is the same
+ * as start otherwise
+ */
+typedef struct chunk {
+	int file;
+	const char *lead, *start, *end;
+} chunk_t;
+
+/*
+ * The content of an input file loaded or mapped in advance, or mapped
+ * anonymously for threads to read in their slices of it
+ */
+typedef struct file {
+	char *data;
+	int mapped;
+} file_t;
 
 typedef struct thread {
 	/* The current thread */
 	pthread_t id;
 
+	/* The index of current thread in the fleet */
+	int idx;
+
+	/* The NUMA node current thread is pinned onto, or -1 */
+	int node;
+
+	/*
+	 * The slice of the files of the current round owned by current
+	 * thread, in the offsets as if all files were laid out one after
+	 * another each from a new page
+	 */
+	size_t slice_start, slice_end;
+
+	/* The pages of input analysed on the node of current thread or not */
+	size_t input_local, input_remote;
+
+	/*
+	 * The number of chunks analysed by current thread and the tasks it
+	 * has stolen, the time spent on them, the time spent waiting for
+	 * others to complete and the moment when no chunk is left in the
+	 * current round. The busy time at the start of the current round
+	 * is marked to tell the idle time of the round
+	 */
+	int chunks, steals;
+	uint64_t busy, idle, done, mark;
+
+	/*
+	 * The moments when the private trees are merged, the words are
+	 * frozen and the subtrees are dumped in the current round
+	 */
+	uint64_t merged, frozen, dumped;
+
+	/*
+	 * The number of words picked up by current thread, and the time
+	 * spent reading, tokenizing and inserting
+	 */
+	size_t tokens;
+	uint64_t phases[PHASE_NUM];
+
+	/* The arena to allocate nodes created by current thread */
+	arena_t arena;
+
+	/* The buffer to read in a small file as a whole */
+	char *buf;
+
+	/* The private tree of a small file in per file mode and its arena */
+	arena_t scratch;
+
+	/* The private tree of current thread in the local strategy */
+	node_t *root;
+
 	/*
-	 * Point to the first and the last byte of current chunk of data
-	 * in the overall data buffer. In particular, the byte pointed to
-	 * by the end must be NULLIFIED for sake of strtok_r
+	 * The hash table of current thread if picked by --engine, and that
+	 * of a small file in per file mode
 	 */
-	char *start, *end;
+	table_t table, file_table;
+
+	/* The cache of hot words in front of the tree, if enabled */
+	cache_t cache;
+
+	/* The window of the last words if n-grams are counted */
+	ngram_t ngram;
+
+	/* The top K words of the subtrees dumped by current thread */
+	topk_t top;
 
 	/* Point back to the parent data structure */
 	struct analysis *parent;
@@ -44,195 +178,1927 @@ typedef struct analysis {
 	/* The fleet of working threads */
 	thread_t *threads;
 
-	/* The huge buffer containing all data to be analysed */
-	char *data;
+	/*
+	 * The input files, the content of those larger than a chunk loaded
+	 * in advance, and the output of each file counted as a whole by a
+	 * single thread in per file mode
+	 */
+	inputs_t *inputs;
+	file_t *files;
+	out_t *file_outs;
+	int use_mmap;
+
+	/*
+	 * Whether threads are spread over NUMA nodes, each reading in its
+	 * slice of the files and analysing it, so that both the input and
+	 * the nodes allocated by each thread are close to it
+	 */
+	int use_numa;
+	numa_t numa;
+
+	/*
+	 * The files of the current round in the range of [first, last),
+	 * split into chunks of about this size, and their scheduler
+	 */
+	int first, last;
+	size_t chunk_size;
+	chunk_t *chunks;
+	int chunks_num, chunks_size;
+	sched_t *sched;
+
+	/*
+	 * Or the buffers the input is read into in turn, if it can't be
+	 * loaded as a whole in advance
+	 */
+	stream_t stream;
+	int streamed;
+
+	/*
+	 * The pool of threads is kept across rounds, each started by bumping
+	 * up the number of rounds, after which every thread reports back by
+	 * dropping the number of running threads
+	 */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int rounds, running, quit;
+	round_t round;
+
+	/* The number of threads started and the moment the round started */
+	int started;
+	uint64_t begin;
 
 	/* The roots of the subtrees starting from a paticular letter */
 	root_t *roots[AVAILABLE_CHARS];
+
+	/* The arena to allocate the nodes of above roots */
+	arena_t arena;
+
+	/*
+	 * How to build up above subtrees, or the hash tables of all threads
+	 * instead, which are sorted by each thread in parallel before the
+	 * words of each first symbol are merged together from all of them
+	 */
+	engine_t engine;
+	strategy_t strategy;
+	insert_t insert;
+
+	/*
+	 * The words frozen into a DAWG by the first thread once all words
+	 * are counted if --freeze is given, and the bytes of the subtrees
+	 * or the hash tables released after
+	 */
+	dawg_t dawg;
+	int freeze;
+	size_t released;
+
+	/* The number of slots in the cache of each thread, 0 if disabled */
+	int cache_slots;
+
+	/* The number of words in each n-gram counted, 1 for words */
+	int ngram;
+
+	/*
+	 * All threads meet at the barrier once all words are counted, in the
+	 * local strategy before merging their private trees, each time
+	 * picking up the next subtree not merged yet
+	 */
+	pthread_barrier_t barrier;
+	int next_merge;
+
+	/*
+	 * Then the output of each subtree is formatted in memory, each time
+	 * by the thread picking up the next subtree not formatted yet. Or
+	 * if only the top K words are wanted, the words of the subtree are
+	 * offered to the top K of that thread
+	 */
+	out_t outs[AVAILABLE_CHARS];
+	int next_dump;
+	int top_k;
+
+	/* The first error met by any thread in the current round */
+	errcode_t err;
+
+	/* The queries answered while the subtrees are built up, if enabled */
+	query_t query;
+	int use_query;
+
+	/* The time spent on each phase, if --stats is given */
+	int stats;
+	uint64_t phases[PHASE_NUM];
 } analysis_t;
 
-static void destroy_analysis(analysis_t *ana)
+static errcode_t insert_mutex(thread_t *current, const char *word,
+							  const int len, const int cnt)
 {
-	int i;
+	return setup_tree_cnt(&current->arena, current->parent->roots,
+						  word, len, cnt);
+}
 
-	if (!ana) {
-		return;
-	}
+static errcode_t insert_lockfree(thread_t *current, const char *word,
+								 const int len, const int cnt)
+{
+	return setup_tree_lockfree_cnt(&current->arena, current->parent->roots,
+								   word, len, cnt);
+}
 
-	if (ana->data) {
-		free(ana->data);
-	}
+static errcode_t insert_local(thread_t *current, const char *word,
+							  const int len, const int cnt)
+{
+	return setup_node_cnt(&current->arena, current->root, word, len, cnt);
+}
 
-	for (i = 0; i < AVAILABLE_CHARS; i ++) {
-		destroy_tree(ana->roots[i]);
-	}
+static const insert_t strategy_inserts[STRATEGY_NUM] = {
+	insert_mutex, insert_lockfree, insert_local
+};
 
-	if (ana->threads) {
-		free(ana->threads);
-	}
+/* The mutex strategy with queries reading the subtrees in between */
+static errcode_t insert_sync(thread_t *current, const char *word,
+							 const int len, const int cnt)
+{
+	return setup_tree_sync_cnt(&current->arena, current->parent->roots,
+							   word, len, cnt);
+}
 
-	free(ana);
+static errcode_t insert_hash(thread_t *current, const char *word,
+							 const int len, const int cnt)
+{
+	return table_insert_cnt(&current->table, word, len, cnt);
+}
+
+/*
+ * Where words evicted from the cache of a thread go
+ */
+static errcode_t flush_word(void *arg, const char *word, const int len,
+							const int cnt)
+{
+	thread_t *current = (thread_t *)arg;
+
+	return current->parent->insert(current, word, len, cnt);
 }
 
-static analysis_t *setup_analysis(const int threads_num, const int size)
+/*
+ * Where words counted by a previous run go, before any thread starts
+ */
+static errcode_t load_word(void *arg, const char *word, const int len,
+						   const int cnt)
 {
-	analysis_t *ana;
-	int i;
+	analysis_t *ana = (analysis_t *)arg;
 
-	if (!(ana = (analysis_t *)malloc(sizeof(analysis_t))) ||
-		!(ana->data = (char *)malloc(size + 1)) ||
-		!(ana->threads = (thread_t *)malloc(sizeof(thread_t) * threads_num))) {
-		goto failed;
+	/* Into the table of the first thread, as good as any other */
+	if (ana->engine == ENGINE_HASH) {
+		return table_insert_cnt(&ana->threads[0].table, word, len, cnt);
 	}
 
-	for (i = 0; i < AVAILABLE_CHARS; i++) {
-		if (!(ana->roots[i] = create_tree('a' + i))) {
-			goto failed;
+	return setup_tree_cnt(&ana->arena, ana->roots, word, len, cnt);
+}
+
+static const struct option options[] = {
+	{ "stats", no_argument, NULL, 's' },
+	{ "mmap", no_argument, NULL, 'm' },
+	{ "strategy", required_argument, NULL, 'S' },
+	{ "cache", required_argument, NULL, 'c' },
+	{ "chunk", required_argument, NULL, 'k' },
+	{ "top", required_argument, NULL, 't' },
+	{ "save", required_argument, NULL, 'o' },
+	{ "merge", required_argument, NULL, 'i' },
+	{ "per-file", no_argument, NULL, 'f' },
+	{ "case-sensitive", no_argument, NULL, 'C' },
+	{ "numa", no_argument, NULL, 'N' },
+	{ "query", required_argument, NULL, 'q' },
+	{ "ngram", required_argument, NULL, 'g' },
+	{ "engine", required_argument, NULL, 'e' },
+	{ "freeze", no_argument, NULL, 'F' },
+	{ "threads", required_argument, NULL, 'T' },
+	{ NULL, 0, NULL, 0 }
+};
+
+/*
+ * Read the whole content of the given input file for sake of performance,
+ * or map it if required so that no copy is made at all
+ */
+static errcode_t load_file(analysis_t *ana, const int idx)
+{
+	const input_t *input = &ana->inputs->items[idx];
+	file_t *file = &ana->files[idx];
+	int fd;
+
+	/* Left untouched for each thread to fault in its own slice */
+	if (ana->use_mmap == 0 && ana->use_numa == 1) {
+		file->data = mmap(NULL, input->size, PROT_READ | PROT_WRITE,
+						  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (file->data == MAP_FAILED) {
+			file->data = NULL;
+			return ERR_NO_MEM;
 		}
+
+		file->mapped = 1;
+		return ERR_SUCCESS;
 	}
 
-	memset(ana->threads, 0, sizeof(thread_t) * threads_num);
-	ana->threads_num = threads_num;
+	if (ana->use_mmap == 0) {
+		if (!(file->data = (char *)malloc(input->size))) {
+			return ERR_NO_MEM;
+		}
 
-	for (i = 0; i < threads_num; i++) {
-		ana->threads[i].parent = ana;
+		return input_read(input, file->data);
 	}
 
-	return ana;
+	if ((fd = open(input->path, O_RDONLY)) < 0) {
+		return ERR_IO;
+	}
 
-failed:
-	destroy_analysis(ana);
-	return NULL;
+	file->data = map_file(fd, input->size);
+	close(fd);
+
+	if (!file->data) {
+		return ERR_IO;
+	}
+
+	file->mapped = 1;
+	return ERR_SUCCESS;
 }
 
-static void *payload(void *arg)
+static void unload_file(analysis_t *ana, const int idx)
 {
-	thread_t *current = (thread_t *)arg;
-	char *token, *saveptr;
-	int ret;
+	file_t *file = &ana->files[idx];
 
-	/* Build up our tree from each token */
-	if ((token = strtok_r(current->start, DELIMITER, &saveptr)) != NULL) {
-		do {
-			if ((ret = setup_tree(current->parent->roots, token)) > 0) {
-				break;
-			}
-		} while ((token = strtok_r(NULL, DELIMITER, &saveptr)) != NULL);
+	if (!file->data) {
+		return;
 	}
 
-	return NULL;
+	if (file->mapped == 1) {
+		unmap_file(file->data, ana->inputs->items[idx].size);
+	} else {
+		free(file->data);
+	}
+
+	file->data = NULL;
+	file->mapped = 0;
 }
 
-int main(int argc, char *argv[])
+static void destroy_analysis(analysis_t *ana)
 {
-	analysis_t *ana;
-	thread_t *current;
-	struct stat statbuf;
-	const char *file;
-	char *start;
-	int fd, ret, i, threads_num = 0, len;
+	int i;
 
-	if (argc < 2 || argc > 3) {
-		printf("Usage: %s <text file path> <num of threads>\n", argv[0]);
-		return ERR_BAD_PARAM;
+	if (!ana) {
+		return;
 	}
 
-	file = argv[1];
+	/* Before the subtrees it reads are gone */
+	if (ana->use_query == 1) {
+		query_stop(&ana->query);
+		query_cleanup(&ana->query);
+	}
 
-	if (argc == 3) {
-		threads_num = atoi(argv[2]);
-		if (threads_num <= 0) {
-			threads_num = THREADS_NUM_MIN;
+	if (ana->files) {
+		for (i = 0; i < ana->inputs->num; i++) {
+			unload_file(ana, i);
 		}
-	} else {
-		threads_num = THREADS_NUM_DEF;
+
+		free(ana->files);
 	}
 
-	if (lstat(file, &statbuf) < 0 ||
-		S_ISREG(statbuf.st_mode) == 0 ||
-		statbuf.st_size == 0) {
-		printf("Illegal text file : %s\n", file);
-		return ERR_BAD_FILE;
+	if (ana->file_outs) {
+		for (i = 0; i < ana->inputs->num; i++) {
+			out_cleanup(&ana->file_outs[i]);
+		}
+
+		free(ana->file_outs);
 	}
 
-	/* Adjust the number of threads if needed */
-	if (statbuf.st_size <= WORD_LEN_MAX) {
-		threads_num = 1;
-	} else if (statbuf.st_size < WORD_LEN_MAX * threads_num) {
-		threads_num = statbuf.st_size / WORD_LEN_MAX;
+	for (i = 0; i < AVAILABLE_CHARS; i ++) {
+		if (ana->roots[i]) {
+			destroy_tree(ana->roots[i]);
+		}
 	}
 
-	if (!(ana = setup_analysis(threads_num, statbuf.st_size))) {
-		printf("Failed to allocate analysis_t\n");
-		ret = ERR_NO_MEM;
-		goto failed;
+	sched_destroy(ana->sched);
+
+	if (ana->chunks) {
+		free(ana->chunks);
 	}
 
-	if ((fd = open(file, O_RDONLY)) < 0) {
-		printf("Failed to open file : %s\n", file);
-		ret = ERR_IO;
-		goto failed;
+	/* Release all nodes in one go */
+	if (ana->threads) {
+		for (i = 0; i < ana->threads_num; i++) {
+			cache_cleanup(&ana->threads[i].cache);
+			ngram_cleanup(&ana->threads[i].ngram);
+			table_cleanup(&ana->threads[i].table);
+			table_cleanup(&ana->threads[i].file_table);
+			topk_cleanup(&ana->threads[i].top);
+			arena_release(&ana->threads[i].arena);
+			arena_release(&ana->threads[i].scratch);
+			free(ana->threads[i].buf);
+		}
+
+		free(ana->threads);
 	}
 
-	/* Read the whole content of the input file for sake of performance */
-	if ((ret = read(fd, ana->data, statbuf.st_size)) < statbuf.st_size) {
-		ret = ERR_IO;
-		goto read_failed;
+	arena_release(&ana->arena);
+	dawg_cleanup(&ana->dawg);
+
+	for (i = 0; i < AVAILABLE_CHARS; i++) {
+		out_cleanup(&ana->outs[i]);
 	}
 
-	ana->data[ret] = '\0';
+	if (ana->threads_num > 0) {
+		pthread_barrier_destroy(&ana->barrier);
+	}
 
-	start = ana->data;
-	len = statbuf.st_size / threads_num;
+	pthread_mutex_destroy(&ana->mutex);
+	pthread_cond_destroy(&ana->cond);
 
-	/*
-	 * NOTE: the last thread/chunk will be treated differently
-	 */
-	for (i = 0; i < threads_num - 1; i++) {
+	numa_cleanup(&ana->numa);
+	free(ana);
+}
+
+/*
+ * Report the node of each thread and where the pages of the input it
+ * has analysed and of the nodes it has allocated are
+ */
+static void dump_numa(const analysis_t *ana)
+{
+	const thread_t *current;
+	const slab_t *slab;
+	size_t local, remote;
+	int i;
+
+	fprintf(stderr, "numa_nodes=%d\n", ana->numa.nodes_num);
+
+	for (i = 0; i < ana->threads_num; i++) {
 		current = &ana->threads[i];
-		current->start = start;
-		current->end = start + len;
 
-		/* Move along the end pointer to the closet delimiter */
-		while (is_delimiter(*current->end) == 0) {
-			current->end++;
+		for (slab = current->arena.slabs, local = remote = 0; slab;
+			 slab = slab->next) {
+			numa_pages(slab, ARENA_SLAB_SIZE, current->node, &local, &remote);
 		}
 
-		/* Convert a delimiter to a NULL byte as boundary of chunks */
-		*current->end = '\0';
-		start = current->end + 1;
+		fprintf(stderr, "numa_node.%d=%d\n"
+				"numa_input_local.%d=%zu\nnuma_input_remote.%d=%zu\n"
+				"numa_tree_local.%d=%zu\nnuma_tree_remote.%d=%zu\n",
+				i, current->node, i, current->input_local,
+				i, current->input_remote, i, local, i, remote);
 	}
+}
+
+static void dump_stats(const analysis_t *ana)
+{
+	const thread_t *current;
+	const cache_t *cache;
+	const root_t *root;
+	node_t *subtrees[AVAILABLE_CHARS];
+	const table_t *tables[ana->threads_num];
+	uint64_t phases[PHASE_NUM];
+	table_stats_t table;
+	tree_stats_t tree;
+	size_t allocated, used, tokens = 0;
+	int i;
 
-	ana->threads[threads_num - 1].start = start;
+	allocated = ana->arena.allocated;
+	used = ana->arena.used;
+	memcpy(phases, ana->phases, sizeof(phases));
 
-	for (i = 0; i < threads_num; i++) {
+	for (i = 0; i < ana->threads_num; i++) {
 		current = &ana->threads[i];
-		if (pthread_create(&current->id, NULL, payload, (void *)current) != 0) {
-			printf("Failed to start thread %d\n", i);
-			ret = ERR_NO_MEM;
-			break;
+		allocated += current->arena.allocated;
+		used += current->arena.used;
+		tokens += current->tokens;
+
+		phases[PHASE_READ] += current->phases[PHASE_READ];
+		phases[PHASE_TOKENIZE] += current->phases[PHASE_TOKENIZE];
+		phases[PHASE_INSERT] += current->phases[PHASE_INSERT];
+	}
+
+	stats_phases(phases);
+
+	if (ana->freeze == 1) {
+		if (stats_dawg(&ana->dawg) != ERR_SUCCESS) {
+			return;
+		}
+
+		fprintf(stderr, "files=%d\nrounds=%d\nfreeze_released=%zu\n"
+				"words=%zu\nbytes_per_word=%.1f\n"
+				"tokens=%zu\noccurences=%zu\n",
+				ana->inputs->num, ana->rounds, ana->released,
+				ana->dawg.words,
+				ana->dawg.words ?
+				(double)dawg_bytes(&ana->dawg) / ana->dawg.words : 0.0,
+				tokens, (size_t)ana->dawg.total);
+	} else if (ana->engine == ENGINE_HASH) {
+		for (i = 0; i < ana->threads_num; i++) {
+			tables[i] = &ana->threads[i].table;
+		}
+
+		if (stats_table(tables, ana->threads_num, &table) != ERR_SUCCESS) {
+			return;
+		}
+
+		/* A word counted by more than one thread takes a bucket in each */
+		fprintf(stderr, "files=%d\nrounds=%d\n"
+				"table_allocated=%zu\ntable_used=%zu\n"
+				"table_words=%zu\nbytes_per_word=%.1f\n"
+				"tokens=%zu\noccurences=%zu\n",
+				ana->inputs->num, ana->rounds, table.allocated, table.used,
+				table.words,
+				table.words ? (double)table.used / table.words : 0.0,
+				tokens, table.total);
+	} else {
+		for (i = 0; i < AVAILABLE_CHARS; i++) {
+			subtrees[i] = ana->roots[i]->n;
 		}
+
+		if (stats_tree(subtrees, AVAILABLE_CHARS, 1, &tree) != ERR_SUCCESS) {
+			return;
+		}
+
+		fprintf(stderr, "files=%d\nrounds=%d\n"
+				"arena_allocated=%zu\narena_used=%zu\n"
+				"nodes=%zu\nwords=%zu\nbytes_per_word=%.1f\n"
+				"tokens=%zu\noccurences=%zu\n",
+				ana->inputs->num, ana->rounds, allocated, used, tree.nodes,
+				tree.words, tree.words ? (double)used / tree.words : 0.0,
+				tokens, tree.total);
 	}
 
-	for (i = 0; i < threads_num; i++) {
-		if (pthread_join(ana->threads[i].id, NULL) != 0) {
-			printf("Failed to join thread %d and it could be left zombie", i);
+	for (i = 0; i < ana->threads_num; i++) {
+		current = &ana->threads[i];
+
+		fprintf(stderr, "worker_chunks.%d=%d\nworker_steals.%d=%d\n"
+				"worker_busy_ms.%d=%.3f\nworker_idle_ms.%d=%.3f\n"
+				"worker_tokens.%d=%zu\nworker_read_ms.%d=%.3f\n"
+				"worker_tokenize_ms.%d=%.3f\nworker_insert_ms.%d=%.3f\n",
+				i, current->chunks, i, current->steals,
+				i, current->busy / 1e6, i, current->idle / 1e6,
+				i, current->tokens, i, current->phases[PHASE_READ] / 1e6,
+				i, current->phases[PHASE_TOKENIZE] / 1e6,
+				i, current->phases[PHASE_INSERT] / 1e6);
+	}
+
+	if (ana->use_numa == 1) {
+		dump_numa(ana);
+	}
+
+	if (ana->use_query == 1) {
+		query_stats(&ana->query);
+	}
+
+	/* Only the mutex strategy takes the mutex of each subtree */
+	for (i = 0; i < AVAILABLE_CHARS; i++) {
+		root = ana->roots[i];
+
+		if (root->acquired == 0) {
+			continue;
 		}
+
+		fprintf(stderr, "lock_acquired." INDEX_FMT "=%zu\n"
+				"lock_contended." INDEX_FMT "=%zu\n"
+				"lock_wait_ms." INDEX_FMT "=%.3f\n",
+				INDEX_ARG(i), root->acquired, INDEX_ARG(i), root->contended,
+				INDEX_ARG(i), root->wait / 1e6);
+	}
+
+	if (ana->cache_slots <= 0) {
+		return;
+	}
+
+	for (i = 0; i < ana->threads_num; i++) {
+		cache = &ana->threads[i].cache;
+
+		fprintf(stderr, "cache_hits.%d=%zu\ncache_misses.%d=%zu\n"
+				"cache_evictions.%d=%zu\ncache_bypasses.%d=%zu\n"
+				"cache_hit_rate.%d=%.3f\n",
+				i, cache->hits, i, cache->misses, i, cache->evictions,
+				i, cache->bypasses, i, cache_hit_rate(cache));
+	}
+}
+
+static analysis_t *setup_analysis(inputs_t *inputs, const int threads_num,
+								  const strategy_t strategy,
+								  const int cache_slots, const int top_k,
+								  const size_t chunk_size, const int use_mmap,
+								  const int ngram, const engine_t engine)
+{
+	analysis_t *ana;
+	int i;
+
+	if (!(ana = (analysis_t *)malloc(sizeof(analysis_t)))) {
+		return NULL;
+	}
+
+	memset(ana, 0, sizeof(analysis_t));
+	arena_init(&ana->arena);
+	dawg_init(&ana->dawg);
+	ana->inputs = inputs;
+	ana->chunk_size = chunk_size;
+	ana->use_mmap = use_mmap;
+
+	pthread_mutex_init(&ana->mutex, NULL);
+	pthread_cond_init(&ana->cond, NULL);
+
+	if (!(ana->files = (file_t *)calloc(inputs->num, sizeof(file_t))) ||
+		!(ana->file_outs = (out_t *)malloc(sizeof(out_t) * inputs->num))) {
+		goto failed;
+	}
+
+	for (i = 0; i < inputs->num; i++) {
+		out_init(&ana->file_outs[i], -1, NULL, 0);
+	}
+
+	if (!(ana->threads = (thread_t *)malloc(sizeof(thread_t) * threads_num))) {
+		goto failed;
 	}
 
+	memset(ana->threads, 0, sizeof(thread_t) * threads_num);
+	ana->threads_num = threads_num;
+	ana->engine = engine;
+	ana->strategy = strategy;
+	ana->insert = (engine == ENGINE_HASH) ? insert_hash :
+				  strategy_inserts[strategy];
+	ana->cache_slots = cache_slots;
+	ana->top_k = top_k;
+	ana->ngram = ngram;
+
+	pthread_barrier_init(&ana->barrier, NULL, threads_num);
+
 	for (i = 0; i < AVAILABLE_CHARS; i++) {
-		dump_tree(ana->roots[i]);
+		out_init(&ana->outs[i], -1, NULL, 0);
 	}
 
-	ret = ERR_SUCCESS;
+	for (i = 0; i < threads_num; i++) {
+		arena_init(&ana->threads[i].arena);
+		arena_init(&ana->threads[i].scratch);
+		ngram_init(&ana->threads[i].ngram, ngram);
+		table_init(&ana->threads[i].table);
+		table_init(&ana->threads[i].file_table);
+		ana->threads[i].idx = i;
+		ana->threads[i].node = -1;
+		ana->threads[i].parent = ana;
 
-	/* Fall through */
+		if (!inputs->streamed &&
+			!(ana->threads[i].buf = (char *)malloc(chunk_size))) {
+			goto failed;
+		}
 
-read_failed:
-	close(fd);
+		/*
+		 * The root of a private tree comes from the shared arena, so
+		 * that the slabs of each thread are first touched by itself
+		 */
+		if (strategy == STRATEGY_LOCAL && engine == ENGINE_TRIE &&
+			!(ana->threads[i].root = create_node(&ana->arena))) {
+			goto failed;
+		}
+
+		if (cache_slots > 0 &&
+			cache_init(&ana->threads[i].cache, cache_slots, flush_word,
+					   &ana->threads[i]) != ERR_SUCCESS) {
+			goto failed;
+		}
+
+		if (top_k > 0 &&
+			topk_init(&ana->threads[i].top, top_k) != ERR_SUCCESS) {
+			goto failed;
+		}
+	}
+
+	for (i = 0; i < AVAILABLE_CHARS; i++) {
+		if (!(ana->roots[i] = create_tree(&ana->arena))) {
+			goto failed;
+		}
+	}
+
+	return ana;
+
+failed:
+	destroy_analysis(ana);
+	return NULL;
+}
+
+/*
+ * Record the given error unless another one has been recorded already
+ */
+static void set_error(analysis_t *ana, const errcode_t ret)
+{
+	errcode_t none = ERR_SUCCESS;
+
+	__atomic_compare_exchange_n(&ana->err, &none, ret, 0,
+								__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/*
+ * Merge the private trees of all threads into the shared subtrees,
+ * which are independent of each other and so could be merged by
+ * different threads in parallel, until any thread has failed
+ */
+static void merge_local(thread_t *current)
+{
+	analysis_t *ana = current->parent;
+	node_t *child;
+	int idx, i;
+	errcode_t ret;
+
+	while (__atomic_load_n(&ana->err, __ATOMIC_RELAXED) == ERR_SUCCESS &&
+		   (idx = __atomic_fetch_add(&ana->next_merge, 1,
+									 __ATOMIC_RELAXED)) < AVAILABLE_CHARS) {
+		for (i = 0; i < ana->threads_num; i++) {
+			if (!(child = node_child(ana->threads[i].root, idx))) {
+				continue;
+			}
+
+			if ((ret = merge_node(&current->arena, ana->roots[idx]->n,
+								  child)) != ERR_SUCCESS) {
+				printf("Failed to merge subtree " INDEX_FMT "\n",
+					   INDEX_ARG(idx));
+				set_error(ana, ret);
+				return;
+			}
+		}
+	}
+}
+
+/*
+ * Sort the hash table of current thread, in parallel with other threads
+ */
+static void sort_table(thread_t *current)
+{
+	errcode_t ret;
+
+	if ((ret = table_sort(&current->table)) != ERR_SUCCESS) {
+		set_error(current->parent, ret);
+	}
+}
+
+/*
+ * Format the output of the words of each first symbol in memory, taken
+ * from the hash tables of all threads
+ */
+static errcode_t dump_tables(thread_t *current, const int idx)
+{
+	analysis_t *ana = current->parent;
+	const table_t *tables[ana->threads_num];
+	int i;
+
+	for (i = 0; i < ana->threads_num; i++) {
+		tables[i] = &ana->threads[i].table;
+	}
+
+	if (ana->top_k > 0) {
+		return table_walk(tables, ana->threads_num, idx, topk_insert,
+						  &current->top);
+	}
+
+	return table_output(&ana->outs[idx], tables, ana->threads_num, idx);
+}
+
+/*
+ * Freeze the words of all subtrees, or of the sorted hash tables, into
+ * one DAWG and release them, while all other threads are waiting
+ */
+static void freeze_words(analysis_t *ana)
+{
+	const table_t *tables[ana->threads_num];
+	thread_t *current;
+	table_stats_t table;
+	errcode_t ret = ERR_SUCCESS;
+	int i;
+
+	if (ana->engine == ENGINE_HASH) {
+		for (i = 0; i < ana->threads_num; i++) {
+			tables[i] = &ana->threads[i].table;
+		}
+
+		ret = table_walk(tables, ana->threads_num, -1, dawg_add, &ana->dawg);
+	} else {
+		for (i = 0; i < AVAILABLE_CHARS && ret == ERR_SUCCESS; i++) {
+			ret = walk_node(ana->roots[i]->n, i, dawg_add, &ana->dawg);
+		}
+	}
+
+	if (ret != ERR_SUCCESS || (ret = dawg_seal(&ana->dawg)) != ERR_SUCCESS) {
+		set_error(ana, ret);
+		return;
+	}
+
+	/* Nodes of the subtrees come from the arenas of all threads */
+	memset(&table, 0, sizeof(table_stats_t));
+	ana->released = ana->arena.allocated;
+
+	for (i = 0; i < ana->threads_num; i++) {
+		current = &ana->threads[i];
+		table_count(&current->table, &table);
+		ana->released += current->arena.allocated;
+
+		arena_release(&current->arena);
+		table_cleanup(&current->table);
+		current->root = NULL;
+	}
+
+	ana->released += table.allocated;
+	arena_release(&ana->arena);
+
+	for (i = 0; i < AVAILABLE_CHARS; i++) {
+		ana->roots[i]->n = NULL;
+	}
+}
+
+/*
+ * Format the output of the subtrees in memory, which are independent of
+ * each other and so could be formatted by different threads in parallel.
+ * So are the words of each first symbol in the DAWG once frozen
+ */
+static void dump_subtrees(thread_t *current)
+{
+	analysis_t *ana = current->parent;
+	errcode_t ret;
+	int idx;
+
+	while ((idx = __atomic_fetch_add(&ana->next_dump, 1,
+									 __ATOMIC_RELAXED)) < AVAILABLE_CHARS) {
+		if (ana->freeze == 1) {
+			ret = (ana->top_k > 0) ?
+				  dawg_walk(&ana->dawg, idx, topk_insert, &current->top) :
+				  dawg_output(&ana->outs[idx], &ana->dawg, idx);
+		} else if (ana->engine == ENGINE_HASH) {
+			ret = dump_tables(current, idx);
+		} else if (ana->top_k > 0) {
+			ret = walk_node(ana->roots[idx]->n, idx, topk_insert,
+							&current->top);
+		} else {
+			ret = output_node(&ana->outs[idx], ana->roots[idx]->n, idx);
+		}
+
+		if (ret != ERR_SUCCESS) {
+			set_error(ana, ret);
+		}
+	}
+}
+
+/*
+ * Return the room for the given number of more chunks
+ */
+static chunk_t *reserve_chunks(analysis_t *ana, const size_t num)
+{
+	chunk_t *chunks;
+	size_t size;
+
+	if (ana->chunks_num + num > ana->chunks_size) {
+		size = (ana->chunks_num + num) * 2;
+
+		if (!(chunks = (chunk_t *)realloc(ana->chunks,
+										  sizeof(chunk_t) * size))) {
+			return NULL;
+		}
+
+		ana->chunks = chunks;
+		ana->chunks_size = size;
+	}
+
+	return &ana->chunks[ana->chunks_num];
+}
+
+static errcode_t run_round(analysis_t *ana, const round_t round);
+
+/* The given size rounded up to whole pages */
+static size_t page_up(const size_t size)
+{
+	const size_t page = sysconf(_SC_PAGESIZE);
+
+	return (size + page - 1) & ~(page - 1);
+}
+
+/*
+ * Cut the files in the range of [first, last) into a slice of about the
+ * same size for each thread, on page boundaries as if every file started
+ * from a new page, so that no page is shared by two slices
+ */
+static void slice_files(analysis_t *ana, const int first, const int last)
+{
+	const size_t page = sysconf(_SC_PAGESIZE);
+	size_t total = 0;
+	int i;
+
+	for (i = first; i < last; i++) {
+		total += page_up(ana->inputs->items[i].size);
+	}
+
+	for (i = 0; i < ana->threads_num; i++) {
+		ana->threads[i].slice_start = i ? ana->threads[i - 1].slice_end : 0;
+		ana->threads[i].slice_end = (i + 1 < ana->threads_num) ?
+			total * (i + 1) / ana->threads_num / page * page : total;
+	}
+}
+
+/*
+ * Read in the slice of current thread of the files loaded for the next
+ * round, so that its pages are faulted in on the node of the thread
+ */
+static void load_slice(thread_t *current)
+{
+	analysis_t *ana = current->parent;
+	const input_t *input;
+	size_t base, lo, hi;
+	errcode_t ret;
+	int i;
+
+	for (i = ana->first, base = 0; i < ana->last && base < current->slice_end;
+		 base += page_up(input->size), i++) {
+		input = &ana->inputs->items[i];
+		lo = (current->slice_start > base) ? current->slice_start - base : 0;
+		hi = (current->slice_end - base < input->size) ?
+			 current->slice_end - base : input->size;
+
+		if (!ana->files[i].data || lo >= hi) {
+			continue;
+		}
+
+		if ((ret = input_read_range(input, ana->files[i].data, lo,
+									hi - lo)) != ERR_SUCCESS) {
+			printf("Failed to read file : %s\n", input->path);
+			set_error(ana, ret);
+			return;
+		}
+	}
+}
+
+/*
+ * Schedule the input files in the range of [first, last) for the next
+ * round. A file no larger than a chunk is scheduled as a whole, to be
+ * read in by the thread picking it up, whereas a larger file is loaded
+ * in advance and split into chunks of about the chunk size, each ending
+ * at a delimiter or the end of the file.
+ *
+ * With threads spread over NUMA nodes, the larger files are read in by
+ * all threads, each its own slice, and each thread is handed the chunks
+ * starting in its slice in the first place
+ */
+static errcode_t split_chunks(analysis_t *ana, const int first, const int last)
+{
+	const input_t *input;
+	const char *start, *end;
+	chunk_t *chunk;
+	uint64_t begin;
+	size_t base, off;
+	errcode_t ret;
+	int heads[ana->threads_num], owner = 0, loaded = 0, i;
+
+	ana->chunks_num = 0;
+	ana->first = first;
+	ana->last = last;
+
+	begin = get_ns();
+
+	for (i = first; i < last; i++) {
+		input = &ana->inputs->items[i];
+
+		if (input->size > ana->chunk_size) {
+			if ((ret = load_file(ana, i)) != ERR_SUCCESS) {
+				printf("Failed to load file : %s\n", input->path);
+				return ret;
+			}
+
+			loaded++;
+		}
+	}
+
+	if (ana->use_numa == 1) {
+		slice_files(ana, first, last);
+
+		if (loaded > 0 && ana->use_mmap == 0 &&
+			(ret = run_round(ana, ROUND_LOAD)) != ERR_SUCCESS) {
+			return ret;
+		}
+	}
+
+	ana->phases[PHASE_READ] += get_ns() - begin;
+
+	heads[0] = 0;
+
+	for (i = first, base = 0; i < last; base += page_up(input->size), i++) {
+		input = &ana->inputs->items[i];
+
+		if (!(chunk = reserve_chunks(ana, input->size / ana->chunk_size + 1))) {
+			return ERR_NO_MEM;
+		}
+
+		if (input->size <= ana->chunk_size) {
+			start = end = NULL;
+		} else {
+			start = ana->files[i].data;
+			end = start + input->size;
+		}
+
+		do {
+			chunk = &ana->chunks[ana->chunks_num];
+			chunk->file = i;
+			chunk->start = start;
+			chunk->end = (end - start > ana->chunk_size) ?
+						 start + ana->chunk_size : end;
+
+			/* Move along the end pointer to the closet delimiter */
+			while (chunk->end < end && is_delimiter(*chunk->end) == 0) {
+				chunk->end++;
+			}
+
+			chunk->lead = (start && ana->ngram > 1) ?
+				ngram_lead(ana->files[i].data, start, ana->ngram - 1) : start;
+
+			/* The chunks starting in the slices of later threads */
+			off = base + (start ? start - ana->files[i].data : 0);
+
+			while (ana->use_numa == 1 && owner + 1 < ana->threads_num &&
+				   off >= ana->threads[owner].slice_end) {
+				heads[++owner] = ana->chunks_num;
+			}
+
+			ana->chunks_num++;
+			start = chunk->end;
+		} while (start < end);
+	}
+
+	while (++owner < ana->threads_num) {
+		heads[owner] = ana->chunks_num;
+	}
+
+	if (!(ana->sched = sched_create_shares(ana->threads_num, ana->chunks_num,
+										   ana->use_numa ? heads : NULL))) {
+		return ERR_NO_MEM;
+	}
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Fill up the window of n-grams with the words in the range of
+ * [lead, start), which only make up the n-grams ending after them
+ */
+static errcode_t prime_ngram(thread_t *current, const char *lead,
+							 const char *start)
+{
+	token_t tokens[TOKENS_BATCH];
+	int num, i;
+
+	ngram_reset(&current->ngram);
+
+	while ((num = tokenize(&lead, start, tokens, TOKENS_BATCH)) > 0) {
+		for (i = 0; i < num; i++) {
+			if (ngram_push(&current->ngram, tokens[i].word,
+						   tokens[i].len) < 0) {
+				return ERR_NO_MEM;
+			}
+		}
+	}
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Build up our tree from each word in the range of [start, end), or
+ * each n-gram ending there with the words from lead before start
+ */
+static errcode_t analyse(thread_t *current, const char *lead,
+						 const char *start, const char *end)
+{
+	analysis_t *ana = current->parent;
+	token_t tokens[TOKENS_BATCH];
+	uint64_t begin = 0, tokenized = 0;
+	const char *word;
+	int num, i, len, ret;
+
+	if (ana->ngram > 1 &&
+		(ret = prime_ngram(current, lead, start)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	for (;;) {
+		/* The clock is read once for a whole batch of words */
+		if (ana->stats == 1) {
+			begin = get_ns();
+		}
+
+		if ((num = tokenize(&start, end, tokens, TOKENS_BATCH)) <= 0) {
+			break;
+		}
+
+		if (ana->stats == 1) {
+			tokenized = get_ns();
+			current->phases[PHASE_TOKENIZE] += tokenized - begin;
+		}
+
+		current->tokens += num;
+
+		for (i = 0; i < num; i++) {
+			word = tokens[i].word;
+			len = tokens[i].len;
+
+			if (ana->ngram > 1) {
+				if ((ret = ngram_push(&current->ngram, word, len)) < 0) {
+					return ERR_NO_MEM;
+				} else if (ret == 0) {
+					continue;
+				}
+
+				word = current->ngram.buf;
+				len = current->ngram.len;
+			}
+
+			if (ana->cache_slots > 0) {
+				ret = cache_insert(&current->cache, word, len);
+			} else {
+				ret = ana->insert(current, word, len, 1);
+			}
+
+			if (ret > 0) {
+				return ret;
+			}
+		}
+
+		if (ana->stats == 1) {
+			current->phases[PHASE_INSERT] += get_ns() - tokenized;
+		}
+	}
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Point to the data of the given chunk and the words before it, reading
+ * in the whole file first if it is small and so has not been loaded in
+ * advance
+ */
+static errcode_t load_chunk(thread_t *current, const chunk_t *chunk,
+							const char **lead, const char **start,
+							const char **end)
+{
+	const input_t *input = &current->parent->inputs->items[chunk->file];
+	uint64_t begin;
+	errcode_t ret;
+
+	if (chunk->start) {
+		*lead = chunk->lead;
+		*start = chunk->start;
+		*end = chunk->end;
+		return ERR_SUCCESS;
+	}
+
+	begin = get_ns();
+	ret = input_read(input, current->buf);
+	current->phases[PHASE_READ] += get_ns() - begin;
+
+	if (ret != ERR_SUCCESS) {
+		printf("Failed to read file : %s\n", input->path);
+		return ret;
+	}
+
+	*lead = *start = current->buf;
+	*end = current->buf + input->size;
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Tell where the pages of the input analysed by current thread are, only
+ * for the stats as it takes a syscall
+ */
+static void count_pages(thread_t *current, const char *start,
+						const char *end)
+{
+	analysis_t *ana = current->parent;
+
+	if (ana->stats == 1 && ana->use_numa == 1) {
+		numa_pages(start, end - start, current->node, &current->input_local,
+				   &current->input_remote);
+	}
+}
+
+/*
+ * Return the next chunk of data for current thread, or -1 if none is
+ * left. A chunk from the stream MUST be put back once analysed
+ */
+static int next_chunk(thread_t *current, const char **lead,
+					  const char **start, const char **end)
+{
+	analysis_t *ana = current->parent;
+	size_t len;
+	int task;
+
+	uint64_t begin;
+
+	/* Reading is accounted by the time waiting for the reader thread */
+	if (ana->streamed == 1) {
+		begin = get_ns();
+
+		if ((task = stream_get(&ana->stream, lead, start, &len)) >= 0) {
+			*end = *start + len;
+		}
+
+		current->phases[PHASE_READ] += get_ns() - begin;
+	} else {
+		task = sched_next(ana->sched, current->idx);
+	}
+
+	return task;
+}
+
+/*
+ * Build up the shared subtrees from the chunks of the current round and
+ * format their output
+ */
+static void count_shared(thread_t *current)
+{
+	analysis_t *ana = current->parent;
+	const char *lead, *start, *end;
+	uint64_t begin;
+	int task;
+	errcode_t ret;
+
+	while ((task = next_chunk(current, &lead, &start, &end)) >= 0) {
+		begin = get_ns();
+
+		if (ana->streamed == 1 ||
+			(ret = load_chunk(current, &ana->chunks[task], &lead, &start,
+							  &end)) == ERR_SUCCESS) {
+			ret = analyse(current, lead, start, end);
+		}
+
+		current->busy += get_ns() - begin;
+		current->chunks++;
+
+		if (ret == ERR_SUCCESS) {
+			count_pages(current, start, end);
+		}
+
+		if (ana->streamed == 1) {
+			stream_put(&ana->stream, task);
+		}
+
+		if (ret != ERR_SUCCESS) {
+			set_error(ana, ret);
+			goto out;
+		}
+	}
+
+	if (ana->cache_slots > 0 &&
+		(ret = cache_flush(&current->cache)) != ERR_SUCCESS) {
+		set_error(ana, ret);
+	}
+
+out:
+	/*
+	 * Every phase ends when the last thread is done with it, so each one
+	 * is timed before the barrier rather than once out of it, by when
+	 * others may well be into the next phase. Nothing is merged unless
+	 * the tables are sorted or the private trees merged
+	 */
+	current->done = get_ns();
+	current->merged = current->done;
+
+	pthread_barrier_wait(&ana->barrier);
+
+	if (ana->engine == ENGINE_HASH) {
+		sort_table(current);
+		current->merged = get_ns();
+		pthread_barrier_wait(&ana->barrier);
+	} else if (ana->strategy == STRATEGY_LOCAL) {
+		merge_local(current);
+		current->merged = get_ns();
+		pthread_barrier_wait(&ana->barrier);
+	}
+
+	if (ana->freeze == 1) {
+		if (current->idx == 0 && ana->err == ERR_SUCCESS) {
+			freeze_words(ana);
+		}
+
+		current->frozen = get_ns();
+		pthread_barrier_wait(&ana->barrier);
+	} else {
+		current->frozen = current->merged;
+	}
+
+	/* Nothing to dump if the words could not be merged or frozen */
+	if (ana->err == ERR_SUCCESS) {
+		dump_subtrees(current);
+	}
+
+	current->dumped = get_ns();
+}
+
+/*
+ * Count the given small file as a whole in a private tree and format
+ * its output, headed by its path
+ */
+static errcode_t count_file(thread_t *current, const chunk_t *chunk)
+{
+	analysis_t *ana = current->parent;
+	out_t *out = &ana->file_outs[chunk->file];
+	const table_t *tables[1] = { &current->file_table };
+	token_t tokens[TOKENS_BATCH];
+	const char *lead, *start, *end, *word;
+	node_t *root;
+	int num, i, len;
+	errcode_t ret;
+
+	arena_reset(&current->scratch);
+	table_reset(&current->file_table);
+	ngram_reset(&current->ngram);
+
+	if (!(root = create_node(&current->scratch))) {
+		return ERR_NO_MEM;
+	}
+
+	if ((ret = load_chunk(current, chunk, &lead, &start,
+						  &end)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	while ((num = tokenize(&start, end, tokens, TOKENS_BATCH)) > 0) {
+		current->tokens += num;
+
+		for (i = 0; i < num; i++) {
+			word = tokens[i].word;
+			len = tokens[i].len;
+
+			if (ana->ngram > 1) {
+				if ((ret = ngram_push(&current->ngram, word, len)) < 0) {
+					return ERR_NO_MEM;
+				} else if (ret == 0) {
+					continue;
+				}
+
+				word = current->ngram.buf;
+				len = current->ngram.len;
+			}
+
+			if (ana->engine == ENGINE_HASH) {
+				ret = table_insert(&current->file_table, word, len);
+			} else {
+				ret = setup_node(&current->scratch, root, word, len);
+			}
+
+			if (ret != ERR_SUCCESS) {
+				return ret;
+			}
+		}
+	}
+
+	if ((ret = input_header(out, &ana->inputs->items[chunk->file])) !=
+		ERR_SUCCESS) {
+		return ret;
+	}
+
+	if (ana->engine == ENGINE_HASH &&
+		(ret = table_sort(&current->file_table)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	if (ana->top_k == 0) {
+		if (ana->engine == ENGINE_HASH) {
+			return table_output(out, tables, 1, -1);
+		}
+
+		return output_node(out, root, -1);
+	}
+
+	topk_reset(&current->top);
+
+	if (ana->engine == ENGINE_HASH) {
+		ret = table_walk(tables, 1, -1, topk_insert, &current->top);
+	} else {
+		ret = walk_node(root, -1, topk_insert, &current->top);
+	}
+
+	if (ret != ERR_SUCCESS) {
+		return ret;
+	}
+
+	return topk_output(&current->top, out);
+}
+
+static void count_files(thread_t *current)
+{
+	analysis_t *ana = current->parent;
+	uint64_t begin;
+	int task;
+	errcode_t ret;
+
+	while ((task = sched_next(ana->sched, current->idx)) >= 0) {
+		begin = get_ns();
+		ret = count_file(current, &ana->chunks[task]);
+		current->busy += get_ns() - begin;
+		current->chunks++;
+
+		if (ret != ERR_SUCCESS) {
+			set_error(ana, ret);
+			break;
+		}
+	}
+
+	current->done = get_ns();
+}
+
+static void *payload(void *arg)
+{
+	thread_t *current = (thread_t *)arg;
+	analysis_t *ana = current->parent;
+	int rounds = 0, quit;
+
+	/* Before any memory is touched by current thread */
+	if (ana->use_numa == 1) {
+		current->node = numa_bind(&ana->numa, current->idx);
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&ana->mutex);
+
+		while (ana->rounds == rounds && ana->quit == 0) {
+			pthread_cond_wait(&ana->cond, &ana->mutex);
+		}
+
+		rounds = ana->rounds;
+		quit = ana->quit;
+
+		pthread_mutex_unlock(&ana->mutex);
+
+		if (quit == 1) {
+			break;
+		}
+
+		if (ana->round == ROUND_LOAD) {
+			load_slice(current);
+		} else if (ana->round == ROUND_PRIVATE) {
+			count_files(current);
+		} else {
+			count_shared(current);
+		}
+
+		pthread_mutex_lock(&ana->mutex);
+
+		if (--ana->running == 0) {
+			pthread_cond_broadcast(&ana->cond);
+		}
+
+		pthread_mutex_unlock(&ana->mutex);
+	}
+
+	return NULL;
+}
+
+static errcode_t start_pool(analysis_t *ana)
+{
+	thread_t *current;
+	int i;
+
+	for (i = 0; i < ana->threads_num; i++) {
+		current = &ana->threads[i];
+		if (pthread_create(&current->id, NULL, payload, (void *)current) != 0) {
+			printf("Failed to start thread %d\n", i);
+			return ERR_NO_MEM;
+		}
+
+		ana->started++;
+	}
+
+	return ERR_SUCCESS;
+}
+
+static void stop_pool(analysis_t *ana)
+{
+	int i;
+
+	pthread_mutex_lock(&ana->mutex);
+	ana->quit = 1;
+	pthread_cond_broadcast(&ana->cond);
+	pthread_mutex_unlock(&ana->mutex);
+
+	for (i = 0; i < ana->started; i++) {
+		if (pthread_join(ana->threads[i].id, NULL) != 0) {
+			printf("Failed to join thread %d and it could be left zombie", i);
+		}
+	}
+
+	ana->started = 0;
+}
+
+/*
+ * Hand the chunks scheduled to the pool of threads and wait for all of
+ * them to complete, the files loaded for the round are dropped after.
+ * Or have the files of the next round read in by slices
+ */
+static errcode_t run_round(analysis_t *ana, const round_t round)
+{
+	thread_t *current;
+	uint64_t done, merged, frozen, dumped;
+	int i;
+
+	ana->round = round;
+	ana->begin = get_ns();
+
+	for (i = 0; i < ana->threads_num; i++) {
+		ana->threads[i].mark = ana->threads[i].busy;
+	}
+
+	pthread_mutex_lock(&ana->mutex);
+
+	ana->rounds++;
+	ana->running = ana->threads_num;
+	pthread_cond_broadcast(&ana->cond);
+
+	while (ana->running > 0) {
+		pthread_cond_wait(&ana->cond, &ana->mutex);
+	}
+
+	pthread_mutex_unlock(&ana->mutex);
+
+	/* Files loaded are kept for the round to come */
+	if (round == ROUND_LOAD) {
+		return ana->err;
+	}
+
+	for (i = 0, done = merged = frozen = dumped = 0; i < ana->threads_num;
+		 i++) {
+		current = &ana->threads[i];
+		done = (current->done > done) ? current->done : done;
+		merged = (current->merged > merged) ? current->merged : merged;
+		frozen = (current->frozen > frozen) ? current->frozen : frozen;
+		dumped = (current->dumped > dumped) ? current->dumped : dumped;
+	}
+
+	ana->phases[PHASE_COUNT] += done - ana->begin;
+
+	if (round == ROUND_SHARED) {
+		ana->phases[PHASE_MERGE] += merged - done;
+		ana->phases[PHASE_FREEZE] += frozen - merged;
+		ana->phases[PHASE_DUMP] += dumped - frozen;
+	}
+
+	/* A thread is idle if it is waiting for others to complete */
+	for (i = 0; i < ana->threads_num; i++) {
+		current = &ana->threads[i];
+		current->idle += done - ana->begin - (current->busy - current->mark);
+
+		if (ana->sched) {
+			current->steals += ana->sched->queues[i].steals;
+		}
+	}
+
+	sched_destroy(ana->sched);
+	ana->sched = NULL;
+
+	for (i = 0; i < ana->chunks_num; i++) {
+		if (ana->chunks[i].start) {
+			unload_file(ana, ana->chunks[i].file);
+		}
+	}
+
+	return ana->err;
+}
+
+/*
+ * Output the shared subtrees built up by the last round, either all
+ * words or the top K words of them
+ */
+static errcode_t write_shared(analysis_t *ana)
+{
+	errcode_t ret = ERR_SUCCESS;
+	int i;
+
+	if (ana->top_k == 0) {
+		/* Anything printed before MUST go out first */
+		fflush(stdout);
+
+		return out_writev(STDOUT_FILENO, ana->outs, AVAILABLE_CHARS);
+	}
+
+	/* Merge the top K of all threads into that of the first one */
+	for (i = 1; i < ana->threads_num; i++) {
+		if ((ret = topk_merge(&ana->threads[0].top,
+							  &ana->threads[i].top)) != ERR_SUCCESS) {
+			return ret;
+		}
+	}
+
+	return topk_dump(&ana->threads[0].top);
+}
+
+static errcode_t output_shared(analysis_t *ana)
+{
+	uint64_t begin;
+	errcode_t ret;
+
+	begin = get_ns();
+	ret = write_shared(ana);
+	ana->phases[PHASE_OUTPUT] += get_ns() - begin;
+
+	return ret;
+}
+
+/*
+ * Drop all words counted by the last round so that the subtrees could
+ * be built up again from scratch for the next file
+ */
+static errcode_t reset_trees(analysis_t *ana)
+{
+	thread_t *current;
+	int i;
+
+	arena_reset(&ana->arena);
+
+	for (i = 0; i < AVAILABLE_CHARS; i++) {
+		if (!(ana->roots[i]->n = create_node(&ana->arena))) {
+			return ERR_NO_MEM;
+		}
+
+		ana->outs[i].len = 0;
+	}
+
+	for (i = 0; i < ana->threads_num; i++) {
+		current = &ana->threads[i];
+		arena_reset(&current->arena);
+		table_reset(&current->table);
+		topk_reset(&current->top);
+
+		if (ana->strategy == STRATEGY_LOCAL && ana->engine == ENGINE_TRIE &&
+			!(current->root = create_node(&ana->arena))) {
+			return ERR_NO_MEM;
+		}
+	}
+
+	ana->next_merge = ana->next_dump = 0;
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Count the words of all input files altogether, in one round
+ */
+static errcode_t analyse_all(analysis_t *ana)
+{
+	errcode_t ret;
+
+	if (ana->inputs->streamed == 0 &&
+		(ret = split_chunks(ana, 0, ana->inputs->num)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	if ((ret = run_round(ana, ROUND_SHARED)) != ERR_SUCCESS) {
+		printf("Failed to analyse files\n");
+		return ret;
+	}
+
+	if ((ret = output_shared(ana)) != ERR_SUCCESS) {
+		printf("Failed to output the tree\n");
+	}
+
+	return ret;
+}
+
+/*
+ * Count the words of each input file on its own, in input order. A run
+ * of consecutive small files is counted in one round, each file by one
+ * thread as a whole, whereas each large file makes a round of its own
+ * shared by all threads
+ */
+static errcode_t analyse_per_file(analysis_t *ana)
+{
+	const inputs_t *inputs = ana->inputs;
+	uint64_t begin;
+	errcode_t ret;
+	int i, j;
+
+	for (i = 0; i < inputs->num; i = j) {
+		j = i + 1;
+
+		if (inputs->streamed == 0 &&
+			inputs->items[i].size <= ana->chunk_size) {
+			while (j < inputs->num &&
+				   inputs->items[j].size <= ana->chunk_size) {
+				j++;
+			}
+
+			if ((ret = split_chunks(ana, i, j)) != ERR_SUCCESS ||
+				(ret = run_round(ana, ROUND_PRIVATE)) != ERR_SUCCESS) {
+				printf("Failed to analyse files\n");
+				return ret;
+			}
+
+			/* Anything printed before MUST go out first */
+			fflush(stdout);
+
+			begin = get_ns();
+			ret = out_writev(STDOUT_FILENO, &ana->file_outs[i], j - i);
+			ana->phases[PHASE_OUTPUT] += get_ns() - begin;
+
+			while (i < j) {
+				out_cleanup(&ana->file_outs[i++]);
+			}
+
+			if (ret != ERR_SUCCESS) {
+				printf("Failed to output the tree\n");
+				return ret;
+			}
+
+			continue;
+		}
+
+		printf(INPUT_HEADER_FMT, inputs->items[i].path);
+
+		if ((inputs->streamed == 0 &&
+			 (ret = split_chunks(ana, i, j)) != ERR_SUCCESS) ||
+			(ret = run_round(ana, ROUND_SHARED)) != ERR_SUCCESS) {
+			printf("Failed to analyse file : %s\n", inputs->items[i].path);
+			return ret;
+		}
+
+		if ((ret = output_shared(ana)) != ERR_SUCCESS) {
+			printf("Failed to output the tree\n");
+			return ret;
+		}
+
+		if ((ret = reset_trees(ana)) != ERR_SUCCESS) {
+			return ret;
+		}
+	}
+
+	return ERR_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	analysis_t *ana = NULL;
+	inputs_t inputs;
+	const char *save = NULL, *merge = NULL, *query = NULL;
+	node_t *subtrees[AVAILABLE_CHARS];
+	int fd = -1, ret, i, threads_num = THREADS_NUM_DEF, opt, stats = 0;
+	int use_mmap = 0, use_numa = 0, per_file = 0, paths_num;
+	strategy_t strategy = STRATEGY_MUTEX;
+	engine_t engine = ENGINE_TRIE;
+	int cache_slots = 0, top_k = 0, ngram = 1, freeze = 0, threads_set = 0;
+	size_t chunk_size = CHUNK_SIZE_DEF;
+	long chunk;
+	char *end;
+	uint64_t begin;
+
+	while ((opt = getopt_long(argc, argv, "smS:c:k:t:o:i:fCNq:g:e:FT:", options, NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			stats = 1;
+			break;
+		case 'm':
+			use_mmap = 1;
+			break;
+		case 'S':
+			for (strategy = 0; strategy < STRATEGY_NUM; strategy++) {
+				if (strcmp(optarg, strategy_names[strategy]) == 0) {
+					break;
+				}
+			}
+
+			if (strategy == STRATEGY_NUM) {
+				goto usage;
+			}
+			break;
+		case 'c':
+			/* Bounded so that the slots could be counted and allocated */
+			if ((cache_slots = atol(optarg)) < 0 ||
+				atol(optarg) > CACHE_SLOTS_MAX) {
+				goto usage;
+			}
+			break;
+		case 'k':
+			if ((chunk = strtol(optarg, &end, 10)) <= 0 || *end != '\0') {
+				goto usage;
+			}
+
+			/* A chunk holds one word at least */
+			chunk_size = (chunk < WORD_LEN_MAX) ? WORD_LEN_MAX : chunk;
+			break;
+		case 't':
+			if ((top_k = atoi(optarg)) <= 0) {
+				goto usage;
+			}
+			break;
+		case 'o':
+			save = optarg;
+			break;
+		case 'i':
+			merge = optarg;
+			break;
+		case 'f':
+			per_file = 1;
+			break;
+		case 'C':
+			keep_case();
+			break;
+		case 'N':
+			use_numa = 1;
+			break;
+		case 'q':
+			query = optarg;
+			break;
+		case 'g':
+			if ((ngram = atoi(optarg)) <= 0 || ngram > NGRAM_MAX) {
+				goto usage;
+			}
+			break;
+		case 'e':
+			if ((engine = table_engine(optarg)) == ENGINE_NUM) {
+				goto usage;
+			}
+			break;
+		case 'F':
+			freeze = 1;
+			break;
+		case 'T':
+			if ((threads_num = atoi(optarg)) <= 0) {
+				goto usage;
+			}
+
+			threads_set = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	/*
+	 * Counts of different files can't be saved or merged into one, nor
+	 * queried or frozen. Only the mutex strategy builds up the shared
+	 * subtrees in a way queries could read them in between, and they
+	 * are gone once frozen. Only the tree could be queried, and the
+	 * hash tables could only be saved once frozen
+	 */
+	if (argc - optind < 1 ||
+		(per_file == 1 && (save || merge || query || freeze)) ||
+		(query && (strategy != STRATEGY_MUTEX || freeze)) ||
+		(engine == ENGINE_HASH && (query || (save && freeze == 0)))) {
+usage:
+		printf("Usage: %s [--stats] [--mmap] [--strategy mutex|lockfree|local] "
+			   "[--cache <slots>] [--chunk <size>] [--top <K>] "
+			   "[--save <snapshot file>] [--merge <snapshot or output file>] "
+			   "[--per-file] [--case-sensitive] [--numa] "
+			   "[--query <socket path>] [--ngram <N>] [--engine trie|hash] "
+			   "[--freeze] [--threads <num>] "
+			   "<text file or directory path|->... "
+			   "[<num of threads>]\n", argv[0]);
+		return ERR_BAD_PARAM;
+	}
+
+	paths_num = argc - optind;
+
+	/*
+	 * Unless given by --threads, the number of threads could still follow
+	 * a single input as it used to
+	 */
+	if (threads_set == 0 && paths_num == 2 &&
+		(ret = inputs_legacy_num(argv[optind + 1])) >= 0) {
+		threads_num = (ret > 0) ? ret : THREADS_NUM_MIN;
+		paths_num = 1;
+	}
+
+	inputs_init(&inputs);
+
+	for (i = optind; i < optind + paths_num; i++) {
+		if ((ret = inputs_add(&inputs, argv[i])) == ERR_BAD_PARAM) {
+			printf("A stream can't be mixed with other inputs : %s\n",
+				   argv[i]);
+			goto failed;
+		} else if (ret != ERR_SUCCESS) {
+			printf("Illegal text file : %s\n", argv[i]);
+			goto failed;
+		}
+	}
+
+	if (inputs.num == 0) {
+		printf("No text file found\n");
+		ret = ERR_BAD_FILE;
+		goto failed;
+	}
+
+	/* Adjust the number of threads if needed, unless nothing is known */
+	if (inputs.streamed == 0) {
+		if (inputs.total <= WORD_LEN_MAX) {
+			threads_num = 1;
+		} else if (inputs.total < WORD_LEN_MAX * threads_num) {
+			threads_num = inputs.total / WORD_LEN_MAX;
+		}
+	}
+
+	if (!(ana = setup_analysis(&inputs, threads_num, strategy, cache_slots,
+							   top_k, chunk_size, use_mmap, ngram,
+							   engine))) {
+		printf("Failed to allocate analysis_t\n");
+		ret = ERR_NO_MEM;
+		goto failed;
+	}
+
+	ana->stats = stats;
+	ana->freeze = freeze;
+
+	if (use_numa == 1) {
+		if ((ret = numa_init(&ana->numa)) != ERR_SUCCESS) {
+			printf("Failed to find out NUMA nodes\n");
+			goto failed;
+		}
+
+		ana->use_numa = 1;
+	}
+
+	/* Start from the counts of a previous run */
+	begin = get_ns();
+
+	if (merge && (ret = load_counts(merge, load_word, ana)) != ERR_SUCCESS) {
+		printf("Failed to load counts : %s\n", merge);
+		goto failed;
+	}
+
+	ana->phases[PHASE_LOAD] = get_ns() - begin;
+
+	/*
+	 * Every thread could be analysing a buffer while the reader is
+	 * filling up another one for each of them
+	 */
+	if (inputs.streamed == 1) {
+		if (strcmp(inputs.items[0].path, "-") == 0) {
+			fd = STDIN_FILENO;
+		} else if ((fd = open(inputs.items[0].path, O_RDONLY)) < 0) {
+			printf("Failed to open file : %s\n", inputs.items[0].path);
+			ret = ERR_IO;
+			goto failed;
+		}
+
+		if ((ret = stream_open(&ana->stream, fd, threads_num * 2,
+							   chunk_size, ngram - 1)) != ERR_SUCCESS) {
+			printf("Failed to set up stream : %s\n", inputs.items[0].path);
+			goto failed;
+		}
+
+		ana->streamed = 1;
+	}
+
+	if (query) {
+		if ((ret = query_start(&ana->query, query, ana->roots)) !=
+			ERR_SUCCESS) {
+			printf("Failed to listen on socket : %s\n", query);
+			goto failed;
+		}
+
+		ana->use_query = 1;
+		ana->insert = insert_sync;
+	}
+
+	if ((ret = start_pool(ana)) == ERR_SUCCESS) {
+		ret = per_file ? analyse_per_file(ana) : analyse_all(ana);
+	}
+
+	stop_pool(ana);
+
+	if (ana->use_query == 1) {
+		query_stop(&ana->query);
+	}
+
+	if (ana->streamed == 1 &&
+		stream_close(&ana->stream) != ERR_SUCCESS && ret == ERR_SUCCESS) {
+		printf("Failed to read stream : %s\n", inputs.items[0].path);
+		ret = ERR_IO;
+	}
+
+	if (ret != ERR_SUCCESS) {
+		goto failed;
+	}
+
+	begin = get_ns();
+
+	if (save) {
+		for (i = 0; i < AVAILABLE_CHARS; i++) {
+			subtrees[i] = ana->roots[i]->n;
+		}
+
+		ret = freeze ? dawg_save(&ana->dawg, save) :
+					   snapshot_save(save, subtrees);
+
+		if (ret != ERR_SUCCESS) {
+			printf("Failed to save snapshot : %s\n", save);
+			goto failed;
+		}
+	}
+
+	ana->phases[PHASE_SAVE] = get_ns() - begin;
+
+	if (stats == 1) {
+		dump_stats(ana);
+	}
+
+	ret = ERR_SUCCESS;
+
+	/* Fall through */
+
+failed:
+	if (fd > STDIN_FILENO) {
+		close(fd);
+	}
 
-failed:
 	destroy_analysis(ana);
+	inputs_cleanup(&inputs);
 
 	return ret;
 }
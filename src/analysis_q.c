@@ -0,0 +1,147 @@
+/*
+ * A handy tool to query the occurence of words in a snapshot saved by
+ * analysis_s or analysis_m, or the DAWG saved by them with --freeze,
+ * without analysing the text file again
+ *
+ * qingtao.cao.au@gmail.com
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include "snapshot.h"
+#include "dawg.h"
+#include "topk.h"
+
+static const struct option options[] = {
+	{ "stats", no_argument, NULL, 's' },
+	{ "top", required_argument, NULL, 't' },
+	{ "case-sensitive", no_argument, NULL, 'C' },
+	{ NULL, 0, NULL, 0 }
+};
+
+static errcode_t visit_out(void *arg, const char *word, const int len,
+						   const int cnt)
+{
+	return out_word((out_t *)arg, word, len, cnt);
+}
+
+/* Either of the snapshot and the DAWG is opened */
+static int count(const snapshot_t *snap, const dawg_t *dawg,
+				 const char *word)
+{
+	if (snap->data) {
+		return snapshot_count(snap, word, strlen(word));
+	}
+
+	return dawg_count(dawg, word, strlen(word));
+}
+
+static errcode_t walk(const snapshot_t *snap, const dawg_t *dawg,
+					  visit_t visit, void *arg)
+{
+	if (snap->data) {
+		return snapshot_walk(snap, visit, arg);
+	}
+
+	return dawg_walk(dawg, -1, visit, arg);
+}
+
+int main(int argc, char *argv[])
+{
+	snapshot_t snap;
+	dawg_t dawg;
+	topk_t top;
+	out_t out;
+	char buf[OUTPUT_BUF_SIZE];
+	const char *file;
+	uint64_t begin, opened;
+	int opt, i, stats = 0, top_k = 0;
+	errcode_t ret;
+
+	while ((opt = getopt_long(argc, argv, "st:C", options, NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			stats = 1;
+			break;
+		case 't':
+			if ((top_k = atoi(optarg)) <= 0) {
+				goto usage;
+			}
+			break;
+		case 'C':
+			keep_case();
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (argc - optind < 1) {
+usage:
+		printf("Usage: %s [--stats] [--top <K>] [--case-sensitive] "
+			   "<snapshot or DAWG file> [word ...]\n", argv[0]);
+		return ERR_BAD_PARAM;
+	}
+
+	file = argv[optind];
+
+	begin = get_ns();
+	dawg_init(&dawg);
+
+	if ((ret = snapshot_open(&snap, file)) != ERR_SUCCESS &&
+		(ret = dawg_open(&dawg, file)) != ERR_SUCCESS) {
+		printf("Illegal snapshot file : %s\n", file);
+		return ret;
+	}
+
+	opened = get_ns();
+
+	out_init(&out, STDOUT_FILENO, buf, sizeof(buf));
+
+	/* The given words, or the top K words, or all words */
+	if (argc - optind > 1) {
+		for (i = optind + 1, ret = ERR_SUCCESS;
+			 i < argc && ret == ERR_SUCCESS; i++) {
+			ret = out_word(&out, argv[i], strlen(argv[i]),
+						   count(&snap, &dawg, argv[i]));
+		}
+	} else if (top_k > 0) {
+		if ((ret = topk_init(&top, top_k)) == ERR_SUCCESS &&
+			(ret = walk(&snap, &dawg, topk_insert, &top)) == ERR_SUCCESS) {
+			ret = topk_dump(&top);
+		}
+
+		topk_cleanup(&top);
+	} else {
+		ret = walk(&snap, &dawg, visit_out, &out);
+	}
+
+	if (ret == ERR_SUCCESS) {
+		ret = out_flush(&out);
+	}
+
+	if (ret != ERR_SUCCESS) {
+		printf("Failed to query snapshot : %s\n", file);
+	}
+
+	if (stats == 1 && !snap.data) {
+		fprintf(stderr, "dawg_size=%zu\nstates=%zu\nedges=%zu\nwords=%zu\n"
+				"total=%lu\nopen_us=%.1f\nquery_ms=%.3f\n",
+				dawg.size, dawg.states_num, dawg.edges_num, dawg.words,
+				dawg.total, (opened - begin) / 1e3,
+				(get_ns() - opened) / 1e6);
+	} else if (stats == 1) {
+		fprintf(stderr, "snapshot_size=%lu\nnodes=%lu\nwords=%lu\n"
+				"total=%lu\nopen_us=%.1f\nquery_ms=%.3f\n",
+				snap.hdr->size, snap.hdr->nodes, snap.hdr->words,
+				snap.hdr->total, (opened - begin) / 1e3,
+				(get_ns() - opened) / 1e6);
+	}
+
+	snapshot_close(&snap);
+	dawg_cleanup(&dawg);
+
+	return ret;
+}
@@ -13,81 +13,435 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <string.h>
+#include <getopt.h>
 #include "node.h"
+#include "token.h"
+#include "cache.h"
+#include "stream.h"
+#include "pipeline.h"
+#include "topk.h"
+#include "snapshot.h"
+#include "input.h"
+#include "stats.h"
+#include "ngram.h"
+#include "table.h"
+#include "dawg.h"
 
 #define CHUNK_SIZE_MIN		64		/* MUST be longer than the longest word */
 #define CHUNK_SIZE_MAX		4096
 #define CHUNK_SIZE_DEF		(CHUNK_SIZE_MAX)
 
-int main(int argc, char *argv[])
+typedef struct analysis {
+	/* The root of the tree and the arena to allocate its nodes */
+	node_t *root;
+	arena_t arena;
+
+	/* Or the hash table counting words instead, if picked by --engine */
+	table_t table;
+	engine_t engine;
+
+	/*
+	 * The words frozen into a DAWG once counted if --freeze is given,
+	 * and the bytes of the tree or the hash table released after
+	 */
+	dawg_t dawg;
+	int freeze, frozen;
+	size_t released;
+
+	/* The cache of hot words in front of the tree, if enabled */
+	cache_t cache;
+	int cached;
+
+	/* The window of the last words if n-grams are counted */
+	ngram_t ngram;
+
+	/* The pipeline building up the tree, if enabled */
+	pipeline_t *pipeline;
+	int inserters_num, cache_slots;
+	size_t mem_cap;
+
+	/* How to read each input file */
+	int use_mmap;
+	int chunk_size;
+	char *buf;
+
+	/*
+	 * The number of words picked up, and the time spent on each phase
+	 * if --stats is given
+	 */
+	size_t tokens;
+	int stats;
+	uint64_t phases[PHASE_NUM];
+} analysis_t;
+
+static const struct option options[] = {
+	{ "stats", no_argument, NULL, 's' },
+	{ "mmap", no_argument, NULL, 'm' },
+	{ "cache", required_argument, NULL, 'c' },
+	{ "pipeline", required_argument, NULL, 'p' },
+	{ "mem-cap", required_argument, NULL, 'M' },
+	{ "top", required_argument, NULL, 't' },
+	{ "save", required_argument, NULL, 'o' },
+	{ "merge", required_argument, NULL, 'i' },
+	{ "per-file", no_argument, NULL, 'f' },
+	{ "case-sensitive", no_argument, NULL, 'C' },
+	{ "ngram", required_argument, NULL, 'g' },
+	{ "engine", required_argument, NULL, 'e' },
+	{ "freeze", no_argument, NULL, 'F' },
+	{ NULL, 0, NULL, 0 }
+};
+
+static errcode_t count_word(void *arg, const char *word, const int len,
+							const int cnt)
 {
-	node_t *root = NULL;
-	struct stat statbuf;
-	const char *file;
-	int fd, ret;
-	int frag_len, size, already_read;
-	int chunk_size = CHUNK_SIZE_DEF;
-	char fragment[WORD_LEN_MAX + 1], *buf = NULL, *buf_start, *p;
-	char *token, *saveptr;
-
-	if (argc < 2 || argc > 3) {
-		printf("Usage: %s <text file path> <chunk size>\n", argv[0]);
-		return ERR_BAD_PARAM;
+	analysis_t *ana = (analysis_t *)arg;
+
+	if (ana->engine == ENGINE_HASH) {
+		return table_insert_cnt(&ana->table, word, len, cnt);
 	}
 
-	file = argv[1];
+	return setup_node_cnt(&ana->arena, ana->root, word, len, cnt);
+}
+
+/*
+ * Build up our tree from each word in the range of [start, end)
+ */
+static errcode_t analyse(analysis_t *ana, const char *start, const char *end)
+{
+	token_t tokens[TOKENS_BATCH];
+	uint64_t begin = 0, tokenized = 0;
+	const char *word;
+	int num, i, len, ret;
 
-	if (argc == 3) {
-		chunk_size = atoi(argv[2]);
-		if (chunk_size < CHUNK_SIZE_MIN) {
-			chunk_size = CHUNK_SIZE_MIN;
-		} else if (chunk_size > CHUNK_SIZE_MAX) {
-			chunk_size = CHUNK_SIZE_MAX;
+	for (;;) {
+		/* The clock is read once for a whole batch of words */
+		if (ana->stats == 1) {
+			begin = get_ns();
+		}
+
+		if ((num = tokenize(&start, end, tokens, TOKENS_BATCH)) <= 0) {
+			break;
+		}
+
+		if (ana->stats == 1) {
+			tokenized = get_ns();
+			ana->phases[PHASE_TOKENIZE] += tokenized - begin;
+		}
+
+		ana->tokens += num;
+
+		for (i = 0; i < num; i++) {
+			word = tokens[i].word;
+			len = tokens[i].len;
+
+			/* The n-gram ending in the word, which may start long before */
+			if (ana->ngram.n > 1) {
+				if ((ret = ngram_push(&ana->ngram, word, len)) < 0) {
+					return ERR_NO_MEM;
+				} else if (ret == 0) {
+					continue;
+				}
+
+				word = ana->ngram.buf;
+				len = ana->ngram.len;
+			}
+
+			if (ana->cached == 1) {
+				ret = cache_insert(&ana->cache, word, len);
+			} else if (ana->engine == ENGINE_HASH) {
+				ret = table_insert(&ana->table, word, len);
+			} else {
+				ret = setup_node(&ana->arena, ana->root, word, len);
+			}
+
+			if (ret > 0) {
+				return ret;
+			}
+		}
+
+		if (ana->stats == 1) {
+			ana->phases[PHASE_INSERT] += get_ns() - tokenized;
 		}
 	}
 
-	if (lstat(file, &statbuf) < 0 ||
-		S_ISREG(statbuf.st_mode) == 0 ||
-		statbuf.st_size == 0) {
-		printf("Illegal text file : %s\n", file);
-		return ERR_BAD_FILE;
+	return ERR_SUCCESS;
+}
+
+/*
+ * Analyse an input of unknown length, such as a pipe, while it is being
+ * read into a pair of buffers in turn
+ */
+static errcode_t analyse_stream(analysis_t *ana, const int fd)
+{
+	stream_t stream;
+	const char *data;
+	size_t len;
+	uint64_t begin;
+	int idx;
+	errcode_t ret = ERR_SUCCESS, err;
+
+	/* Buffers needn't overlap as the window of n-grams is carried over */
+	if ((ret = stream_open(&stream, fd, 2, STREAM_BUF_SIZE,
+						   0)) != ERR_SUCCESS) {
+		return ret;
 	}
 
-	if (!(root = create_node(0)) ||
-		!(buf = (char *)malloc(chunk_size + 1))) {
-		ret = ERR_NO_MEM;
-		goto failed;
+	/* Reading is accounted by the time waiting for the reader thread */
+	for (;;) {
+		begin = get_ns();
+		idx = stream_get(&stream, NULL, &data, &len);
+		ana->phases[PHASE_READ] += get_ns() - begin;
+
+		if (idx < 0) {
+			break;
+		}
+
+		ret = analyse(ana, data, data + len);
+		stream_put(&stream, idx);
+
+		if (ret != ERR_SUCCESS) {
+			break;
+		}
 	}
 
-	if ((fd = open(file, O_RDONLY)) < 0) {
-		printf("Failed to open file : %s\n", file);
-		ret = ERR_IO;
-		goto failed;
+	if ((err = stream_close(&stream)) != ERR_SUCCESS && ret == ERR_SUCCESS) {
+		ret = err;
+	}
+
+	return ret;
+}
+
+/*
+ * Build up the tree by a pipeline of the given number of inserters
+ * reading from fd, with the memory of the pipeline itself capped
+ */
+static errcode_t analyse_pipeline(analysis_t *ana, const int fd,
+								  const int inserters_num,
+								  const size_t mem_cap, const int cache_slots)
+{
+	errcode_t ret;
+
+	if (!(ana->pipeline = pipeline_create(fd, inserters_num, mem_cap,
+										  cache_slots, ana->ngram.n))) {
+		return ERR_NO_MEM;
+	}
+
+	if ((ret = pipeline_run(ana->pipeline)) != ERR_SUCCESS) {
+		return ret;
 	}
 
+	return pipeline_merge(ana->pipeline, &ana->arena, ana->root);
+}
+
+/*
+ * Freeze the words counted into a DAWG, then release the tree or the
+ * hash table, which is never counted into again
+ */
+static errcode_t freeze_words(analysis_t *ana)
+{
+	const table_t *tables[1] = { &ana->table };
+	table_stats_t table;
+	errcode_t ret;
+	int i;
+
+	if (ana->cached == 1 && (ret = cache_flush(&ana->cache)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	if (ana->engine == ENGINE_HASH) {
+		if ((ret = table_sort(&ana->table)) == ERR_SUCCESS) {
+			ret = table_walk(tables, 1, -1, dawg_add, &ana->dawg);
+		}
+	} else {
+		ret = walk_node(ana->root, -1, dawg_add, &ana->dawg);
+	}
+
+	if (ret != ERR_SUCCESS || (ret = dawg_seal(&ana->dawg)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	memset(&table, 0, sizeof(table_stats_t));
+	table_count(&ana->table, &table);
+	ana->released = ana->arena.allocated + table.allocated;
+
+	/* Subtrees grafted from the trees of inserters are released as well */
+	if (ana->pipeline) {
+		for (i = 0; i < ana->pipeline->inserters_num; i++) {
+			ana->released += ana->pipeline->inserters[i].arena.allocated;
+			arena_release(&ana->pipeline->inserters[i].arena);
+		}
+	}
+
+	arena_release(&ana->arena);
+	table_cleanup(&ana->table);
+	ana->root = NULL;
+
+	cache_cleanup(&ana->cache);
+	ana->cached = 0;
+	ana->frozen = 1;
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Output the given number of the most frequent words in the tree, the
+ * hash table, or the DAWG
+ */
+static errcode_t dump_top(analysis_t *ana, const int k)
+{
+	const table_t *tables[1] = { &ana->table };
+	topk_t top;
+	errcode_t ret;
+
+	if ((ret = topk_init(&top, k)) != ERR_SUCCESS) {
+		goto out;
+	}
+
+	if (ana->frozen == 1) {
+		ret = dawg_walk(&ana->dawg, -1, topk_insert, &top);
+	} else if (ana->engine == ENGINE_HASH) {
+		if ((ret = table_sort(&ana->table)) == ERR_SUCCESS) {
+			ret = table_walk(tables, 1, -1, topk_insert, &top);
+		}
+	} else {
+		ret = walk_node(ana->root, -1, topk_insert, &top);
+	}
+
+	if (ret == ERR_SUCCESS) {
+		ret = topk_dump(&top);
+	}
+
+out:
+	topk_cleanup(&top);
+
+	return ret;
+}
+
+/*
+ * Save the tree into a snapshot file, the root itself stands for no
+ * alphabet and only its children are saved as subtrees
+ */
+static errcode_t save_snapshot(const node_t *root, const char *path)
+{
+	node_t *subtrees[AVAILABLE_CHARS];
+	int i;
+
+	for (i = 0; i < AVAILABLE_CHARS; i++) {
+		subtrees[i] = node_child(root, i);
+	}
+
+	return snapshot_save(path, subtrees);
+}
+
+static void dump_stats(const analysis_t *ana)
+{
+	const table_t *tables[1] = { &ana->table };
+	const cache_t *cache = &ana->cache;
+	table_stats_t table;
+	tree_stats_t tree;
+	size_t allocated, used;
+	int i;
+
+	allocated = ana->arena.allocated;
+	used = ana->arena.used;
+
+	if (ana->pipeline) {
+		for (i = 0; i < ana->pipeline->inserters_num; i++) {
+			allocated += ana->pipeline->inserters[i].arena.allocated;
+			used += ana->pipeline->inserters[i].arena.used;
+		}
+	}
+
+	stats_phases(ana->phases);
+
+	if (ana->frozen == 1) {
+		if (stats_dawg(&ana->dawg) != ERR_SUCCESS) {
+			return;
+		}
+
+		fprintf(stderr, "freeze_released=%zu\n"
+				"words=%zu\nbytes_per_word=%.1f\n"
+				"tokens=%zu\noccurences=%zu\n",
+				ana->released, ana->dawg.words,
+				ana->dawg.words ?
+				(double)dawg_bytes(&ana->dawg) / ana->dawg.words : 0.0,
+				ana->tokens, (size_t)ana->dawg.total);
+	} else if (ana->engine == ENGINE_HASH) {
+		if (stats_table(tables, 1, &table) != ERR_SUCCESS) {
+			return;
+		}
+
+		fprintf(stderr, "table_allocated=%zu\ntable_used=%zu\n"
+				"words=%zu\nbytes_per_word=%.1f\n"
+				"tokens=%zu\noccurences=%zu\n",
+				table.allocated, table.used, table.words,
+				table.words ? (double)table.used / table.words : 0.0,
+				ana->tokens, table.total);
+	} else {
+		if (stats_tree(&ana->root, 1, 0, &tree) != ERR_SUCCESS) {
+			return;
+		}
+
+		fprintf(stderr, "arena_allocated=%zu\narena_used=%zu\n"
+				"nodes=%zu\nwords=%zu\nbytes_per_word=%.1f\n"
+				"tokens=%zu\noccurences=%zu\n",
+				allocated, used, tree.nodes, tree.words,
+				tree.words ? (double)used / tree.words : 0.0,
+				ana->tokens, tree.total);
+	}
+
+	if (ana->pipeline) {
+		pipeline_stats(ana->pipeline);
+	}
+
+	if (ana->cached == 1) {
+		fprintf(stderr, "cache_hits=%zu\ncache_misses=%zu\n"
+				"cache_evictions=%zu\ncache_bypasses=%zu\n"
+				"cache_hit_rate=%.3f\n",
+				cache->hits, cache->misses, cache->evictions, cache->bypasses,
+				cache_hit_rate(cache));
+	}
+}
+
+/*
+ * Read the given regular file chunk by chunk, carrying the fragment of
+ * the word cut across by the end of a chunk over to the next one
+ */
+static errcode_t analyse_chunks(analysis_t *ana, const int fd,
+								const input_t *input)
+{
+	char fragment[CHUNK_SIZE_MAX], *buf = ana->buf, *buf_start, *buf_end, *p;
+	int frag_len, size, ret;
+	off_t already_read;
+	uint64_t begin;
+
 	frag_len = already_read = 0;
-	while (already_read <= statbuf.st_size) {
+	while (already_read <= input->size) {
 		buf_start = buf;
-		size = chunk_size;
+		size = ana->chunk_size;
 
 		if (frag_len > 0) {
 			memcpy(buf, fragment, frag_len);
-			buf[frag_len] = '\0';
 			buf_start += frag_len;
 			size -= frag_len;
 			frag_len = 0;
 		}
 
-		if ((ret = read(fd, buf_start, size)) < 0) {
-			ret = ERR_IO;
-			break;
+		buf_end = buf_start;
+		begin = get_ns();
+		ret = read(fd, buf_start, size);
+		ana->phases[PHASE_READ] += get_ns() - begin;
+
+		if (ret < 0) {
+			return ERR_IO;
 		} else if (ret == 0) {
 			if (frag_len == 0) {	/* no leftover from previous chunk */
 				break;
 			}
 		} else {
 			already_read += ret;
-			buf_start[ret] = '\0';
+			buf_end = buf_start + ret;
+			*buf_end = '\0';
 
 			/*
 			 * If more data available, the last word in current chunk
@@ -100,53 +454,374 @@ int main(int argc, char *argv[])
 			 * Fortunately, this won't happen if the chunk size is larger
 			 * than the length of the longest possible word.
 			 */
-			if (ret == size && already_read < statbuf.st_size) {
+			if (ret == size && already_read < input->size) {
 				for (p = buf_start + ret - 1, frag_len = 0;
 					 p >= buf && is_delimiter(*p) == 0;
 					 p--, frag_len++);
 
 				if (p < buf) {
-					ret = ERR_BAD_PARAM;
 					printf("The specified chunk size is too small to "
 						   "accommodate a long word (partial): %s\n", buf);
-					goto failed;
+					return ERR_BAD_PARAM;
 				} else if (frag_len > 0) {
 
 					memcpy(fragment, p + 1, frag_len);
 
 					/* Truncate the fragment of the last word */
-					*(p + 1) = '\0';
+					buf_end = p + 1;
 				}
 			}
 		}
 
-		/* Build up our tree from each token */
-		if ((token = strtok_r(buf, DELIMITER, &saveptr)) != NULL) {
-			do {
-				if ((ret = setup_node(root, token)) > 0) {
-					goto mem_failed;
-				}
-			} while ((token = strtok_r(NULL, DELIMITER, &saveptr)) != NULL);
+		if ((ret = analyse(ana, buf, buf_end)) > 0) {
+			return ret;
 		}
+	}
+
+	return ERR_SUCCESS;
+}
 
+/*
+ * Count the words of the given input into the tree
+ */
+static errcode_t analyse_file(analysis_t *ana, const input_t *input,
+							  const int streamed)
+{
+	char *data;
+	uint64_t begin;
+	int fd;
+	errcode_t ret;
+
+	/* N-grams never span files */
+	ngram_reset(&ana->ngram);
+
+	if (strcmp(input->path, "-") == 0) {
+		fd = STDIN_FILENO;
+	} else if ((fd = open(input->path, O_RDONLY)) < 0) {
+		printf("Failed to open file : %s\n", input->path);
+		return ERR_IO;
 	}
 
-	dump_node(root, "");
+	if (ana->inserters_num > 0) {
+		if ((ret = analyse_pipeline(ana, fd, ana->inserters_num, ana->mem_cap,
+									ana->cache_slots)) != ERR_SUCCESS) {
+			printf("Failed to analyse file in pipeline : %s\n", input->path);
+		}
+	} else if (streamed == 1) {
+		if ((ret = analyse_stream(ana, fd)) != ERR_SUCCESS) {
+			printf("Failed to read stream : %s\n", input->path);
+		}
+	} else if (ana->use_mmap == 1) {
+		/*
+		 * Analyse the file straight from the page cache without any copy,
+		 * the mapping only occupies virtual address space but not RAM
+		 */
+		begin = get_ns();
+		data = map_file(fd, input->size);
+		ana->phases[PHASE_READ] += get_ns() - begin;
+
+		if (!data) {
+			printf("Failed to map file : %s\n", input->path);
+			ret = ERR_IO;
+		} else {
+			ret = analyse(ana, data, data + input->size);
+			unmap_file(data, input->size);
+		}
+	} else {
+		ret = analyse_chunks(ana, fd, input);
+	}
+
+	if (fd != STDIN_FILENO) {
+		close(fd);
+	}
+
+	return ret;
+}
+
+/*
+ * Output the words counted so far, or only the top K of them
+ */
+static errcode_t dump_words(analysis_t *ana, const int top_k)
+{
+	errcode_t ret;
+
+	if (ana->cached == 1 && (ret = cache_flush(&ana->cache)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	if (top_k > 0) {
+		if ((ret = dump_top(ana, top_k)) != ERR_SUCCESS) {
+			printf("Failed to output the top %d words\n", top_k);
+			return ret;
+		}
+	} else if (ana->frozen == 1) {
+		dawg_dump(&ana->dawg);
+	} else if (ana->engine == ENGINE_HASH) {
+		table_dump(&ana->table);
+	} else {
+		dump_node(ana->root);
+	}
+
+	return ERR_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	analysis_t ana;
+	inputs_t inputs;
+	const char *save = NULL, *merge = NULL;
+	int ret, i, opt, per_file = 0, paths_num;
+	uint64_t begin;
+	int top_k = 0;
+	long mem_cap = 0;
+	char *end;
+
+	memset(&ana, 0, sizeof(analysis_t));
+	arena_init(&ana.arena);
+	table_init(&ana.table);
+	dawg_init(&ana.dawg);
+	ngram_init(&ana.ngram, 1);
+	inputs_init(&inputs);
+	ana.mem_cap = PIPELINE_MEM_CAP_DEF;
+	ana.chunk_size = CHUNK_SIZE_DEF;
+
+	while ((opt = getopt_long(argc, argv, "smc:p:M:t:o:i:fCg:e:F", options, NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			ana.stats = 1;
+			break;
+		case 'm':
+			ana.use_mmap = 1;
+			break;
+		case 'c':
+			/* Bounded so that the slots could be counted and allocated */
+			if ((ana.cache_slots = atol(optarg)) < 0 ||
+				atol(optarg) > CACHE_SLOTS_MAX) {
+				goto usage;
+			}
+			break;
+		case 'p':
+			if ((ana.inserters_num = atoi(optarg)) <= 0) {
+				goto usage;
+			}
+			break;
+		case 'M':
+			if ((mem_cap = strtol(optarg, &end, 10)) <= 0 || *end != '\0') {
+				goto usage;
+			}
+
+			ana.mem_cap = mem_cap;
+			break;
+		case 't':
+			if ((top_k = atoi(optarg)) <= 0) {
+				goto usage;
+			}
+			break;
+		case 'o':
+			save = optarg;
+			break;
+		case 'i':
+			merge = optarg;
+			break;
+		case 'f':
+			per_file = 1;
+			break;
+		case 'C':
+			keep_case();
+			break;
+		case 'g':
+			if ((ana.ngram.n = atoi(optarg)) <= 0 ||
+				ana.ngram.n > NGRAM_MAX) {
+				goto usage;
+			}
+			break;
+		case 'e':
+			if ((ana.engine = table_engine(optarg)) == ENGINE_NUM) {
+				goto usage;
+			}
+			break;
+		case 'F':
+			ana.freeze = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	/*
+	 * Counts of different files can't be saved or merged into one, nor
+	 * frozen as they are dropped once output. The hash table could only
+	 * be saved once frozen. The memory cap is that of the pipeline
+	 */
+	if (argc - optind < 1 ||
+		(per_file == 1 && (save || merge || ana.freeze)) ||
+		(mem_cap > 0 && ana.inserters_num <= 0) ||
+		(ana.engine == ENGINE_HASH && save && ana.freeze == 0)) {
+usage:
+		printf("Usage: %s [--stats] [--mmap] [--cache <slots>] "
+			   "[--pipeline <inserters> [--mem-cap <bytes>]] [--top <K>] "
+			   "[--save <snapshot file>] [--merge <snapshot or output file>] "
+			   "[--per-file] [--case-sensitive] [--ngram <N>] "
+			   "[--engine trie|hash] [--freeze] "
+			   "<text file or directory path|->... "
+			   "[<chunk size>]\n", argv[0]);
+		return ERR_BAD_PARAM;
+	}
+
+	paths_num = argc - optind;
+
+	/* The chunk size could still follow a single input */
+	if (paths_num == 2 && (ret = inputs_legacy_num(argv[optind + 1])) >= 0) {
+		ana.chunk_size = ret;
+		if (ana.chunk_size < CHUNK_SIZE_MIN) {
+			ana.chunk_size = CHUNK_SIZE_MIN;
+		} else if (ana.chunk_size > CHUNK_SIZE_MAX) {
+			ana.chunk_size = CHUNK_SIZE_MAX;
+		}
+
+		paths_num = 1;
+	}
+
+	for (i = optind; i < optind + paths_num; i++) {
+		if ((ret = inputs_add(&inputs, argv[i])) == ERR_BAD_PARAM) {
+			printf("A stream can't be mixed with other inputs : %s\n",
+				   argv[i]);
+			goto failed;
+		} else if (ret != ERR_SUCCESS) {
+			printf("Illegal text file : %s\n", argv[i]);
+			goto failed;
+		}
+	}
+
+	if (inputs.num == 0) {
+		printf("No text file found\n");
+		ret = ERR_BAD_FILE;
+		goto failed;
+	}
+
+	/* The pipeline reads one single input from start to end */
+	if (ana.inserters_num > 0 && inputs.num > 1) {
+		printf("Only one input could be analysed in pipeline\n");
+		ret = ERR_BAD_PARAM;
+		goto failed;
+	}
+
+	/* Inserters of the pipeline build up trees of their own */
+	if (ana.inserters_num > 0 && ana.engine == ENGINE_HASH) {
+		printf("The hash table can't be built up in pipeline\n");
+		ret = ERR_BAD_PARAM;
+		goto failed;
+	}
+
+	if (!(ana.root = create_node(&ana.arena)) ||
+		!(ana.buf = (char *)malloc(ana.chunk_size + 1))) {
+		ret = ERR_NO_MEM;
+		goto failed;
+	}
+
+	/* Inserters of the pipeline have their own caches */
+	if (ana.cache_slots > 0 && ana.inserters_num <= 0) {
+		if ((ret = cache_init(&ana.cache, ana.cache_slots, count_word,
+							  &ana)) != ERR_SUCCESS) {
+			printf("Failed to create the hot word cache\n");
+			goto failed;
+		}
+
+		ana.cached = 1;
+	}
+
+	/* Start from the counts of a previous run */
+	begin = get_ns();
+
+	if (merge && (ret = load_counts(merge, count_word, &ana)) != ERR_SUCCESS) {
+		printf("Failed to load counts : %s\n", merge);
+		goto failed;
+	}
+
+	ana.phases[PHASE_LOAD] = get_ns() - begin;
+
+	for (i = 0; i < inputs.num; i++) {
+		begin = get_ns();
+
+		if ((ret = analyse_file(&ana, &inputs.items[i],
+								inputs.streamed)) != ERR_SUCCESS) {
+			goto failed;
+		}
+
+		ana.phases[PHASE_COUNT] += get_ns() - begin;
+
+		if (per_file == 0) {
+			continue;
+		}
+
+		printf(INPUT_HEADER_FMT, inputs.items[i].path);
+
+		begin = get_ns();
+
+		if ((ret = dump_words(&ana, top_k)) != ERR_SUCCESS) {
+			goto failed;
+		}
+
+		ana.phases[PHASE_DUMP] += get_ns() - begin;
+
+		/* Start from scratch for the next file, reusing the same slabs */
+		arena_reset(&ana.arena);
+		table_reset(&ana.table);
+
+		if (!(ana.root = create_node(&ana.arena))) {
+			ret = ERR_NO_MEM;
+			goto failed;
+		}
+	}
+
+	begin = get_ns();
+
+	if (ana.freeze == 1 && (ret = freeze_words(&ana)) != ERR_SUCCESS) {
+		printf("Failed to freeze the words\n");
+		goto failed;
+	}
+
+	ana.phases[PHASE_FREEZE] = get_ns() - begin;
+	begin = get_ns();
+
+	if (per_file == 0 && (ret = dump_words(&ana, top_k)) != ERR_SUCCESS) {
+		goto failed;
+	}
+
+	ana.phases[PHASE_DUMP] += get_ns() - begin;
+	begin = get_ns();
+
+	if (save) {
+		ret = ana.frozen ? dawg_save(&ana.dawg, save) :
+						   save_snapshot(ana.root, save);
+
+		if (ret != ERR_SUCCESS) {
+			printf("Failed to save snapshot : %s\n", save);
+			goto failed;
+		}
+	}
+
+	ana.phases[PHASE_SAVE] = get_ns() - begin;
+
+	if (ana.stats == 1) {
+		dump_stats(&ana);
+	}
 
 	ret = ERR_SUCCESS;
 
 	/* Fall through */
 
-mem_failed:
-	close(fd);
-
 failed:
-	if (root) {
-		destroy_node(root);
-	}
+	cache_cleanup(&ana.cache);
+	pipeline_destroy(ana.pipeline);
+	ngram_cleanup(&ana.ngram);
+	table_cleanup(&ana.table);
+	dawg_cleanup(&ana.dawg);
+	arena_release(&ana.arena);
+	inputs_cleanup(&inputs);
 
-	if (buf) {
-		free(buf);
+	if (ana.buf) {
+		free(ana.buf);
 	}
 
 	return ret;
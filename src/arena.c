@@ -0,0 +1,232 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+#ifdef COMPACT_NODES
+/* Blocks are referred to in the unit of 4 bytes */
+#define ARENA_ALIGN		4
+#else
+#define ARENA_ALIGN		sizeof(void *)
+#endif
+
+#ifdef ARENA_REFS
+char *arena_slabs[ARENA_SLABS_MAX];
+
+/*
+ * Indexes of slabs released so far, to be recycled by new slabs
+ * before the never used indexes beyond the watermark
+ */
+static uint32_t slab_ids_free[ARENA_SLABS_MAX];
+static uint32_t slab_ids_free_num, slab_ids_watermark;
+
+/* The spinlock to protect above variables */
+static int slab_ids_lock;
+
+/* Set once the pool is found full, so that it is only told once */
+static int slabs_exhausted;
+
+static void lock_slab_ids(void)
+{
+	while (__atomic_exchange_n(&slab_ids_lock, 1, __ATOMIC_ACQUIRE) == 1);
+}
+
+static void unlock_slab_ids(void)
+{
+	__atomic_store_n(&slab_ids_lock, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Register the given slab in the pool, return -1 if the pool is full
+ */
+static int register_slab(slab_t *slab)
+{
+	int ret = 0;
+
+	lock_slab_ids();
+
+	if (slab_ids_free_num > 0) {
+		slab->id = slab_ids_free[--slab_ids_free_num];
+	} else if (slab_ids_watermark < ARENA_SLABS_MAX) {
+		slab->id = slab_ids_watermark++;
+	} else {
+		ret = -1;
+	}
+
+	if (ret == 0) {
+		arena_slabs[slab->id] = (char *)slab;
+	}
+
+	unlock_slab_ids();
+
+	return ret;
+}
+
+static void unregister_slab(slab_t *slab)
+{
+	lock_slab_ids();
+
+	arena_slabs[slab->id] = NULL;
+	slab_ids_free[slab_ids_free_num++] = slab->id;
+
+	unlock_slab_ids();
+}
+#endif
+
+/*
+ * Map a new slab aligned on ARENA_SLAB_SIZE so that it qualifies
+ * for a transparent huge page. Memory freshly mapped is zeroed by
+ * the kernel, so there is no need to clear nodes carved out of it.
+ */
+static slab_t *create_slab(void)
+{
+	char *p, *aligned;
+	size_t head, tail;
+
+	p = mmap(NULL, ARENA_SLAB_SIZE * 2, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		return NULL;
+	}
+
+	aligned = (char *)(((uintptr_t)p + ARENA_SLAB_SIZE - 1) &
+					   ~(ARENA_SLAB_SIZE - 1));
+	head = aligned - p;
+	tail = ARENA_SLAB_SIZE - head;
+
+	if (head > 0) {
+		munmap(p, head);
+	}
+
+	if (tail > 0) {
+		munmap(aligned + ARENA_SLAB_SIZE, tail);
+	}
+
+#ifdef MADV_HUGEPAGE
+	madvise(aligned, ARENA_SLAB_SIZE, MADV_HUGEPAGE);
+#endif
+
+#ifdef ARENA_REFS
+	if (register_slab((slab_t *)aligned) < 0) {
+		if (!__atomic_exchange_n(&slabs_exhausted, 1, __ATOMIC_RELAXED)) {
+			printf("All %u slabs of %luMB that references reach are taken\n",
+				   ARENA_SLABS_MAX, ARENA_SLAB_SIZE >> 20);
+		}
+
+		munmap(aligned, ARENA_SLAB_SIZE);
+		return NULL;
+	}
+#endif
+
+	return (slab_t *)aligned;
+}
+
+void arena_init(arena_t *arena)
+{
+	memset(arena, 0, sizeof(arena_t));
+}
+
+/*
+ * Release all slabs of the given arena at once
+ */
+void arena_release(arena_t *arena)
+{
+	slab_t *slab, *next;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		for (slab = i ? arena->spare : arena->slabs; slab; slab = next) {
+			next = slab->next;
+#ifdef ARENA_REFS
+			unregister_slab(slab);
+#endif
+			munmap(slab, ARENA_SLAB_SIZE);
+		}
+	}
+
+	arena_init(arena);
+}
+
+/*
+ * Give back all memory handed out by the given arena at once but keep
+ * its slabs for reuse, the memory used is zeroed again
+ */
+void arena_reset(arena_t *arena)
+{
+	slab_t *slab, *next;
+
+	for (slab = arena->slabs; slab; slab = next) {
+		next = slab->next;
+
+		/* Only the current slab may be partly used */
+		memset((char *)slab + sizeof(slab_t), 0,
+			   (slab == arena->slabs ? arena->cur - (char *)slab :
+				ARENA_SLAB_SIZE) - sizeof(slab_t));
+
+		slab->next = arena->spare;
+		arena->spare = slab;
+	}
+
+	arena->slabs = NULL;
+	arena->cur = arena->end = NULL;
+	arena->used = 0;
+}
+
+/*
+ * Return a zeroed memory block of the given size, or NULL
+ * if no more slab could be mapped
+ */
+void *arena_alloc(arena_t *arena, size_t size)
+{
+	slab_t *slab;
+	void *p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	assert(size <= ARENA_SLAB_SIZE - sizeof(slab_t));
+
+	if ((size_t)(arena->end - arena->cur) < size) {
+		if ((slab = arena->spare) != NULL) {
+			arena->spare = slab->next;
+			arena->allocated -= ARENA_SLAB_SIZE;
+		} else if (!(slab = create_slab())) {
+			return NULL;
+		}
+
+		slab->next = arena->slabs;
+		arena->slabs = slab;
+		arena->cur = (char *)slab + sizeof(slab_t);
+		arena->end = (char *)slab + ARENA_SLAB_SIZE;
+		arena->allocated += ARENA_SLAB_SIZE;
+	}
+
+	p = arena->cur;
+	arena->cur += size;
+	arena->used += size;
+
+	return p;
+}
+
+/*
+ * Give back the most recent block allocated from the given arena, which
+ * must have never been published to other threads. Return -1 if it is
+ * not the last one in the current slab, in which case it is left alone
+ */
+int arena_unalloc(arena_t *arena, void *p, size_t size)
+{
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if ((char *)p + size != arena->cur) {
+		return -1;
+	}
+
+	/* Keep the promise that memory from the arena is zeroed */
+	memset(p, 0, size);
+
+	arena->cur = (char *)p;
+	arena->used -= size;
+
+	return 0;
+}
@@ -0,0 +1,94 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Size of each slab requested from the kernel, which is also the
+ * size of a huge page on x86 so that a slab could be backed by one
+ * single TLB entry
+ */
+#define ARENA_SLAB_SIZE		(2UL << 20)
+
+/*
+ * The header at the beginning of every slab, which is aligned on
+ * ARENA_SLAB_SIZE so that it can be located from any address inside
+ */
+typedef struct slab {
+	struct slab *next;
+
+	/* The index of this slab in the pool of all slabs */
+	uint32_t id;
+} slab_t;
+
+/*
+ * A bump-pointer allocator for trie nodes. Memory is carved out of
+ * large slabs and never given back individually, instead all slabs
+ * are released in one go when the arena is torn down.
+ *
+ * An arena is not thread safe, each thread should have its own one.
+ */
+typedef struct arena {
+	/* The list of slabs, the most recent one first */
+	struct slab *slabs;
+
+	/* Slabs given back by arena_reset() for reuse */
+	struct slab *spare;
+
+	/* The next free byte and the end of the current slab */
+	char *cur, *end;
+
+	/* Bytes obtained from the kernel and bytes handed out respectively */
+	size_t allocated, used;
+} arena_t;
+
+void arena_init(arena_t *arena);
+void arena_release(arena_t *arena);
+void arena_reset(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size);
+int arena_unalloc(arena_t *arena, void *p, size_t size);
+
+/*
+ * References are used by compact nodes for all children, and by nodes
+ * of a byte alphabet for children other than lower case letters
+ */
+#if defined(COMPACT_NODES) || defined(BYTE_ALPHABET)
+#define ARENA_REFS
+#endif
+
+#ifdef ARENA_REFS
+/*
+ * Slabs of all arenas are registered in one global pool so that any
+ * block allocated from whichever arena could be referred to by a
+ * 32-bit reference, made of the index of its slab and its offset
+ * inside the slab in the unit of 4 bytes.
+ *
+ * The slab header lives at the offset 0, so a reference of 0 never
+ * points to a valid block and could be used as NULL.
+ */
+typedef uint32_t aref_t;
+
+#define ARENA_REF_SHIFT		19	/* log2(ARENA_SLAB_SIZE / 4) */
+#define ARENA_REF_MASK		((1U << ARENA_REF_SHIFT) - 1)
+#define ARENA_SLABS_MAX		(1U << (32 - ARENA_REF_SHIFT))
+
+extern char *arena_slabs[ARENA_SLABS_MAX];
+
+static inline void *arena_deref(const aref_t ref)
+{
+	return arena_slabs[ref >> ARENA_REF_SHIFT] + ((ref & ARENA_REF_MASK) << 2);
+}
+
+static inline aref_t arena_ref(const void *p)
+{
+	const slab_t *slab;
+
+	slab = (const slab_t *)((uintptr_t)p & ~(ARENA_SLAB_SIZE - 1));
+
+	return (slab->id << ARENA_REF_SHIFT) |
+		   (((const char *)p - (const char *)slab) >> 2);
+}
+#endif
+
+#endif	/* _ARENA_H */
@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+
+/*
+ * FNV-1a, which is good enough for short words
+ */
+static inline unsigned int hash(const char *word, const int len)
+{
+	unsigned int h = 2166136261U;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		h = (h ^ (unsigned char)word[i]) * 16777619U;
+	}
+
+	return h;
+}
+
+/*
+ * Set up a cache of at least the given number of slots, rounded up
+ * to a power of 2
+ */
+errcode_t cache_init(cache_t *cache, unsigned int slots_num,
+					 cache_flush_t flush, void *arg)
+{
+	unsigned int size = CACHE_PROBES;
+
+	memset(cache, 0, sizeof(cache_t));
+
+	if (slots_num > CACHE_SLOTS_MAX) {
+		return ERR_BAD_PARAM;
+	}
+
+	while (size < slots_num) {
+		size <<= 1;
+	}
+
+	if (!(cache->slots = (slot_t *)calloc(size, sizeof(slot_t)))) {
+		return ERR_NO_MEM;
+	}
+
+	cache->mask = size - 1;
+	cache->flush = flush;
+	cache->arg = arg;
+
+	return ERR_SUCCESS;
+}
+
+void cache_cleanup(cache_t *cache)
+{
+	if (cache->slots) {
+		free(cache->slots);
+		cache->slots = NULL;
+	}
+}
+
+/*
+ * Count one occurence of the given word. If it is not cached yet and
+ * all probed slots are taken, the least frequent of them is evicted
+ * to the tree to make room for it
+ */
+errcode_t cache_insert(cache_t *cache, const char *word, const int len)
+{
+	slot_t *slot, *victim = NULL;
+	unsigned int h;
+	int i, ret;
+
+	if (len > CACHE_WORD_MAX) {
+		cache->bypasses++;
+		return cache->flush(cache->arg, word, len, 1);
+	}
+
+	h = hash(word, len);
+
+	for (i = 0; i < CACHE_PROBES; i++) {
+		slot = &cache->slots[(h + i) & cache->mask];
+
+		if (slot->cnt == 0) {
+			victim = slot;
+			break;
+		}
+
+		if (slot->len == len && memcmp(slot->word, word, len) == 0) {
+			slot->cnt++;
+			cache->hits++;
+			return ERR_SUCCESS;
+		}
+
+		if (!victim || slot->cnt < victim->cnt) {
+			victim = slot;
+		}
+	}
+
+	cache->misses++;
+
+	if (victim->cnt > 0) {
+		cache->evictions++;
+
+		if ((ret = cache->flush(cache->arg, victim->word, victim->len,
+								victim->cnt)) != ERR_SUCCESS) {
+			return ret;
+		}
+	}
+
+	victim->cnt = 1;
+	victim->len = len;
+	memcpy(victim->word, word, len);
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Hand over all cached counters to the tree and empty the cache
+ */
+errcode_t cache_flush(cache_t *cache)
+{
+	slot_t *slot;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i <= cache->mask; i++) {
+		slot = &cache->slots[i];
+
+		if (slot->cnt == 0) {
+			continue;
+		}
+
+		if ((ret = cache->flush(cache->arg, slot->word, slot->len,
+								slot->cnt)) != ERR_SUCCESS) {
+			return ret;
+		}
+
+		slot->cnt = 0;
+	}
+
+	return ERR_SUCCESS;
+}
+
+double cache_hit_rate(const cache_t *cache)
+{
+	size_t total = cache->hits + cache->misses + cache->bypasses;
+
+	return total ? (double)cache->hits / total : 0.0;
+}
@@ -0,0 +1,60 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h>
+#include "lib.h"
+
+/*
+ * A small hash table in front of the tree, absorbing the occurences of
+ * the most frequent words so that they don't have to walk down the tree
+ * (and take its lock) every time. Words are stored inline in the slots,
+ * and those too long to fit in are passed through to the tree.
+ *
+ * A cache is not thread safe, each thread should have its own one.
+ */
+
+/* The longest word that could be cached, to make a slot 32 bytes */
+#define CACHE_WORD_MAX		27
+
+/* The number of slots probed before evicting one of them */
+#define CACHE_PROBES		4
+
+/* The most slots of a cache, 512MB of them */
+#define CACHE_SLOTS_MAX		(1U << 24)
+
+typedef struct slot {
+	/* Occurence of the word absorbed so far, 0 if slot is empty */
+	int cnt;
+
+	unsigned char len;
+	char word[CACHE_WORD_MAX];
+} slot_t;
+
+/*
+ * Hand over the counter of a word to the tree when it is evicted
+ * or when the cache is flushed
+ */
+typedef errcode_t (*cache_flush_t)(void *arg, const char *word,
+								   const int len, const int cnt);
+
+typedef struct cache {
+	/* The array of slots, whose size is a power of 2 */
+	slot_t *slots;
+	unsigned int mask;
+
+	/* Where evicted counters go */
+	cache_flush_t flush;
+	void *arg;
+
+	/* Statistics */
+	size_t hits, misses, evictions, bypasses;
+} cache_t;
+
+errcode_t cache_init(cache_t *cache, unsigned int slots_num,
+					 cache_flush_t flush, void *arg);
+void cache_cleanup(cache_t *cache);
+errcode_t cache_insert(cache_t *cache, const char *word, const int len);
+errcode_t cache_flush(cache_t *cache);
+double cache_hit_rate(const cache_t *cache);
+
+#endif	/* _CACHE_H */
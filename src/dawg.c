@@ -0,0 +1,810 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dawg.h"
+
+/* The number of slots of the register of states to start with */
+#define REGISTER_SIZE_MIN	1024
+
+/*
+ * A state not made yet, along the path of the last word added, whose
+ * edges are the pending ones from start to those of the next state
+ */
+typedef struct bframe {
+	uint32_t start;
+	uint32_t final;
+} bframe_t;
+
+/*
+ * A slot of the register, taken by the state of the given index plus 1
+ * so that 0 marks an empty slot, along with its hash so that most
+ * states are told apart without being looked at
+ */
+typedef struct rslot {
+	uint32_t hash;
+	uint32_t state;
+} rslot_t;
+
+typedef struct builder {
+	/* The arrays being built up, the number of entries they could hold */
+	uint32_t *states, *counts;
+	dawg_edge_t *edges;
+	unsigned char *labels;
+	size_t states_size, edges_size, counts_size;
+
+	/*
+	 * The number of words reached from each state made so far, and the
+	 * register of them by the hash of their edges
+	 */
+	uint32_t *sizes;
+	rslot_t *slots;
+	uint32_t mask;
+
+	/* The symbols of the last word and the states along its path */
+	unsigned char *path;
+	bframe_t *frames;
+	int depth, depth_size;
+
+	/*
+	 * The edges of the states along the path, those of each state after
+	 * those of its parent, the last one of every state but the deepest
+	 * one leading to the next state on the path. Along with the number
+	 * of words reached through each of them
+	 */
+	unsigned char *pending_labels;
+	uint32_t *pending_targets, *pending_sizes;
+	size_t pending_num, pending_size;
+} builder_t;
+
+/*
+ * Make sure the given array could hold num entries of the given size,
+ * doubling it if not
+ */
+static errcode_t reserve(void **array, size_t *size, const size_t num,
+						 const size_t unit)
+{
+	size_t n = *size ? *size : 64;
+	void *p;
+
+	if (num <= *size) {
+		return ERR_SUCCESS;
+	}
+
+	while (n < num) {
+		n *= 2;
+	}
+
+	if (!(p = realloc(*array, n * unit))) {
+		return ERR_NO_MEM;
+	}
+
+	*array = p;
+	*size = n;
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Resize the given array to hold num entries of the given size, along
+ * with another array reserved above
+ */
+static errcode_t resize(void **array, const size_t num, const size_t unit)
+{
+	void *p;
+
+	if (!(p = realloc(*array, num * unit))) {
+		return ERR_NO_MEM;
+	}
+
+	*array = p;
+
+	return ERR_SUCCESS;
+}
+
+static void builder_destroy(builder_t *b)
+{
+	if (!b) {
+		return;
+	}
+
+	free(b->states);
+	free(b->counts);
+	free(b->edges);
+	free(b->labels);
+	free(b->sizes);
+	free(b->slots);
+	free(b->path);
+	free(b->frames);
+	free(b->pending_labels);
+	free(b->pending_targets);
+	free(b->pending_sizes);
+	free(b);
+}
+
+static errcode_t builder_create(dawg_t *dawg)
+{
+	builder_t *b;
+
+	if (!(b = (builder_t *)calloc(1, sizeof(builder_t)))) {
+		return ERR_NO_MEM;
+	}
+
+	b->depth_size = WORD_LEN_MAX;
+	b->mask = REGISTER_SIZE_MIN - 1;
+
+	b->slots = (rslot_t *)calloc(REGISTER_SIZE_MIN, sizeof(rslot_t));
+	b->path = (unsigned char *)malloc(b->depth_size);
+	b->frames = (bframe_t *)malloc(sizeof(bframe_t) * (b->depth_size + 1));
+
+	if (!b->slots || !b->path || !b->frames) {
+		builder_destroy(b);
+		return ERR_NO_MEM;
+	}
+
+	/* The root, with no edge yet */
+	b->frames[0].start = b->frames[0].final = 0;
+
+	dawg->builder = b;
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * The hash of a state, made of its final flag and its edges, each of
+ * which is a symbol and the index of a state made before
+ */
+static uint32_t hash_state(const uint32_t final, const unsigned char *labels,
+						   const uint32_t *targets, const int num)
+{
+	uint64_t h = (final | num) * 0x9e3779b97f4a7c15ULL;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		h = (h ^ (((uint64_t)labels[i] << 32) | targets[i])) *
+			0xbf58476d1ce4e5b9ULL;
+		h ^= h >> 31;
+	}
+
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+/*
+ * Return non-zero if the given state made before has the same final
+ * flag and the same edges as given
+ */
+static int same_state(const builder_t *b, const uint32_t s,
+					  const uint32_t final, const unsigned char *labels,
+					  const uint32_t *targets, const int num)
+{
+	uint32_t first = b->states[s] & ~DAWG_FINAL, i;
+
+	if ((b->states[s] & DAWG_FINAL) != final ||
+		(b->states[s + 1] & ~DAWG_FINAL) - first != num) {
+		return 0;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (b->labels[first + i] != labels[i] ||
+			b->edges[first + i].target != targets[i]) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Double the slots of the register and put every state in its new slot
+ */
+static errcode_t grow_register(builder_t *b)
+{
+	rslot_t *slots, *slot;
+	uint32_t size = (b->mask + 1) * 2, pos, i;
+
+	if (!(slots = (rslot_t *)calloc(size, sizeof(rslot_t)))) {
+		return ERR_NO_MEM;
+	}
+
+	for (i = 0; i <= b->mask; i++) {
+		slot = &b->slots[i];
+
+		if (slot->state == 0) {
+			continue;
+		}
+
+		for (pos = slot->hash & (size - 1); slots[pos].state;
+			 pos = (pos + 1) & (size - 1));
+
+		slots[pos] = *slot;
+	}
+
+	free(b->slots);
+	b->slots = slots;
+	b->mask = size - 1;
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Make the state of the given depth on the path, which no more word
+ * could reach, and drop its edges from the pending ones. It is merged
+ * into the state made before with the same final flag and edges if any,
+ * or laid out after all states made so far. Either way its index and
+ * the number of words reached from it are returned
+ */
+static errcode_t make_state(dawg_t *dawg, const int depth, uint32_t *id,
+							uint32_t *size)
+{
+	builder_t *b = dawg->builder;
+	const bframe_t *f = &b->frames[depth];
+	const unsigned char *labels = b->pending_labels + f->start;
+	const uint32_t *targets = b->pending_targets + f->start;
+	const uint32_t *sizes = b->pending_sizes + f->start;
+	int num = b->pending_num - f->start, i;
+	uint32_t h, pos, s, e, acc;
+	size_t states_size, edges_size;
+	errcode_t ret;
+
+	h = hash_state(f->final, labels, targets, num);
+
+	for (pos = h & b->mask; (s = b->slots[pos].state) != 0;
+		 pos = (pos + 1) & b->mask) {
+		if (b->slots[pos].hash == h &&
+			same_state(b, s - 1, f->final, labels, targets, num)) {
+			*id = s - 1;
+			*size = b->sizes[s - 1];
+			goto out;
+		}
+	}
+
+	/* One more entry of states for the end of the edges of the last one */
+	s = dawg->states_num;
+	e = dawg->edges_num;
+
+	if (s + 1 >= DAWG_INDEX_MAX || e + num > DAWG_INDEX_MAX) {
+		printf("Too many states or edges for a DAWG\n");
+		return ERR_BAD_PARAM;
+	}
+	states_size = b->states_size;
+	edges_size = b->edges_size;
+
+	if ((ret = reserve((void **)&b->states, &b->states_size, s + 2,
+					   sizeof(uint32_t))) != ERR_SUCCESS ||
+		(ret = reserve((void **)&b->edges, &b->edges_size, e + num,
+					   sizeof(dawg_edge_t))) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	if ((b->states_size != states_size &&
+		 (ret = resize((void **)&b->sizes, b->states_size,
+					   sizeof(uint32_t))) != ERR_SUCCESS) ||
+		(b->edges_size != edges_size &&
+		 (ret = resize((void **)&b->labels, b->edges_size,
+					   1)) != ERR_SUCCESS)) {
+		return ret;
+	}
+
+	b->states[s] = e | f->final;
+	acc = f->final ? 1 : 0;
+
+	for (i = 0; i < num; i++, e++) {
+		b->labels[e] = labels[i];
+		b->edges[e].target = targets[i];
+		b->edges[e].skip = acc;
+		acc += sizes[i];
+	}
+
+	b->states[s + 1] = e;
+	b->sizes[s] = acc;
+	b->slots[pos].hash = h;
+	b->slots[pos].state = s + 1;
+
+	dawg->states_num = s + 1;
+	dawg->edges_num = e;
+	*id = s;
+	*size = acc;
+
+	/*
+	 * Keep at least half of the slots empty, most states being new ones
+	 * which are only placed after probing up to an empty slot
+	 */
+	if (dawg->states_num * 2 > (size_t)b->mask + 1 &&
+		(ret = grow_register(b)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+out:
+	b->pending_num = f->start;
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Make all states along the path deeper than the given depth, from the
+ * deepest one upwards, each then leading to from its parent
+ */
+static errcode_t make_path(dawg_t *dawg, const int depth)
+{
+	builder_t *b = dawg->builder;
+	uint32_t id, size;
+	errcode_t ret;
+
+	for (; b->depth > depth; b->depth--) {
+		if ((ret = make_state(dawg, b->depth, &id, &size)) != ERR_SUCCESS) {
+			return ret;
+		}
+
+		b->pending_targets[b->pending_num - 1] = id;
+		b->pending_sizes[b->pending_num - 1] = size;
+	}
+
+	return ERR_SUCCESS;
+}
+
+void dawg_init(dawg_t *dawg)
+{
+	memset(dawg, 0, sizeof(dawg_t));
+}
+
+void dawg_cleanup(dawg_t *dawg)
+{
+	if (dawg->data) {
+		munmap((void *)dawg->data, dawg->size);
+	} else {
+		free((void *)dawg->states);
+		free((void *)dawg->edges);
+		free((void *)dawg->counts);
+		free((void *)dawg->labels);
+	}
+
+	builder_destroy(dawg->builder);
+	dawg_init(dawg);
+}
+
+/*
+ * Add the given word and its occurence, as a visitor of the words of
+ * the tree or of the sorted hash tables. Words MUST come in the same
+ * order as the tree, a prefix before its extensions
+ */
+errcode_t dawg_add(void *arg, const char *word, const int len,
+				   const int cnt)
+{
+	dawg_t *dawg = (dawg_t *)arg;
+	builder_t *b;
+	size_t pending_size;
+	int i, idx = 0, depth;
+	errcode_t ret;
+
+	if (!dawg->builder && (ret = builder_create(dawg)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	b = dawg->builder;
+
+	/* The length of the prefix shared with the last word */
+	for (depth = 0; depth < len && depth < b->depth; depth++) {
+		if ((idx = char_symbol(word[depth])) < 0 || idx != b->path[depth]) {
+			break;
+		}
+	}
+
+	if (idx < 0 || (dawg->words > 0 &&
+					(depth == len || (depth < b->depth &&
+									  idx < b->path[depth])))) {
+		printf("Words are not added in the order of the tree\n");
+		return ERR_BAD_PARAM;
+	}
+
+	if (dawg->words >= DAWG_INDEX_MAX) {
+		printf("Too many words for a DAWG\n");
+		return ERR_BAD_PARAM;
+	}
+
+	/* The states off the path of the new word could be made now */
+	if ((ret = make_path(dawg, depth)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	if (len >= b->depth_size) {
+		if ((ret = resize((void **)&b->path, len * 2, 1)) != ERR_SUCCESS ||
+			(ret = resize((void **)&b->frames, len * 2 + 1,
+						  sizeof(bframe_t))) != ERR_SUCCESS) {
+			return ret;
+		}
+
+		b->depth_size = len * 2;
+	}
+
+	pending_size = b->pending_size;
+
+	if ((ret = reserve((void **)&b->pending_targets, &b->pending_size,
+					   b->pending_num + len - depth,
+					   sizeof(uint32_t))) != ERR_SUCCESS ||
+		(b->pending_size != pending_size &&
+		 ((ret = resize((void **)&b->pending_labels, b->pending_size,
+						1)) != ERR_SUCCESS ||
+		  (ret = resize((void **)&b->pending_sizes, b->pending_size,
+						sizeof(uint32_t))) != ERR_SUCCESS)) ||
+		(ret = reserve((void **)&b->counts, &b->counts_size,
+					   dawg->words + 1, sizeof(uint32_t))) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	/* The rest of the word goes down a new path */
+	for (i = depth; i < len; i++) {
+		if ((idx = char_symbol(word[i])) < 0) {
+			printf("Words are not added in the order of the tree\n");
+			return ERR_BAD_PARAM;
+		}
+
+		b->path[i] = idx;
+		b->pending_labels[b->pending_num] = idx;
+		b->pending_targets[b->pending_num++] = 0;
+
+		b->frames[i + 1].start = b->pending_num;
+		b->frames[i + 1].final = 0;
+	}
+
+	b->frames[len].final = DAWG_FINAL;
+	b->depth = len;
+
+	b->counts[dawg->words++] = cnt;
+	dawg->total += cnt;
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Make all states left once all words are added, the root the last one,
+ * and give back the room the arrays have grown for but left unused
+ */
+errcode_t dawg_seal(dawg_t *dawg)
+{
+	builder_t *b;
+	uint32_t root, size;
+	void *p;
+	errcode_t ret;
+
+	if (!dawg->builder && (ret = builder_create(dawg)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	b = dawg->builder;
+
+	if ((ret = make_path(dawg, 0)) != ERR_SUCCESS ||
+		(ret = make_state(dawg, 0, &root, &size)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	if ((p = realloc(b->states, sizeof(uint32_t) * (dawg->states_num + 1)))) {
+		b->states = (uint32_t *)p;
+	}
+
+	if (dawg->edges_num > 0 &&
+		(p = realloc(b->edges, sizeof(dawg_edge_t) * dawg->edges_num))) {
+		b->edges = (dawg_edge_t *)p;
+	}
+
+	if (dawg->edges_num > 0 && (p = realloc(b->labels, dawg->edges_num))) {
+		b->labels = (unsigned char *)p;
+	}
+
+	if (dawg->words > 0 &&
+		(p = realloc(b->counts, sizeof(uint32_t) * dawg->words))) {
+		b->counts = (uint32_t *)p;
+	}
+
+	/* The arrays are handed over to the graph, the rest are dropped */
+	dawg->states = b->states;
+	dawg->edges = b->edges;
+	dawg->labels = b->labels;
+	dawg->counts = b->counts;
+
+	b->states = b->counts = NULL;
+	b->edges = NULL;
+	b->labels = NULL;
+
+	builder_destroy(b);
+	dawg->builder = NULL;
+
+	return ERR_SUCCESS;
+}
+
+static inline uint32_t dawg_root(const dawg_t *dawg)
+{
+	return dawg->states_num - 1;
+}
+
+static inline uint32_t first_edge(const dawg_t *dawg, const uint32_t s)
+{
+	return dawg->states[s] & ~DAWG_FINAL;
+}
+
+/*
+ * Return the edge of the given symbol out of the given state, -1 if
+ * there is none. Edges are sorted by their symbols, whose labels are
+ * next to each other in one or two cache lines
+ */
+static inline int64_t find_edge(const dawg_t *dawg, const uint32_t s,
+								const int idx)
+{
+	uint32_t e = first_edge(dawg, s), end = first_edge(dawg, s + 1);
+
+	for (; e < end && dawg->labels[e] < idx; e++);
+
+	return (e < end && dawg->labels[e] == idx) ? (int64_t)e : -1;
+}
+
+/*
+ * Return the occurence of the given word, 0 if never seen
+ */
+int dawg_count(const dawg_t *dawg, const char *word, const int len)
+{
+	uint32_t s, rank = 0;
+	int64_t e;
+	int i, idx;
+
+	if (dawg->states_num == 0) {
+		return 0;
+	}
+
+	for (i = 0, s = dawg_root(dawg); i < len; i++) {
+		if ((idx = char_symbol(word[i])) < 0 ||
+			(e = find_edge(dawg, s, idx)) < 0) {
+			return 0;
+		}
+
+		rank += dawg->edges[e].skip;
+		s = dawg->edges[e].target;
+	}
+
+	return (dawg->states[s] & DAWG_FINAL) ? dawg->counts[rank] : 0;
+}
+
+/* The next edge to follow out of a state and the end of its edges */
+typedef struct wframe {
+	uint32_t next, end;
+} wframe_t;
+
+/*
+ * Visit every word in the graph in alphabetical order, the same as
+ * walk_node() on the tree frozen. Or only those starting with the
+ * given symbol, unless idx is -1.
+ *
+ * States shared by many words are walked through once for each of
+ * them, while their occurences are simply taken one after another
+ */
+errcode_t dawg_walk(const dawg_t *dawg, const int idx, visit_t visit,
+					void *arg)
+{
+	wframe_t *frames, *f;
+	char *path, *p;
+	uint32_t s, rank = 0, e;
+	int64_t first;
+	int depth = WORD_LEN_MAX, top = 0, base = 0;
+	errcode_t ret = ERR_SUCCESS;
+
+	if (dawg->states_num == 0) {
+		return ERR_SUCCESS;
+	}
+
+	frames = (wframe_t *)malloc(sizeof(wframe_t) * depth);
+	path = (char *)malloc(depth);
+
+	if (!frames || !path) {
+		ret = ERR_NO_MEM;
+		goto out;
+	}
+
+	s = dawg_root(dawg);
+
+	if (idx >= 0) {
+		if ((first = find_edge(dawg, s, idx)) < 0) {
+			goto out;
+		}
+
+		rank = dawg->edges[first].skip;
+		s = dawg->edges[first].target;
+		path[base++] = INDEX_CHAR(idx);
+	}
+
+	frames[0].next = first_edge(dawg, s);
+	frames[0].end = first_edge(dawg, s + 1);
+
+	if ((dawg->states[s] & DAWG_FINAL) &&
+		(ret = visit(arg, path, base, dawg->counts[rank++])) != 0) {
+		goto out;
+	}
+
+	while (top >= 0) {
+		f = &frames[top];
+
+		if (f->next == f->end) {
+			top--;
+			continue;
+		}
+
+		e = f->next++;
+
+		if (base + top + 1 == depth) {
+			depth *= 2;
+
+			if (!(f = (wframe_t *)realloc(frames, sizeof(wframe_t) * depth))) {
+				ret = ERR_NO_MEM;
+				goto out;
+			}
+
+			frames = f;
+
+			if (!(p = (char *)realloc(path, depth))) {
+				ret = ERR_NO_MEM;
+				goto out;
+			}
+
+			path = p;
+		}
+
+		path[base + top] = INDEX_CHAR(dawg->labels[e]);
+		s = dawg->edges[e].target;
+
+		f = &frames[++top];
+		f->next = first_edge(dawg, s);
+		f->end = first_edge(dawg, s + 1);
+
+		if ((dawg->states[s] & DAWG_FINAL) &&
+			(ret = visit(arg, path, base + top, dawg->counts[rank++])) != 0) {
+			goto out;
+		}
+	}
+
+out:
+	free(frames);
+	free(path);
+
+	return ret;
+}
+
+static errcode_t visit_out(void *arg, const char *word, const int len,
+						   const int cnt)
+{
+	return out_word((out_t *)arg, word, len, cnt);
+}
+
+errcode_t dawg_output(out_t *out, const dawg_t *dawg, const int idx)
+{
+	return dawg_walk(dawg, idx, visit_out, out);
+}
+
+/*
+ * Output every word in the graph on stdout
+ */
+void dawg_dump(const dawg_t *dawg)
+{
+	char buf[OUTPUT_BUF_SIZE];
+	out_t out;
+
+	/* Anything printed before MUST go out first */
+	fflush(stdout);
+
+	out_init(&out, STDOUT_FILENO, buf, sizeof(buf));
+
+	if (dawg_output(&out, dawg, -1) != ERR_SUCCESS ||
+		out_flush(&out) != ERR_SUCCESS) {
+		printf("Failed to output the graph\n");
+	}
+}
+
+/*
+ * Save the arrays of the graph as they are, following the header, into
+ * a temporary file renamed over the given one once complete
+ */
+errcode_t dawg_save(const dawg_t *dawg, const char *path)
+{
+	char buf[OUTPUT_BUF_SIZE];
+	char temp[PATH_MAX];
+	dawg_header_t hdr;
+	out_t out;
+	int fd;
+	errcode_t ret;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, DAWG_MAGIC, sizeof(hdr.magic));
+	hdr.version = DAWG_VERSION;
+	hdr.chars = AVAILABLE_CHARS;
+	hdr.size = sizeof(hdr) + dawg_bytes(dawg);
+	hdr.states = dawg->states_num;
+	hdr.edges = dawg->edges_num;
+	hdr.words = dawg->words;
+	hdr.total = dawg->total;
+
+	if ((fd = out_create(path, temp, sizeof(temp))) < 0) {
+		return ERR_IO;
+	}
+
+	out_init(&out, fd, buf, sizeof(buf));
+
+	if ((ret = out_bytes(&out, &hdr, sizeof(hdr))) != ERR_SUCCESS ||
+		(ret = out_bytes(&out, dawg->states, sizeof(uint32_t) *
+						 (dawg->states_num + 1))) != ERR_SUCCESS ||
+		(ret = out_bytes(&out, dawg->edges, sizeof(dawg_edge_t) *
+						 dawg->edges_num)) != ERR_SUCCESS ||
+		(ret = out_bytes(&out, dawg->counts, sizeof(uint32_t) *
+						 dawg->words)) != ERR_SUCCESS ||
+		(ret = out_bytes(&out, dawg->labels,
+						 dawg->edges_num)) != ERR_SUCCESS) {
+		goto out;
+	}
+
+	ret = out_flush(&out);
+
+out:
+	return out_replace(fd, temp, path, ret);
+}
+
+/*
+ * Map the graph saved in the given file, which is used straight from
+ * the mapping without being loaded
+ */
+errcode_t dawg_open(dawg_t *dawg, const char *path)
+{
+	const dawg_header_t *hdr;
+	struct stat statbuf;
+	const char *data;
+	void *p;
+	int fd;
+
+	dawg_init(dawg);
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return ERR_IO;
+	}
+
+	if (fstat(fd, &statbuf) < 0 || statbuf.st_size < sizeof(dawg_header_t)) {
+		close(fd);
+		return ERR_BAD_FILE;
+	}
+
+	p = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (p == MAP_FAILED) {
+		return ERR_IO;
+	}
+
+	data = (const char *)p;
+	hdr = (const dawg_header_t *)data;
+
+	dawg->data = data;
+	dawg->size = statbuf.st_size;
+	dawg->states_num = hdr->states;
+	dawg->edges_num = hdr->edges;
+	dawg->words = hdr->words;
+	dawg->total = hdr->total;
+
+	if (memcmp(hdr->magic, DAWG_MAGIC, sizeof(hdr->magic)) != 0 ||
+		hdr->version != DAWG_VERSION || hdr->chars != AVAILABLE_CHARS ||
+		hdr->size != statbuf.st_size || hdr->states == 0 ||
+		hdr->states >= DAWG_INDEX_MAX || hdr->edges > DAWG_INDEX_MAX ||
+		hdr->words > DAWG_INDEX_MAX ||
+		hdr->size != sizeof(dawg_header_t) + dawg_bytes(dawg)) {
+		dawg_cleanup(dawg);
+		return ERR_BAD_FILE;
+	}
+
+	dawg->states = (const uint32_t *)(data + sizeof(dawg_header_t));
+	dawg->edges = (const dawg_edge_t *)(dawg->states + dawg->states_num + 1);
+	dawg->counts = (const uint32_t *)(dawg->edges + dawg->edges_num);
+	dawg->labels = (const unsigned char *)(dawg->counts + dawg->words);
+
+	if (dawg->states[dawg->states_num] != dawg->edges_num) {
+		dawg_cleanup(dawg);
+		return ERR_BAD_FILE;
+	}
+
+	return ERR_SUCCESS;
+}
@@ -0,0 +1,108 @@
+#ifndef _DAWG_H
+#define _DAWG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lib.h"
+#include "node.h"
+
+/*
+ * The words counted, frozen into a minimized DAWG (directed acyclic word
+ * graph) once counting is done. It is the tree with all nodes of the
+ * same final flag and the same children, recursively, merged into one
+ * state, so that a suffix shared by many words such as "ing" or "tion"
+ * is kept once rather than under every prefix.
+ *
+ * Since a state may stand for many words, occurences are not kept in
+ * states but in a side array in the order of the words. Every edge
+ * tells how many words come before those reached through it among the
+ * words of its state, so the index of a word is summed up on the way
+ * down, and a walk over all words in order simply steps through them.
+ *
+ * Built up from words fed in the order of the tree, one state is made
+ * whenever no more words could reach it and is then either merged into
+ * an equal state made before, or laid out after all of them. So the
+ * whole graph is a few flat arrays of 32-bit indexes, ready to be saved
+ * and mapped as they are:
+ *
+ *	states[]		the first edge of each state and its final flag,
+ *					followed by one more entry for the end of the
+ *					edges of the last state, which is the root
+ *	edges[]			the state each edge leads to and the number of
+ *					words before it, those of a state in the order
+ *					of their symbols
+ *	counts[]		occurence of each word in the order of the tree
+ *	labels[]		the symbol of each edge
+ */
+#define DAWG_MAGIC			"WORDDAWG"
+#define DAWG_VERSION		1
+
+/* The final flag in states[], set if the word of the state is counted */
+#define DAWG_FINAL			(1U << 31)
+
+/*
+ * States, edges and words are all below the final flag, so that edge
+ * indexes never run into it, nor do skips summed up by lookups overflow
+ */
+#define DAWG_INDEX_MAX		(DAWG_FINAL - 1)
+
+typedef struct dawg_edge {
+	uint32_t target;
+	uint32_t skip;
+} dawg_edge_t;
+
+typedef struct dawg_header {
+	char magic[8];
+	uint32_t version;
+
+	/* The number of alphabets, which fixes the meaning of labels */
+	uint32_t chars;
+
+	/* The size of the whole file */
+	uint64_t size;
+
+	/* The number of states, edges, distinct words and all words */
+	uint64_t states;
+	uint64_t edges;
+	uint64_t words;
+	uint64_t total;
+} dawg_header_t;
+
+typedef struct dawg {
+	const uint32_t *states;
+	const dawg_edge_t *edges;
+	const uint32_t *counts;
+	const unsigned char *labels;
+
+	size_t states_num, edges_num, words;
+	uint64_t total;
+
+	/* The file mapped if opened rather than built up */
+	const char *data;
+	size_t size;
+
+	/* The states not made yet while words are being added */
+	struct builder *builder;
+} dawg_t;
+
+/* The number of bytes taken by the arrays of the given graph */
+static inline size_t dawg_bytes(const dawg_t *dawg)
+{
+	return sizeof(uint32_t) * (dawg->states_num + 1 + dawg->words) +
+		   (sizeof(dawg_edge_t) + 1) * dawg->edges_num;
+}
+
+void dawg_init(dawg_t *dawg);
+void dawg_cleanup(dawg_t *dawg);
+errcode_t dawg_add(void *arg, const char *word, const int len,
+				   const int cnt);
+errcode_t dawg_seal(dawg_t *dawg);
+int dawg_count(const dawg_t *dawg, const char *word, const int len);
+errcode_t dawg_walk(const dawg_t *dawg, const int idx, visit_t visit,
+					void *arg);
+errcode_t dawg_output(out_t *out, const dawg_t *dawg, const int idx);
+void dawg_dump(const dawg_t *dawg);
+errcode_t dawg_save(const dawg_t *dawg, const char *path);
+errcode_t dawg_open(dawg_t *dawg, const char *path);
+
+#endif	/* _DAWG_H */
@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "input.h"
+#include "stream.h"
+
+void inputs_init(inputs_t *inputs)
+{
+	memset(inputs, 0, sizeof(inputs_t));
+}
+
+void inputs_cleanup(inputs_t *inputs)
+{
+	int i;
+
+	for (i = 0; i < inputs->num; i++) {
+		free(inputs->items[i].path);
+	}
+
+	free(inputs->items);
+	inputs_init(inputs);
+}
+
+static errcode_t append(inputs_t *inputs, const char *path, const size_t size)
+{
+	input_t *items;
+	int num;
+
+	if (inputs->num == inputs->size) {
+		num = inputs->size ? inputs->size * 2 : 16;
+
+		if (!(items = (input_t *)realloc(inputs->items,
+										 sizeof(input_t) * num))) {
+			return ERR_NO_MEM;
+		}
+
+		inputs->items = items;
+		inputs->size = num;
+	}
+
+	if (!(inputs->items[inputs->num].path = strdup(path))) {
+		return ERR_NO_MEM;
+	}
+
+	inputs->items[inputs->num++].size = size;
+	inputs->total += size;
+
+	return ERR_SUCCESS;
+}
+
+static int skip_entry(const struct dirent *entry)
+{
+	return strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..");
+}
+
+/*
+ * Add all non-empty regular files under the given directory and its
+ * subdirectories, anything else found there is silently skipped
+ */
+static errcode_t add_dir(inputs_t *inputs, const char *dir)
+{
+	struct dirent **entries;
+	struct stat statbuf;
+	char path[PATH_MAX];
+	errcode_t ret = ERR_SUCCESS;
+	int num, i;
+
+	if ((num = scandir(dir, &entries, skip_entry, alphasort)) < 0) {
+		return ERR_BAD_FILE;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (ret != ERR_SUCCESS) {
+			goto next;
+		}
+
+		if (snprintf(path, sizeof(path), "%s/%s", dir,
+					 entries[i]->d_name) >= sizeof(path) ||
+			lstat(path, &statbuf) < 0) {
+			ret = ERR_BAD_FILE;
+		} else if (S_ISDIR(statbuf.st_mode)) {
+			ret = add_dir(inputs, path);
+		} else if (S_ISREG(statbuf.st_mode) && statbuf.st_size > 0) {
+			ret = append(inputs, path, statbuf.st_size);
+		}
+
+next:
+		free(entries[i]);
+	}
+
+	free(entries);
+
+	return ret;
+}
+
+/*
+ * Add the given text file, or all files under the given directory, to
+ * the list of inputs. Return ERR_BAD_FILE if it can't be analysed or
+ * ERR_BAD_PARAM if a stream would be mixed with any other input
+ */
+errcode_t inputs_add(inputs_t *inputs, const char *path)
+{
+	struct stat statbuf;
+	int streamed;
+
+	if (inputs->streamed == 1) {
+		return ERR_BAD_PARAM;
+	}
+
+	if (strcmp(path, "-") && lstat(path, &statbuf) == 0 &&
+		S_ISDIR(statbuf.st_mode)) {
+		return add_dir(inputs, path);
+	}
+
+	if ((streamed = stream_probe(path, &statbuf)) < 0) {
+		return ERR_BAD_FILE;
+	}
+
+	if (streamed == 1) {
+		if (inputs->num > 0) {
+			return ERR_BAD_PARAM;
+		}
+
+		inputs->streamed = 1;
+		return append(inputs, path, 0);
+	}
+
+	return append(inputs, path, statbuf.st_size);
+}
+
+/*
+ * Return the number given by the legacy trailing argument, or -1 if
+ * it is the path of another input rather than a number
+ */
+int inputs_legacy_num(const char *arg)
+{
+	struct stat statbuf;
+	const char *p;
+
+	for (p = arg; *p >= '0' && *p <= '9'; p++);
+
+	if (p == arg || *p != '\0' || lstat(arg, &statbuf) == 0) {
+		return -1;
+	}
+
+	return atoi(arg);
+}
+
+/*
+ * Read the whole content of the given regular file into buf, which
+ * MUST be large enough to hold it
+ */
+errcode_t input_read(const input_t *input, char *buf)
+{
+	return input_read_range(input, buf, 0, input->size);
+}
+
+/*
+ * Read the given range of the input file into the same range of the
+ * buffer holding the whole file
+ */
+errcode_t input_read_range(const input_t *input, char *buf, const size_t off,
+						   const size_t len)
+{
+	ssize_t ret;
+	size_t done;
+	int fd;
+
+	if ((fd = open(input->path, O_RDONLY)) < 0) {
+		return ERR_IO;
+	}
+
+	for (done = 0; done < len; done += ret) {
+		if ((ret = pread(fd, buf + off + done, len - done,
+						 off + done)) <= 0) {
+			close(fd);
+			return ERR_IO;
+		}
+	}
+
+	close(fd);
+
+	return ERR_SUCCESS;
+}
+
+errcode_t input_header(out_t *out, const input_t *input)
+{
+	char buf[PATH_MAX + 16];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), INPUT_HEADER_FMT, input->path);
+
+	return out_bytes(out, buf, len < sizeof(buf) ? len : sizeof(buf) - 1);
+}
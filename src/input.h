@@ -0,0 +1,42 @@
+#ifndef _INPUT_H
+#define _INPUT_H
+
+#include <stddef.h>
+#include "lib.h"
+#include "output.h"
+
+/*
+ * The inputs to be analysed in one run, either text files named on the
+ * command line along with all non-empty regular files found under named
+ * directories (in alphabetical order), or one single stream such as
+ * stdin or a pipe, which can't be mixed with any other input
+ */
+typedef struct input {
+	char *path;
+	size_t size;
+} input_t;
+
+typedef struct inputs {
+	input_t *items;
+	int num, size;
+
+	/* Whether the only input is a stream of unknown length */
+	int streamed;
+
+	/* The total size of all regular files */
+	size_t total;
+} inputs_t;
+
+/* The line heading the output of each input in per file mode */
+#define INPUT_HEADER_FMT	"==> %s <==\n"
+
+void inputs_init(inputs_t *inputs);
+void inputs_cleanup(inputs_t *inputs);
+errcode_t inputs_add(inputs_t *inputs, const char *path);
+int inputs_legacy_num(const char *arg);
+errcode_t input_read(const input_t *input, char *buf);
+errcode_t input_read_range(const input_t *input, char *buf, const size_t off,
+						   const size_t len);
+errcode_t input_header(out_t *out, const input_t *input);
+
+#endif	/* _INPUT_H */
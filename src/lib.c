@@ -1,31 +1,116 @@
 #include <sys/syscall.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <time.h>
+#include "lib.h"
 
 const int WORD_LEN_MAX = 64;
 
 const char *DELIMITER = " \t\n\"\',.:!?=";
 const int DELIMITER_NUM = 11;
 
+#define DELIMITERS														\
+	[' '] = CHAR_DELIMITER, ['\t'] = CHAR_DELIMITER, ['\n'] = CHAR_DELIMITER,	\
+	['"'] = CHAR_DELIMITER, ['\''] = CHAR_DELIMITER, [','] = CHAR_DELIMITER,	\
+	['.'] = CHAR_DELIMITER, [':'] = CHAR_DELIMITER, ['!'] = CHAR_DELIMITER,	\
+	['?'] = CHAR_DELIMITER, ['='] = CHAR_DELIMITER
+
+#ifdef BYTE_ALPHABET
+/*
+ * The class of every byte, which is the byte itself with ASCII upper
+ * case folded, or CHAR_DELIMITER for those in DELIMITER, or CHAR_ILLEGAL
+ * for control characters. Symbols are filled in by alphabet_init()
+ *
+ * NOTE: must be consistent with DELIMITER
+ */
+char_class_t char_class[256] = {
+	[0 ... 255] = CHAR_ILLEGAL,
+	DELIMITERS
+};
+
+__attribute__((constructor))
+static void alphabet_init(void)
+{
+	int c;
+
+	for (c = 0x20; c < 256; c++) {
+		if (c != 0x7f && char_class[c] == CHAR_ILLEGAL) {
+			char_class[c] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+		}
+	}
+}
+
+/*
+ * Stop folding ASCII upper case, so that "The" and "the" are counted
+ * as different words
+ */
+void keep_case(void)
+{
+	int c;
+
+	for (c = 'A'; c <= 'Z'; c++) {
+		char_class[c] = c;
+	}
+}
+#else
+#ifdef SEPARATOR_IDX
+#define ALPHABET_BASE		(SEPARATOR_IDX + 1)
+#else
+#define ALPHABET_BASE		0
+#endif
+
+#define ALPHABET(c)		[c] = c - 'a' + ALPHABET_BASE,					\
+						[c - 'a' + 'A'] = c - 'a' + ALPHABET_BASE
+
+/*
+ * The class of every byte, which is the index of a case-folded alphabet
+ * (after the separator of n-grams if any), or CHAR_DELIMITER for those in
+ * DELIMITER, or CHAR_ILLEGAL otherwise.
+ * So that a byte could be classified and folded by one lookup.
+ *
+ * NOTE: must be consistent with DELIMITER
+ */
+char_class_t char_class[256] = {
+	[0 ... 255] = CHAR_ILLEGAL,
+	ALPHABET('a'), ALPHABET('b'), ALPHABET('c'), ALPHABET('d'),
+	ALPHABET('e'), ALPHABET('f'), ALPHABET('g'), ALPHABET('h'),
+	ALPHABET('i'), ALPHABET('j'), ALPHABET('k'), ALPHABET('l'),
+	ALPHABET('m'), ALPHABET('n'), ALPHABET('o'), ALPHABET('p'),
+	ALPHABET('q'), ALPHABET('r'), ALPHABET('s'), ALPHABET('t'),
+	ALPHABET('u'), ALPHABET('v'), ALPHABET('w'), ALPHABET('x'),
+	ALPHABET('y'), ALPHABET('z'),
+	DELIMITERS
+};
+
+/*
+ * Stop folding upper case, which has no room among 26 alphabets, so
+ * words with any upper case letter become illegal
+ */
+void keep_case(void)
+{
+	int c;
+
+	for (c = 'A'; c <= 'Z'; c++) {
+		char_class[c] = CHAR_ILLEGAL;
+	}
+}
+#endif
+
 pid_t get_tid(void)
 {
 	return syscall(SYS_gettid);
 }
 
 /*
- * Return 1 if the givn charater is one of delimiter chars
- * 0 otherwise
+ * Return a monotonic timestamp in nanoseconds
  */
-int is_delimiter(const char c)
+uint64_t get_ns(void)
 {
-	int i;
+	struct timespec ts;
 
-	for (i = 0; i < DELIMITER_NUM; i++) {
-		if (c == DELIMITER[i]) {
-			return 1;
-		}
-	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	return 0;
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
 /*
@@ -34,15 +119,34 @@ int is_delimiter(const char c)
  */
 int to_lowercase(const char c)
 {
-	int lc = c;
+	int idx = char_class[(unsigned char)c];
 
-	if (lc >= 'A' && lc <= 'Z') {
-		lc += 'a' - 'A';
-	}
+	return (idx < 0) ? -1 : INDEX_CHAR(idx);
+}
+
+/*
+ * Map the whole content of the given file read-only, hinting the kernel
+ * that it will be read sequentially so that readahead could be more
+ * aggressive, and backed by huge pages if possible
+ */
+char *map_file(const int fd, const size_t size)
+{
+	char *data;
 
-	if (lc < 'a' || c > 'z') {
-		return -1;
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		return NULL;
 	}
 
-	return lc;
+	madvise(data, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+	madvise(data, size, MADV_HUGEPAGE);
+#endif
+
+	return data;
+}
+
+void unmap_file(char *data, const size_t size)
+{
+	munmap(data, size);
 }
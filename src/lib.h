@@ -4,12 +4,67 @@
 
 #include <sys/syscall.h>
 #include <unistd.h>
+#include <stddef.h>
+#include <stdint.h>
 
+#ifdef BYTE_ALPHABET
+/*
+ * Every byte other than delimiters and control characters is a symbol
+ * of its own, so that words of digits, hyphens or UTF-8 sequences are
+ * counted byte by byte rather than dropped
+ */
+#define AVAILABLE_CHARS	256
+
+/* The byte of the given index in the children of a node */
+#define INDEX_CHAR(idx)		((char)(idx))
+
+/* Symbols in stats keys, which may well be unprintable */
+#define INDEX_FMT			"%02x"
+#define INDEX_ARG(idx)		(idx)
+
+/* The space between words of an n-gram is a symbol of its own */
+#define SEPARATOR_IDX		' '
+
+typedef int16_t char_class_t;
+#elif defined(COMPACT_NODES)
+/*
+ * The 26 alphabets follow the space between words of an n-gram, so that
+ * n-grams are sorted the same as by their bytes
+ */
+#define AVAILABLE_CHARS	27
+
+#define SEPARATOR_IDX		0
+
+/* The alphabet of the given index in the children of a node */
+#define INDEX_CHAR(idx)		(" abcdefghijklmnopqrstuvwxyz"[(idx)])
+
+#define INDEX_FMT			"%c"
+#define INDEX_ARG(idx)		INDEX_CHAR(idx)
+
+typedef signed char char_class_t;
+#else
+/*
+ * Nodes of 26 alphabets keep a pointer for every symbol, so there is no
+ * separator of n-grams, which would take one more in every node
+ */
 #define AVAILABLE_CHARS	26
 
+#define INDEX_CHAR(idx)		('a' + (idx))
+
+#define INDEX_FMT			"%c"
+#define INDEX_ARG(idx)		INDEX_CHAR(idx)
+
+typedef signed char char_class_t;
+#endif
+
+/* Classes of characters other than alphabets in char_class[] */
+#define CHAR_ILLEGAL		-1
+#define CHAR_DELIMITER		-2
+
 extern const int WORD_LEN_MAX;
 extern const char *DELIMITER;
 extern const int DELIMITER_NUM;
+extern char_class_t char_class[256];
 
 typedef enum {
 	ERR_SUCCESS = 0,
@@ -19,8 +74,40 @@ typedef enum {
 	ERR_BAD_PARAM
 } errcode_t;
 
-int is_delimiter(const char c);
+/*
+ * Return the symbol of the given byte in the tree, which is its class
+ * unless it is the space between words of an n-gram, negative if it is
+ * never found in the tree
+ *
+ * NOTE: the space stays a delimiter to the tokenizer, so no word picked
+ * up from the input ever contains it
+ */
+static inline int char_symbol(const char c)
+{
+	int idx = char_class[(unsigned char)c];
+
+#ifdef SEPARATOR_IDX
+	return (idx < 0 && c == ' ') ? SEPARATOR_IDX : idx;
+#else
+	return idx;
+#endif
+}
+
+/*
+ * Return 1 if the givn charater is one of delimiter chars
+ * 0 otherwise
+ */
+static inline int is_delimiter(const char c)
+{
+	return char_class[(unsigned char)c] == CHAR_DELIMITER;
+}
+
 pid_t get_tid(void);
+uint64_t get_ns(void);
 
 int to_lowercase(char c);
+void keep_case(void);
+
+char *map_file(const int fd, const size_t size);
+void unmap_file(char *data, const size_t size);
 #endif	/* _LIB_H */
@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ngram.h"
+
+void ngram_init(ngram_t *ngram, const int n)
+{
+	memset(ngram, 0, sizeof(ngram_t));
+	ngram->n = n;
+}
+
+void ngram_cleanup(ngram_t *ngram)
+{
+	free(ngram->buf);
+	ngram_init(ngram, ngram->n);
+}
+
+/*
+ * Empty the window, so that no n-gram spans the words before and after
+ */
+void ngram_reset(ngram_t *ngram)
+{
+	ngram->num = ngram->len = 0;
+}
+
+/*
+ * Slide the given word into the window, return 1 if the window makes up
+ * an n-gram in buf of len bytes, 0 if there are not enough words yet, or
+ * -1 if the window can't grow to hold the word
+ */
+int ngram_push(ngram_t *ngram, const char *word, const int len)
+{
+	char *buf;
+	int size, drop;
+
+	/* The oldest word goes along with the space after it */
+	if (ngram->num == ngram->n) {
+		drop = ngram->lens[0] + 1;
+		ngram->len -= drop;
+		memmove(ngram->buf, ngram->buf + drop, ngram->len);
+		memmove(ngram->lens, ngram->lens + 1, sizeof(int) * --ngram->num);
+	}
+
+	if (ngram->len + len + 1 > ngram->size) {
+		size = (ngram->len + len + 1) * 2;
+
+		if (!(buf = (char *)realloc(ngram->buf, size))) {
+			return -1;
+		}
+
+		ngram->buf = buf;
+		ngram->size = size;
+	}
+
+	if (ngram->num > 0) {
+		ngram->buf[ngram->len++] = ' ';
+	}
+
+	memcpy(ngram->buf + ngram->len, word, len);
+	ngram->len += len;
+	ngram->lens[ngram->num++] = len;
+
+	return ngram->num == ngram->n;
+}
+
+/*
+ * Return where the n words right before start begin, no further back
+ * than begin, so that the n-grams ending in the words from start could
+ * be made up by the same window
+ */
+const char *ngram_lead(const char *begin, const char *start, const int n)
+{
+	const char *p = start;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		while (p > begin && is_delimiter(p[-1]) == 1) {
+			p--;
+		}
+
+		if (p == begin) {
+			break;
+		}
+
+		while (p > begin && is_delimiter(p[-1]) == 0) {
+			p--;
+		}
+	}
+
+	return p;
+}
@@ -0,0 +1,44 @@
+#ifndef _NGRAM_H
+#define _NGRAM_H
+
+#include "lib.h"
+
+/*
+ * Turn consecutive words into n-grams, each made of n words joined by
+ * a space, which is a symbol of the tree between words so that n-grams
+ * are counted and output the same as words. A window of the last n
+ * words is kept in a buffer of its own, so that an n-gram could span
+ * buffers of input that are gone by then.
+ *
+ * Words are consecutive no matter which delimiters are in between.
+ */
+
+/*
+ * The most words in an n-gram. N-grams take the separator between words,
+ * which nodes of 26 alphabets have no slot for, see lib.h
+ */
+#ifdef SEPARATOR_IDX
+#define NGRAM_MAX			8
+#else
+#define NGRAM_MAX			1
+#endif
+
+typedef struct ngram {
+	/* The number of words in each n-gram and that in the window */
+	int n, num;
+
+	/* The length of each word in the window, the oldest first */
+	int lens[NGRAM_MAX];
+
+	/* The words in the window joined by spaces */
+	char *buf;
+	int len, size;
+} ngram_t;
+
+void ngram_init(ngram_t *ngram, const int n);
+void ngram_cleanup(ngram_t *ngram);
+void ngram_reset(ngram_t *ngram);
+int ngram_push(ngram_t *ngram, const char *word, const int len);
+const char *ngram_lead(const char *begin, const char *start, const int n);
+
+#endif	/* _NGRAM_H */
@@ -2,193 +2,713 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include "node.h"
 
-node_t *create_node(const char c)
+/*
+ * Allocate a node from the given arena. There is no counterpart to
+ * release a single node, all nodes go away with their arena at once
+ */
+node_t *create_node(arena_t *arena)
 {
 	node_t *node;
 
-	if (!(node = (node_t *)malloc(sizeof(node_t)))) {
+	/* Memory from the arena has been zeroed already */
+	if (!(node = (node_t *)arena_alloc(arena, sizeof(node_t)))) {
 		printf("Failed to allocate a tree node\n");
 		return NULL;
 	}
 
-	memset(node, 0, sizeof(node_t));
-	node->c = c;
-
 	return node;
 }
 
-void destroy_node(node_t *node)
+#ifdef ARENA_REFS
+static int kids_num(const kids_t *kids)
 {
-	int i;
+	int i, num = 0;
+
+	for (i = 0; i < BITMAP_WORDS; i++) {
+		num += __builtin_popcount(kids_word(kids, i));
+	}
+
+	return num;
+}
 
-	if (!node) {
-		return;
+/*
+ * Allocate a block for num children with the given bitmap, whose
+ * references are left for the caller to fill in
+ */
+static kids_t *alloc_kids(arena_t *arena, const uint32_t *bitmap,
+						  const int num)
+{
+	kids_t *kids;
+#if BITMAP_WORDS == 1
+	if (!(kids = (kids_t *)arena_alloc(arena, sizeof(kids_t) +
+										sizeof(nref_t) * num))) {
+		return NULL;
 	}
 
-	for (i = 0; i < AVAILABLE_CHARS; i++) {
-		destroy_node(node->children[i]);
+	kids->bitmap[0] = bitmap[0];
+#else
+	int words = 0, i;
+
+	for (i = 0; i < BITMAP_WORDS; i++) {
+		words += (bitmap[i] != 0);
 	}
 
-	free(node);
+	if (!(kids = (kids_t *)arena_alloc(arena, sizeof(kids_t) +
+										sizeof(uint32_t) * words +
+										sizeof(nref_t) * num))) {
+		return NULL;
+	}
+
+	for (i = 0, words = 0; i < BITMAP_WORDS; i++) {
+		if (bitmap[i]) {
+			kids->summary |= 1U << i;
+			kids->bitmap[words++] = bitmap[i];
+		}
+	}
+#endif
+	return kids;
 }
 
-errcode_t setup_node(node_t *node, const char *word)
+/*
+ * Return a new block of children made of the current block of the given
+ * node plus the given child at idx
+ */
+static kids_t *build_kids(arena_t *arena, const nref_t ref, const int idx,
+						  const node_t *child)
 {
-	node_t *p;
-	int len, i, idx;
-	char c;
+	uint32_t bitmap[BITMAP_WORDS] = { 0 };
+	const kids_t *old = NULL;
+	kids_t *new;
+	nref_t *refs;
+	int num = 0, pos = 0, i;
 
-	len = strlen(word);
+	if (ref) {
+		old = (const kids_t *)arena_deref(ref);
+
+		for (i = 0; i < BITMAP_WORDS; i++) {
+			bitmap[i] = kids_word(old, i);
+		}
+
+		num = kids_num(old);
+		pos = kids_pos(old, idx);
+	}
+
+	bitmap[idx / 32] |= 1U << (idx % 32);
+
+	if (!(new = alloc_kids(arena, bitmap, num + 1))) {
+		return NULL;
+	}
+
+	refs = (nref_t *)kids_refs(new);
+
+	if (old) {
+		memcpy(refs, kids_refs(old), sizeof(nref_t) * pos);
+		memcpy(refs + pos + 1, kids_refs(old) + pos,
+			   sizeof(nref_t) * (num - pos));
+	}
+
+	refs[pos] = arena_ref(child);
+
+	return new;
+}
+
+/*
+ * Publish the given child by replacing the block referred to by *ref
+ * with a bigger one
+ *
+ * NOTE: the old block is left in the arena since readers may still be
+ * walking through it, which is cheap since most nodes have a few children
+ */
+static node_t *kids_link(arena_t *arena, nref_t *ref, const int idx,
+						 node_t *child)
+{
+	kids_t *kids;
+
+	if (!(kids = build_kids(arena, *ref, idx, child))) {
+		return NULL;
+	}
+
+	__atomic_store_n(ref, arena_ref(kids), __ATOMIC_RELEASE);
+
+	return child;
+}
+
+#ifdef MULTI_THREADS
+static size_t kids_size(const kids_t *kids)
+{
+	return (const char *)(kids_refs(kids) + kids_num(kids)) -
+		   (const char *)kids;
+}
+
+/*
+ * Same as kids_link() but without any lock held, racing with other
+ * threads by compare-and-swap on the reference to the block.
+ *
+ * If another thread has published the same child in the meantime, the
+ * winner's node is returned instead, and the caller should give back
+ * the given one
+ */
+static node_t *kids_link_cas(arena_t *arena, nref_t *ref, const int idx,
+							 node_t *child)
+{
+	node_t *winner;
+	kids_t *kids;
+	nref_t r;
+
+	r = __atomic_load_n(ref, __ATOMIC_ACQUIRE);
+
+	do {
+		if ((winner = kids_child(ref, idx)) != NULL) {
+			return winner;
+		}
+
+		if (!(kids = build_kids(arena, r, idx, child))) {
+			return NULL;
+		}
+
+		if (__atomic_compare_exchange_n(ref, &r, arena_ref(kids), 0,
+										__ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+			return child;
+		}
+
+		/* Lost the race, try again on top of the latest block */
+		arena_unalloc(arena, kids, kids_size(kids));
+	} while (1);
+}
+#endif
+#endif
+
+#ifdef COMPACT_NODES
+static node_t *link_child(arena_t *arena, node_t *node, const int idx,
+						  node_t *child)
+{
+	return kids_link(arena, &node->kids, idx, child);
+}
+
+#ifdef MULTI_THREADS
+/*
+ * Same as add_child() but without any lock held, racing with other
+ * threads by compare-and-swap on the reference to the block of children.
+ *
+ * If another thread has published the same child in the meantime, the
+ * new node is given back and the winner's node is returned instead
+ */
+static node_t *add_child_cas(arena_t *arena, node_t *node, const int idx)
+{
+	node_t *child, *winner;
+
+	if (!(child = create_node(arena))) {
+		return NULL;
+	}
+
+	if ((winner = kids_link_cas(arena, &node->kids, idx, child)) != child) {
+		arena_unalloc(arena, child, sizeof(node_t));
+	}
+
+	return winner;
+}
+#endif
+#else
+static node_t *link_child(arena_t *arena, node_t *node, const int idx,
+						  node_t *child)
+{
+#ifdef BYTE_ALPHABET
+	if ((unsigned int)(idx - SLOT_BASE) >= NODE_SLOTS) {
+		return kids_link(arena, &node->others, idx, child);
+	}
+#endif
+	__atomic_store_n(&node->children[idx - SLOT_BASE], child,
+					 __ATOMIC_RELEASE);
+
+	return child;
+}
+
+#ifdef MULTI_THREADS
+/*
+ * Same as add_child() but without any lock held, racing with other
+ * threads by compare-and-swap on the pointer to the child.
+ *
+ * If another thread has published the same child in the meantime, the
+ * new node is given back and the winner's node is returned instead
+ */
+static node_t *add_child_cas(arena_t *arena, node_t *node, const int idx)
+{
+	node_t *child, *winner = NULL;
+
+	if (!(child = create_node(arena))) {
+		return NULL;
+	}
+
+#ifdef BYTE_ALPHABET
+	if ((unsigned int)(idx - SLOT_BASE) >= NODE_SLOTS) {
+		if ((winner = kids_link_cas(arena, &node->others, idx,
+									child)) != child) {
+			arena_unalloc(arena, child, sizeof(node_t));
+		}
+
+		return winner;
+	}
+#endif
+
+	if (__atomic_compare_exchange_n(&node->children[idx - SLOT_BASE], &winner,
+									child, 0, __ATOMIC_RELEASE,
+									__ATOMIC_ACQUIRE)) {
+		return child;
+	}
+
+	arena_unalloc(arena, child, sizeof(node_t));
+
+	return winner;
+}
+#endif
+#endif
+
+/*
+ * Create a new child for the given node
+ */
+static node_t *add_child(arena_t *arena, node_t *node, const int idx)
+{
+	node_t *child;
+
+	if (!(child = create_node(arena))) {
+		return NULL;
+	}
+
+	return link_child(arena, node, idx, child);
+}
+
+/*
+ * Count cnt occurences of the given word of len bytes, which is not
+ * necessarily NULL-terminated
+ */
+errcode_t setup_node_cnt(arena_t *arena, node_t *node, const char *word,
+						 const int len, const int cnt)
+{
+	node_t *p, *child;
+	int i, idx;
 
 	assert(node && word && len > 0);
 
 	for (i = 0, p = node; i < len; i++) {
 		/* Illegal word, skip it, resulting in leaf node's cnt == 0 */
-		if ((c = to_lowercase(word[i])) < 0) {
+		if ((idx = char_symbol(word[i])) < 0) {
 			return 0;
 		}
 
-		idx = c - 'a';
-
-		if (p->children[idx] != NULL) {
-			p = p->children[idx];
+		if ((child = node_child(p, idx)) != NULL) {
+			p = child;
 			continue;
 		}
 
-		if (!p->children[idx]) {
-			if (!(p->children[idx] = create_node(c))) {
-				return ERR_NO_MEM;
-			}
+		if (!(p = add_child(arena, p, idx))) {
+			return ERR_NO_MEM;
 		}
-
-		p = p->children[idx];
 	}
 
 	/* update counter on the leaf node */
-	p->cnt++;
+	p->cnt += cnt;
 
 	return 0;
 }
 
-void dump_node(const node_t *node, const char *path)
+errcode_t setup_node(arena_t *arena, node_t *node, const char *word,
+					 const int len)
 {
-	node_t *child;
-	char *path_new;
-	int i;
+	return setup_node_cnt(arena, node, word, len, 1);
+}
 
-	assert (node && path);	/* path could point to an empty string but never NULL */
+/*
+ * A node being visited in the traversal and the index of its next
+ * child to visit
+ */
+typedef struct frame {
+	const node_t *node;
+	int next;
+} frame_t;
+
+/*
+ * Double the room for the path and the frames of the traversal, which
+ * start out on the stack and only move to the heap for words longer
+ * than WORD_LEN_MAX
+ */
+static errcode_t grow_frames(frame_t **frames, char **path, int *depth,
+							 frame_t *frames_def, char *path_def)
+{
+	frame_t *f;
+	char *p;
 
-	if (!(path_new = (char *)malloc(strlen(path) + 2))) {
-		return;
+	if (!(f = (frame_t *)malloc(sizeof(frame_t) * *depth * 2)) ||
+		!(p = (char *)malloc(*depth * 2))) {
+		free(f);
+		return ERR_NO_MEM;
 	}
 
-	sprintf(path_new, "%s%c", path, node->c);
+	memcpy(f, *frames, sizeof(frame_t) * *depth);
+	memcpy(p, *path, *depth);
 
-	if (node->cnt) {
-		printf("%s : %d\n", path_new, node->cnt);
+	if (*frames != frames_def) {
+		free(*frames);
+		free(*path);
 	}
 
-	for (i = 0; i < AVAILABLE_CHARS; i++) {
-		if (!(child = node->children[i])) {
+	*frames = f;
+	*path = p;
+	*depth *= 2;
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Visit every word in the tree rooted by the given node in alphabetical
+ * order, walking down the tree with an explicit stack and building up
+ * words in one path buffer, stopping at the first error of the visitor.
+ *
+ * Nodes don't record their own alphabets, which are told by their
+ * positions in their parents, so idx is the alphabet of the given node,
+ * or -1 for the root of a whole tree which stands for none
+ */
+errcode_t walk_node(const node_t *node, const int idx, visit_t visit,
+					void *arg)
+{
+	frame_t frames_def[WORD_LEN_MAX], *frames = frames_def;
+	char path_def[WORD_LEN_MAX], *path = path_def;
+	const node_t *child;
+	int depth = WORD_LEN_MAX, top = 0, base = 0;
+	errcode_t ret = ERR_SUCCESS;
+
+	assert(node);
+
+	if (idx >= 0) {
+		path[base++] = INDEX_CHAR(idx);
+	}
+
+	frames[0].node = node;
+	frames[0].next = 0;
+
+	if (node->cnt && (ret = visit(arg, path, base, node->cnt)) != 0) {
+		goto out;
+	}
+
+	while (top >= 0) {
+		if (!(child = node_next(frames[top].node, &frames[top].next))) {
+			top--;
 			continue;
 		}
 
-		dump_node(child, path_new);
+		if (base + top + 1 == depth &&
+			(ret = grow_frames(&frames, &path, &depth, frames_def,
+							   path_def)) != ERR_SUCCESS) {
+			goto out;
+		}
+
+		path[base + top] = INDEX_CHAR(frames[top].next - 1);
+		top++;
+		frames[top].node = child;
+		frames[top].next = 0;
+
+		if (child->cnt &&
+			(ret = visit(arg, path, base + top, child->cnt)) != 0) {
+			goto out;
+		}
+	}
+
+out:
+	if (frames != frames_def) {
+		free(frames);
+		free(path);
+	}
+
+	return ret;
+}
+
+static errcode_t visit_out(void *arg, const char *word, const int len,
+						   const int cnt)
+{
+	return out_word((out_t *)arg, word, len, cnt);
+}
+
+errcode_t output_node(out_t *out, const node_t *node, const int idx)
+{
+	return walk_node(node, idx, visit_out, out);
+}
+
+/*
+ * Output every word in the tree rooted by the given node on stdout
+ */
+void dump_node(const node_t *node)
+{
+	char buf[OUTPUT_BUF_SIZE];
+	out_t out;
+
+	/* Anything printed before MUST go out first */
+	fflush(stdout);
+
+	out_init(&out, STDOUT_FILENO, buf, sizeof(buf));
+
+	if (output_node(&out, node, -1) != ERR_SUCCESS ||
+		out_flush(&out) != ERR_SUCCESS) {
+		printf("Failed to output the tree\n");
+	}
+}
+
+/*
+ * Add up the counters in the tree rooted by src onto those in the tree
+ * rooted by dst, both representing the same word. Subtrees missing in
+ * dst are grafted from src as they are rather than copied, so src
+ * must not be used any more afterwards
+ */
+errcode_t merge_node(arena_t *arena, node_t *dst, node_t *src)
+{
+	node_t *s, *d;
+	int i = 0, ret;
+
+	dst->cnt += src->cnt;
+
+	while ((s = node_next(src, &i)) != NULL) {
+		if (!(d = node_child(dst, i - 1))) {
+			if (!link_child(arena, dst, i - 1, s)) {
+				return ERR_NO_MEM;
+			}
+		} else if ((ret = merge_node(arena, d, s)) != ERR_SUCCESS) {
+			return ret;
+		}
+	}
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Accumulate the shape of the tree rooted by the given node, which is
+ * at the given depth
+ */
+void count_node(const node_t *node, const int depth, tree_stats_t *stats)
+{
+	node_t *child;
+	int i = 0;
+
+	stats->nodes++;
+	stats->depths[depth < TREE_DEPTH_MAX ? depth : TREE_DEPTH_MAX]++;
+
+	if (node->cnt) {
+		stats->words++;
+		stats->total += node->cnt;
 	}
 
-	free(path_new);
+	while ((child = node_next(node, &i)) != NULL) {
+		count_node(child, depth + 1, stats);
+	}
 }
 
 #ifdef MULTI_THREADS
-root_t *create_tree(const char c)
+root_t *create_tree(arena_t *arena)
 {
 	root_t *root;
 
-	if (!(root = (root_t *)malloc(sizeof(root_t)))) {
+	/* The tsync may well be laid out on cache lines of its own */
+	if (posix_memalign((void **)&root, 64, sizeof(root_t)) != 0) {
 		printf("Failed to allocate a root node\n");
 		return NULL;
 	}
 
 	memset(root, 0, sizeof(root_t));
 
-	if (!(root->n = create_node(c))) {
+	if (!(root->n = create_node(arena))) {
 		printf("Failed to allocate a tree node for root\n");
 		free(root);
 		return NULL;
 	}
 
 	pthread_mutex_init(&root->mutex, NULL);
+	tsync_init(&root->sync);
 	return root;
 }
 
+/*
+ * NOTE: nodes of the subtree are released along with the arenas
+ * they were allocated from
+ */
 void destroy_tree(root_t *root)
 {
-	if (root->n) {
-		destroy_node(root->n);
-	}
-
 	pthread_mutex_destroy(&root->mutex);
+	tsync_cleanup(&root->sync);
 
 	free(root);
 }
 
-errcode_t setup_tree(root_t **roots, const char *word)
+/*
+ * Take the mutex of the given subtree, the clock is only read if it is
+ * held by another thread
+ */
+static void lock_root(root_t *root)
 {
-	root_t *root;
-	node_t *p;
-	int len, i, idx;
-	char c;
+	uint64_t begin;
+
+	if (pthread_mutex_trylock(&root->mutex) != 0) {
+		begin = get_ns();
+		pthread_mutex_lock(&root->mutex);
+		root->contended++;
+		root->wait += get_ns() - begin;
+	}
 
-	len = strlen(word);
+	root->acquired++;
+}
+
+errcode_t setup_tree_cnt(arena_t *arena, root_t **roots, const char *word,
+						 const int len, const int cnt)
+{
+	root_t *root;
+	node_t *p, *child;
+	int i, idx;
 
 	assert(roots && word && len > 0);
 
-	if ((c = to_lowercase(word[0])) < 0) {
+	if ((idx = char_symbol(word[0])) < 0) {
 		return 0;
 	}
 
-	idx = c - 'a';
 	root = roots[idx];
 
 	for (i = 1, p = root->n; i < len; i++) {
 		/* Illegal word, skip it, resulting in leaf node's cnt == 0 */
-		if ((c = to_lowercase(word[i])) < 0) {
+		if ((idx = char_symbol(word[i])) < 0) {
 			return 0;
 		}
 
-		idx = c - 'a';
-
-		if (p->children[idx] != NULL) {
-			p = p->children[idx];
+		if ((child = node_child(p, idx)) != NULL) {
+			p = child;
 			continue;
 		}
 
-		pthread_mutex_lock(&root->mutex);
-		if (!p->children[idx]) {
-			if (!(p->children[idx] = create_node(c))) {
+		lock_root(root);
+		if (!(child = node_child(p, idx))) {
+			if (!(child = add_child(arena, p, idx))) {
 				pthread_mutex_unlock(&root->mutex);
 				return ERR_NO_MEM;
 			}
 		}
 		pthread_mutex_unlock(&root->mutex);
 
-		p = p->children[idx];
+		p = child;
 	}
 
 	/* update counter on the leaf node */
-	pthread_mutex_lock(&root->mutex);
-	p->cnt++;
+	lock_root(root);
+	p->cnt += cnt;
 	pthread_mutex_unlock(&root->mutex);
 
 	return 0;
 }
 
-void dump_tree(root_t *root)
+errcode_t setup_tree(arena_t *arena, root_t **roots, const char *word,
+					 const int len)
+{
+	return setup_tree_cnt(arena, roots, word, len, 1);
+}
+
+/*
+ * Same as setup_tree_cnt() but with the writers side of the tsync of the
+ * subtree taken for every change instead of its mutex, so that queries
+ * could read the subtree in between. Fails only if the subtree is being
+ * shut down
+ */
+errcode_t setup_tree_sync_cnt(arena_t *arena, root_t **roots,
+							  const char *word, const int len, const int cnt)
+{
+	root_t *root;
+	node_t *p, *child;
+	int i, idx;
+
+	assert(roots && word && len > 0);
+
+	if ((idx = char_symbol(word[0])) < 0) {
+		return 0;
+	}
+
+	root = roots[idx];
+
+	for (i = 1, p = root->n; i < len; i++) {
+		/* Illegal word, skip it, resulting in leaf node's cnt == 0 */
+		if ((idx = char_symbol(word[i])) < 0) {
+			return 0;
+		}
+
+		if ((child = node_child(p, idx)) != NULL) {
+			p = child;
+			continue;
+		}
+
+		if (tsync_writer_entry(&root->sync) < 0) {
+			return ERR_BAD_PARAM;
+		}
+
+		if (!(child = node_child(p, idx))) {
+			child = add_child(arena, p, idx);
+		}
+
+		tsync_writer_exit(&root->sync);
+
+		if (!(p = child)) {
+			return ERR_NO_MEM;
+		}
+	}
+
+	if (tsync_writer_entry(&root->sync) < 0) {
+		return ERR_BAD_PARAM;
+	}
+
+	p->cnt += cnt;
+	tsync_writer_exit(&root->sync);
+
+	return 0;
+}
+
+/*
+ * Same as setup_tree() but without taking any mutex. New children are
+ * published by compare-and-swap and the counter is bumped atomically.
+ *
+ * NOTE: the counter is only read after all threads have completed,
+ * so no ordering is needed for it
+ */
+errcode_t setup_tree_lockfree_cnt(arena_t *arena, root_t **roots,
+								  const char *word, const int len,
+								  const int cnt)
 {
-	assert(root);
+	node_t *p, *child;
+	int i, idx;
+
+	assert(roots && word && len > 0);
+
+	if ((idx = char_symbol(word[0])) < 0) {
+		return 0;
+	}
+
+	for (i = 1, p = roots[idx]->n; i < len; i++) {
+		/* Illegal word, skip it, resulting in leaf node's cnt == 0 */
+		if ((idx = char_symbol(word[i])) < 0) {
+			return 0;
+		}
+
+		if ((child = node_child(p, idx)) != NULL) {
+			p = child;
+			continue;
+		}
+
+		if (!(p = add_child_cas(arena, p, idx))) {
+			return ERR_NO_MEM;
+		}
+	}
 
-	dump_node(root->n, "");
+	__atomic_fetch_add(&p->cnt, cnt, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+errcode_t setup_tree_lockfree(arena_t *arena, root_t **roots,
+							  const char *word, const int len)
+{
+	return setup_tree_lockfree_cnt(arena, roots, word, len, 1);
 }
 #endif
@@ -1,10 +1,256 @@
 #ifndef _NODE_H
 #define _NODE_H
 
+#include <stddef.h>
 #include "lib.h"
+#include "arena.h"
+#include "output.h"
 
 #ifdef MULTI_THREADS
 #include <pthread.h>
+#include "tsync.h"
+#endif
+
+#ifdef ARENA_REFS
+/*
+ * 32-bit reference to a node or a block of children in the node pool
+ */
+typedef aref_t nref_t;
+
+#define BITMAP_WORDS		((AVAILABLE_CHARS + 31) / 32)
+
+#if BITMAP_WORDS == 1
+/*
+ * Children of a node packed in the order of their alphabets, only the
+ * present ones are stored as indicated by the bitmap.
+ *
+ * NOTE: a block is never changed once published, adding one more child
+ * results in a new block replacing the old one, so that readers walking
+ * the tree without any lock will see either of them but never a block
+ * half way through the update
+ */
+typedef struct kids {
+	uint32_t bitmap[BITMAP_WORDS];
+	nref_t refs[];
+} kids_t;
+
+/* The given word of the bitmap */
+static inline uint32_t kids_word(const kids_t *kids, const int w)
+{
+	return kids->bitmap[w];
+}
+
+static inline const nref_t *kids_refs(const kids_t *kids)
+{
+	return kids->refs;
+}
+
+/*
+ * Return the position of the given child in the block, no matter
+ * whether it is present or not
+ */
+static inline int kids_pos(const kids_t *kids, const int idx)
+{
+	return __builtin_popcount(kids->bitmap[0] & ((1U << idx) - 1));
+}
+
+/* Return the position of the given child in the block, -1 if absent */
+static inline int kids_find(const kids_t *kids, const int idx)
+{
+	if (!(kids->bitmap[0] & (1U << idx))) {
+		return -1;
+	}
+
+	return kids_pos(kids, idx);
+}
+#else
+/*
+ * Same as above, but the bitmap of a wide alphabet is mostly zero since
+ * the children of a node tend to fall in one or two of its words, ASCII
+ * lower case all in the 4th of them. So only the non-zero words of the
+ * bitmap are stored, as indicated by the bits in the summary, followed
+ * by the references to the children
+ */
+typedef struct kids {
+	uint32_t summary;
+	uint32_t bitmap[];
+} kids_t;
+
+/*
+ * The summary has at most 8 bits, whose population is counted inline
+ * rather than by __builtin_popcount(), which is a libgcc call unless
+ * the target has a popcnt instruction.
+ *
+ * NOTE: most blocks have only one word, whose children are then found
+ * by a well predicted branch rather than waiting for the arithmetic
+ */
+static inline int summary_count(uint32_t bits)
+{
+	if (!(bits & (bits - 1))) {
+		return bits != 0;
+	}
+
+	bits = bits - ((bits >> 1) & 0x55);
+	bits = (bits & 0x33) + ((bits >> 2) & 0x33);
+
+	return (bits + (bits >> 4)) & 0x0f;
+}
+
+static inline uint32_t kids_word(const kids_t *kids, const int w)
+{
+	if (!(kids->summary & (1U << w))) {
+		return 0;
+	}
+
+	return kids->bitmap[summary_count(kids->summary & ((1U << w) - 1))];
+}
+
+static inline const nref_t *kids_refs(const kids_t *kids)
+{
+	return (const nref_t *)(kids->bitmap + summary_count(kids->summary));
+}
+
+static inline int kids_pos(const kids_t *kids, const int idx)
+{
+	int w = idx / 32, i, n, pos = 0;
+
+	n = summary_count(kids->summary & ((1U << w) - 1));
+
+	for (i = 0; i < n; i++) {
+		pos += __builtin_popcount(kids->bitmap[i]);
+	}
+
+	if (kids->summary & (1U << w)) {
+		pos += __builtin_popcount(kids->bitmap[n] & ((1U << (idx % 32)) - 1));
+	}
+
+	return pos;
+}
+
+static inline int kids_find(const kids_t *kids, const int idx)
+{
+	int w = idx / 32, i, n, pos;
+	uint32_t word;
+
+	if (!(kids->summary & (1U << w))) {
+		return -1;
+	}
+
+	n = summary_count(kids->summary & ((1U << w) - 1));
+
+	if (!((word = kids->bitmap[n]) & (1U << (idx % 32)))) {
+		return -1;
+	}
+
+	pos = __builtin_popcount(word & ((1U << (idx % 32)) - 1));
+
+	for (i = 0; i < n; i++) {
+		pos += __builtin_popcount(kids->bitmap[i]);
+	}
+
+	return pos;
+}
+#endif
+
+/*
+ * Return the child at idx in the block referred to by *ref, or NULL if
+ * there is none
+ */
+static inline struct node *kids_child(const nref_t *ref, const int idx)
+{
+	const kids_t *kids;
+	nref_t r;
+	int pos;
+
+	if (!(r = __atomic_load_n(ref, __ATOMIC_ACQUIRE))) {
+		return NULL;
+	}
+
+	kids = (const kids_t *)arena_deref(r);
+
+	if ((pos = kids_find(kids, idx)) < 0) {
+		return NULL;
+	}
+
+	return (struct node *)arena_deref(kids_refs(kids)[pos]);
+}
+
+/*
+ * Return the first child at or after *idx in the block referred to by
+ * *ref and move *idx past it, or NULL if there is none
+ */
+static inline struct node *kids_next(const nref_t *ref, int *idx)
+{
+	const kids_t *kids;
+	nref_t r;
+	uint32_t bits;
+	int w, i;
+
+	if (*idx >= AVAILABLE_CHARS ||
+		!(r = __atomic_load_n(ref, __ATOMIC_ACQUIRE))) {
+		return NULL;
+	}
+
+	kids = (const kids_t *)arena_deref(r);
+
+	for (w = *idx / 32; w < BITMAP_WORDS; w++) {
+		bits = kids_word(kids, w);
+
+		if (w == *idx / 32) {
+			bits &= ~0U << (*idx % 32);
+		}
+
+		if (bits) {
+			i = w * 32 + __builtin_ctz(bits);
+			*idx = i + 1;
+			i = kids_pos(kids, i);
+			return (struct node *)arena_deref(kids_refs(kids)[i]);
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+#ifdef COMPACT_NODES
+/*
+ * Descriptor of a node in the analysis tree
+ */
+typedef struct node {
+	/* Occurence of the word represented by this node */
+	int cnt;
+
+	/* Reference to the block of children, 0 if there is none */
+	nref_t kids;
+} node_t;
+
+static inline node_t *node_child(const node_t *node, const int idx)
+{
+	return kids_child(&node->kids, idx);
+}
+
+/*
+ * Return the first child at or after *idx and move *idx past it, or
+ * NULL if there is none
+ */
+static inline node_t *node_next(const node_t *node, int *idx)
+{
+	return kids_next(&node->kids, idx);
+}
+#else
+#ifdef BYTE_ALPHABET
+/*
+ * Only lower case letters have their slots in the array of children,
+ * the first of which is for 'a', so that ASCII text is counted just as
+ * fast as with 26 alphabets. Children of other bytes are packed into
+ * a block like compact nodes
+ */
+#define SLOT_BASE			'a'
+#define NODE_SLOTS			26
+#else
+/* Every one of the 26 alphabets has its slot, and nothing else */
+#define SLOT_BASE			0
+#define NODE_SLOTS			26
 #endif
 
 /*
@@ -14,28 +260,132 @@ typedef struct node {
 	/* Occurence of the word represented by this node */
 	int cnt;
 
-	/* The alphabet of this node */
-	char c;
+#ifdef BYTE_ALPHABET
+	/* Reference to the block of children other than letters */
+	nref_t others;
+#endif
 
 	/* Pointers to the next alphabets of potential words */
-	struct node *children[AVAILABLE_CHARS];
+	struct node *children[NODE_SLOTS];
 } node_t;
 
-node_t *create_node(const char c);
-void destroy_node(node_t *node);
-errcode_t setup_node(node_t *node, const char *word);
-void dump_node(const node_t *node, const char *path);
+/*
+ * NOTE: pairs with the release store publishing a new child, so that
+ * the child is seen fully initialised by lookups without any lock
+ */
+static inline node_t *node_child(const node_t *node, const int idx)
+{
+#ifdef BYTE_ALPHABET
+	if ((unsigned int)(idx - SLOT_BASE) >= NODE_SLOTS) {
+		return kids_child(&node->others, idx);
+	}
+#endif
+	return __atomic_load_n(&node->children[idx - SLOT_BASE], __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Return the first child at or after *idx and move *idx past it, or
+ * NULL if there is none
+ */
+static inline node_t *node_next(const node_t *node, int *idx)
+{
+	node_t *child;
+#ifdef BYTE_ALPHABET
+	int i;
+#endif
+
+	while (*idx < AVAILABLE_CHARS) {
+#ifdef BYTE_ALPHABET
+		/*
+		 * Look for the next child in the block, but any one found beyond
+		 * the slots only comes after the children in the slots
+		 */
+		if ((unsigned int)(*idx - SLOT_BASE) >= NODE_SLOTS) {
+			i = *idx;
+			child = kids_next(&node->others, &i);
+
+			if (*idx > SLOT_BASE || (child && i <= SLOT_BASE)) {
+				*idx = i;
+				return child;
+			}
+
+			*idx = SLOT_BASE;
+			continue;
+		}
+#endif
+		if ((child = node_child(node, (*idx)++)) != NULL) {
+			return child;
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+node_t *create_node(arena_t *arena);
+errcode_t setup_node(arena_t *arena, node_t *node, const char *word,
+					 const int len);
+errcode_t setup_node_cnt(arena_t *arena, node_t *node, const char *word,
+						 const int len, const int cnt);
+/*
+ * Called for every word found in the tree, which is NOT NULL-terminated
+ */
+typedef errcode_t (*visit_t)(void *arg, const char *word, const int len,
+							 const int cnt);
+
+errcode_t walk_node(const node_t *node, const int idx, visit_t visit,
+					void *arg);
+errcode_t output_node(out_t *out, const node_t *node, const int idx);
+void dump_node(const node_t *node);
+/* Nodes deeper than this are counted altogether at this depth */
+#define TREE_DEPTH_MAX		32
+
+/*
+ * The shape of a tree: the number of nodes, that of distinct words and
+ * that of all their occurences, and the number of nodes at each depth,
+ * which is the length of the word a node stands for
+ */
+typedef struct tree_stats {
+	size_t nodes, words, total;
+	size_t depths[TREE_DEPTH_MAX + 1];
+} tree_stats_t;
+
+void count_node(const node_t *node, const int depth, tree_stats_t *stats);
+errcode_t merge_node(arena_t *arena, node_t *dst, node_t *src);
 
 #ifdef MULTI_THREADS
 typedef struct root {
 	node_t *n;
 	pthread_mutex_t mutex;
+
+	/*
+	 * Taken instead of above mutex when the subtree is read by queries
+	 * while being built up, by inserters as writers
+	 */
+	tsync_t sync;
+
+	/*
+	 * The number of times the mutex is taken, and among them the number
+	 * of times it has been held by another thread and the time spent
+	 * waiting for it, all updated with the mutex held
+	 */
+	size_t acquired, contended;
+	uint64_t wait;
 } root_t;
 
-root_t *create_tree(const char c);
+root_t *create_tree(arena_t *arena);
 void destroy_tree(root_t *root);
-errcode_t setup_tree(root_t **root, const char *word);
-void dump_tree(root_t *root);
+errcode_t setup_tree(arena_t *arena, root_t **root, const char *word,
+					 const int len);
+errcode_t setup_tree_cnt(arena_t *arena, root_t **roots, const char *word,
+						 const int len, const int cnt);
+errcode_t setup_tree_sync_cnt(arena_t *arena, root_t **roots,
+							  const char *word, const int len, const int cnt);
+errcode_t setup_tree_lockfree(arena_t *arena, root_t **roots,
+							  const char *word, const int len);
+errcode_t setup_tree_lockfree_cnt(arena_t *arena, root_t **roots,
+								  const char *word, const int len,
+								  const int cnt);
 #endif
 
 #endif	/* _NODE_H */
@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include "numa.h"
+
+#define NODE_CPULIST_FMT	"/sys/devices/system/node/node%d/cpulist"
+
+/* The number of pages asked about by each call of move_pages() */
+#define PAGES_BATCH			256
+
+/*
+ * Append the CPUs in the given list like "0-3,8-11" which are also in
+ * the given set to the CPUs of the numa, return the number appended
+ */
+static int add_cpus(numa_t *numa, const char *list, const cpu_set_t *allowed)
+{
+	const char *p = list;
+	char *end;
+	long lo, hi, cpu;
+	int num = 0;
+
+	while (*p >= '0' && *p <= '9') {
+		lo = hi = strtol(p, &end, 10);
+
+		if (*end == '-') {
+			hi = strtol(end + 1, &end, 10);
+		}
+
+		for (cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, allowed)) {
+				numa->cpus[numa->first[numa->nodes_num] + num++] = cpu;
+			}
+		}
+
+		p = (*end == ',') ? end + 1 : end;
+	}
+
+	return num;
+}
+
+errcode_t numa_init(numa_t *numa)
+{
+	char path[64], list[4096];
+	cpu_set_t allowed;
+	FILE *fp;
+	int id, num, cpu;
+
+	memset(numa, 0, sizeof(numa_t));
+
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) {
+		return ERR_IO;
+	}
+
+	/* No CPU shows up in more than one node */
+	if (!(numa->cpus = (int *)malloc(sizeof(int) * CPU_SETSIZE))) {
+		return ERR_NO_MEM;
+	}
+
+	for (id = 0; id < NUMA_NODES_MAX; id++) {
+		snprintf(path, sizeof(path), NODE_CPULIST_FMT, id);
+
+		if (!(fp = fopen(path, "r"))) {
+			continue;
+		}
+
+		num = fgets(list, sizeof(list), fp) ?
+			  add_cpus(numa, list, &allowed) : 0;
+		fclose(fp);
+
+		if (num > 0) {
+			numa->ids[numa->nodes_num] = id;
+			numa->first[numa->nodes_num + 1] =
+				numa->first[numa->nodes_num] + num;
+			numa->nodes_num++;
+		}
+	}
+
+	if (numa->nodes_num > 0) {
+		return ERR_SUCCESS;
+	}
+
+	for (cpu = 0, num = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &allowed)) {
+			numa->cpus[num++] = cpu;
+		}
+	}
+
+	numa->nodes_num = 1;
+	numa->first[1] = num;
+
+	return ERR_SUCCESS;
+}
+
+void numa_cleanup(numa_t *numa)
+{
+	free(numa->cpus);
+	memset(numa, 0, sizeof(numa_t));
+}
+
+/*
+ * Pin the calling thread, the given one of a fleet, onto a CPU so that
+ * the fleet is spread over all nodes in turn, and over the CPUs of each
+ * node. Return the id of the node, or -1 if the thread can't be pinned
+ */
+int numa_bind(const numa_t *numa, const int idx)
+{
+	cpu_set_t set;
+	int node, num;
+
+	if (numa->nodes_num == 0) {
+		return -1;
+	}
+
+	node = idx % numa->nodes_num;
+	num = numa->first[node + 1] - numa->first[node];
+
+	CPU_ZERO(&set);
+	CPU_SET(numa->cpus[numa->first[node] + idx / numa->nodes_num % num], &set);
+
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) != 0) {
+		return -1;
+	}
+
+	return numa->ids[node];
+}
+
+/*
+ * Add up the pages of the given range on the given node to local, and
+ * those on any other node to remote. Pages not faulted in yet are on no
+ * node at all and so not counted
+ */
+void numa_pages(const void *start, const size_t len, const int node,
+				size_t *local, size_t *remote)
+{
+	const long page = sysconf(_SC_PAGESIZE);
+	uintptr_t addr = (uintptr_t)start & ~(page - 1);
+	const uintptr_t end = (uintptr_t)start + len;
+	void *pages[PAGES_BATCH];
+	int status[PAGES_BATCH], num, i;
+
+	while (addr < end) {
+		for (num = 0; num < PAGES_BATCH && addr < end; addr += page) {
+			pages[num++] = (void *)addr;
+		}
+
+		/* Without target nodes, the node of each page is told instead */
+		if (syscall(SYS_move_pages, 0, num, pages, NULL, status, 0) != 0) {
+			return;
+		}
+
+		for (i = 0; i < num; i++) {
+			if (status[i] == node) {
+				(*local)++;
+			} else if (status[i] >= 0) {
+				(*remote)++;
+			}
+		}
+	}
+}
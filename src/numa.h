@@ -0,0 +1,33 @@
+#ifndef _NUMA_H
+#define _NUMA_H
+
+#include <stddef.h>
+#include "lib.h"
+
+/* The most NUMA nodes ever looked for */
+#define NUMA_NODES_MAX		64
+
+/*
+ * The NUMA nodes of the machine told by sysfs, along with the CPUs of
+ * each node the process is allowed to run on. Nodes without any such
+ * CPU are left out. If sysfs tells nothing, all allowed CPUs are taken
+ * as one single node 0.
+ */
+typedef struct numa {
+	int nodes_num;
+
+	/* The id of each node */
+	int ids[NUMA_NODES_MAX];
+
+	/* The CPUs of the ith node are cpus[first[i]] to cpus[first[i + 1] - 1] */
+	int *cpus;
+	int first[NUMA_NODES_MAX + 1];
+} numa_t;
+
+errcode_t numa_init(numa_t *numa);
+void numa_cleanup(numa_t *numa);
+int numa_bind(const numa_t *numa, const int idx);
+void numa_pages(const void *start, const size_t len, const int node,
+				size_t *local, size_t *remote);
+
+#endif	/* _NUMA_H */
@@ -0,0 +1,267 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include "output.h"
+
+/* Not exposed by limits.h without _XOPEN_SOURCE, 1024 on Linux */
+#ifndef IOV_MAX
+#define IOV_MAX				1024
+#endif
+
+/*
+ * Set up output to the given file descriptor through the given buffer,
+ * or if fd is negative, output kept in a buffer growing on demand
+ */
+void out_init(out_t *out, const int fd, char *buf, const size_t size)
+{
+	out->fd = fd;
+	out->buf = buf;
+	out->len = 0;
+	out->size = size;
+}
+
+/*
+ * Release the buffer of output kept in memory
+ */
+void out_cleanup(out_t *out)
+{
+	if (out->fd < 0 && out->buf) {
+		free(out->buf);
+		out->buf = NULL;
+	}
+}
+
+/*
+ * Write the given bytes in full, no matter how many of them a single
+ * write() takes, which is less than asked for on pipes and sockets, on
+ * a signal, or beyond 0x7ffff000 bytes on Linux
+ */
+static errcode_t write_fully(const int fd, const void *data, const size_t len)
+{
+	const char *p = (const char *)data;
+	size_t done;
+	ssize_t ret;
+
+	for (done = 0; done < len; done += ret) {
+		if ((ret = write(fd, p + done, len - done)) < 0) {
+			if (errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+
+			return ERR_IO;
+		}
+	}
+
+	return ERR_SUCCESS;
+}
+
+errcode_t out_flush(out_t *out)
+{
+	errcode_t ret;
+
+	if ((ret = write_fully(out->fd, out->buf, out->len)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	out->len = 0;
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Create the file to be renamed over the given path once fully written,
+ * whose path is kept in the given buffer, so that the file replaced is
+ * never left half written nor truncated under those mapping it.
+ * Return its file descriptor, or -1 on failure
+ */
+int out_create(const char *path, char *temp, const size_t size)
+{
+	int len;
+
+	len = snprintf(temp, size, "%s" OUTPUT_TEMP_SUFFIX, path);
+	if (len < 0 || len >= size) {
+		return -1;
+	}
+
+	return open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+/*
+ * Close the file from out_create(), and if all went well with it, make
+ * sure it is on disk and move it over the given path, or remove it
+ * otherwise. Return the given error, if any, or that of these steps
+ */
+errcode_t out_replace(const int fd, const char *temp, const char *path,
+					  errcode_t ret)
+{
+	if (ret == ERR_SUCCESS && fsync(fd) < 0) {
+		ret = ERR_IO;
+	}
+
+	if (close(fd) < 0 && ret == ERR_SUCCESS) {
+		ret = ERR_IO;
+	}
+
+	if (ret == ERR_SUCCESS && rename(temp, path) < 0) {
+		ret = ERR_IO;
+	}
+
+	if (ret != ERR_SUCCESS) {
+		unlink(temp);
+	}
+
+	return ret;
+}
+
+/*
+ * Make room for the given number of bytes, by flushing the buffer out
+ * to the file or by growing the buffer in memory
+ */
+static errcode_t out_reserve(out_t *out, const size_t room)
+{
+	size_t size = out->size ? out->size : OUTPUT_BUF_SIZE;
+	char *buf;
+
+	if (out->fd >= 0) {
+		return out_flush(out);
+	}
+
+	while (size - out->len < room) {
+		size *= 2;
+	}
+
+	if (!(buf = (char *)realloc(out->buf, size))) {
+		return ERR_NO_MEM;
+	}
+
+	out->buf = buf;
+	out->size = size;
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Write the output kept in memory by all the given outs to fd in order
+ */
+errcode_t out_writev(const int fd, const out_t *outs, const int num)
+{
+	struct iovec iov[num];
+	ssize_t ret;
+	int i, first, cnt;
+
+	for (i = 0; i < num; i++) {
+		iov[i].iov_base = outs[i].buf;
+		iov[i].iov_len = outs[i].len;
+	}
+
+	for (first = 0; first < num; ) {
+		cnt = num - first < IOV_MAX ? num - first : IOV_MAX;
+
+		if ((ret = writev(fd, iov + first, cnt)) < 0) {
+			return ERR_IO;
+		}
+
+		/* Skip what has been written, which may end half way a buffer */
+		while (first < num && (size_t)ret >= iov[first].iov_len) {
+			ret -= iov[first++].iov_len;
+		}
+
+		if (first < num) {
+			iov[first].iov_base = (char *)iov[first].iov_base + ret;
+			iov[first].iov_len -= ret;
+		}
+	}
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Format the given number in decimal at p, return the number of bytes
+ */
+static int format_int(char *p, const int num)
+{
+	char digits[12];
+	unsigned int n = num < 0 ? -(unsigned int)num : num;
+	int i = 0, len = 0;
+
+	do {
+		digits[i++] = '0' + n % 10;
+		n /= 10;
+	} while (n);
+
+	if (num < 0) {
+		p[len++] = '-';
+	}
+
+	while (i) {
+		p[len++] = digits[--i];
+	}
+
+	return len;
+}
+
+/*
+ * Append the given bytes as they are
+ */
+errcode_t out_bytes(out_t *out, const void *data, const size_t len)
+{
+	errcode_t ret;
+
+	if (out->size - out->len < len &&
+		(ret = out_reserve(out, len)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	/* Too large to fit in the buffer at all, goes out on its own */
+	if (out->size - out->len < len) {
+		return write_fully(out->fd, data, len);
+	}
+
+	memcpy(out->buf + out->len, data, len);
+	out->len += len;
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Append a line of "word : cnt" as printf("%s : %d\n") would do
+ */
+errcode_t out_word(out_t *out, const char *word, const int len,
+				   const int cnt)
+{
+	size_t n = len;
+	char *p;
+	int ret;
+
+	if (out->size - out->len < n + 16 &&
+		(ret = out_reserve(out, n + 16)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	/* A word too long to fit in the buffer at all goes out on its own */
+	if (out->size < n + 16) {
+		if ((ret = write_fully(out->fd, word, n)) != ERR_SUCCESS) {
+			return ret;
+		}
+
+		n = 0;
+	}
+
+	p = out->buf + out->len;
+	memcpy(p, word, n);
+	p += n;
+	memcpy(p, " : ", 3);
+	p += 3;
+	p += format_int(p, cnt);
+	*p++ = '\n';
+
+	out->len = p - out->buf;
+
+	return ERR_SUCCESS;
+}
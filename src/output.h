@@ -0,0 +1,36 @@
+#ifndef _OUTPUT_H
+#define _OUTPUT_H
+
+#include <stddef.h>
+#include "lib.h"
+
+/* The size of the buffer for output, flushed once full */
+#define OUTPUT_BUF_SIZE		(64 << 10)
+
+/* The suffix of the file written in place of the one to be replaced */
+#define OUTPUT_TEMP_SUFFIX	".tmp"
+
+/*
+ * Output is formatted into a buffer which is written to the file
+ * descriptor in large blocks, rather than going through stdio line
+ * by line. Or with no file descriptor, the buffer grows to keep all
+ * output in memory until written out along with others by writev()
+ */
+typedef struct out {
+	int fd;
+	char *buf;
+	size_t len, size;
+} out_t;
+
+void out_init(out_t *out, const int fd, char *buf, const size_t size);
+void out_cleanup(out_t *out);
+errcode_t out_flush(out_t *out);
+int out_create(const char *path, char *temp, const size_t size);
+errcode_t out_replace(const int fd, const char *temp, const char *path,
+					  errcode_t ret);
+errcode_t out_writev(const int fd, const out_t *outs, const int num);
+errcode_t out_bytes(out_t *out, const void *data, const size_t len);
+errcode_t out_word(out_t *out, const char *word, const int len,
+				   const int cnt);
+
+#endif	/* _OUTPUT_H */
@@ -0,0 +1,504 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include "pipeline.h"
+#include "stream.h"
+
+/*
+ * Stop all stages on the first error
+ */
+static void fail(pipeline_t *pipe, const errcode_t err)
+{
+	errcode_t none = ERR_SUCCESS;
+
+	__atomic_compare_exchange_n(&pipe->err, &none, err, 0,
+								__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	__atomic_store_n(&pipe->failed, 1, __ATOMIC_RELEASE);
+}
+
+static int failed(pipeline_t *pipe)
+{
+	return __atomic_load_n(&pipe->failed, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Pop from the given ring, waiting for the producer if it is empty.
+ * Return NULL if the ring is closed and drained, or on any error
+ */
+static void *wait_pop(pipeline_t *pipe, ring_t *ring, stage_t *stage)
+{
+	uint64_t begin = 0;
+	void *p;
+
+	while (!(p = ring_pop(ring))) {
+		/* Pop once more since the last item may come before closing */
+		if (ring_closed(ring)) {
+			p = ring_pop(ring);
+			break;
+		}
+
+		if (failed(pipe)) {
+			break;
+		}
+
+		if (begin == 0) {
+			begin = get_ns();
+		}
+
+		sched_yield();
+	}
+
+	if (begin) {
+		stage->wait += get_ns() - begin;
+	}
+
+	return p;
+}
+
+/*
+ * Push onto the given ring, waiting for the consumer if it is full.
+ * Return -1 on any error
+ */
+static int wait_push(pipeline_t *pipe, ring_t *ring, void *p, stage_t *stage)
+{
+	uint64_t begin = 0;
+	int ret;
+
+	while ((ret = ring_push(ring, p)) < 0 && !failed(pipe)) {
+		if (begin == 0) {
+			begin = get_ns();
+		}
+
+		sched_yield();
+	}
+
+	if (begin) {
+		stage->wait += get_ns() - begin;
+	}
+
+	return ret;
+}
+
+static void *reader(void *arg)
+{
+	pipeline_t *pipe = (pipeline_t *)arg;
+	stage_t *stage = &pipe->reader;
+	buffer_t *buf;
+	const char *frag = NULL;
+	size_t frag_len = 0;
+	int eof = 0;
+	errcode_t ret;
+
+	stage->begin = get_ns();
+
+	while (eof == 0 && (buf = wait_pop(pipe, &pipe->free, stage)) != NULL) {
+		if ((ret = stream_read(pipe->fd, buf->data, pipe->buf_size, &frag,
+							   &frag_len, &buf->len, &eof)) != ERR_SUCCESS) {
+			fail(pipe, ret);
+			break;
+		}
+
+		stage->items += buf->len;
+		stage->rounds++;
+
+		if (wait_push(pipe, &pipe->full, buf, stage) < 0) {
+			break;
+		}
+	}
+
+	ring_close(&pipe->full);
+	stage->end = get_ns();
+
+	return NULL;
+}
+
+/*
+ * Copy the given word into the current batch of the inserter owning it,
+ * handing over the batch once it is full
+ */
+static errcode_t dispatch(pipeline_t *pipe, batch_t **cur, const token_t *token)
+{
+	inserter_t *ins;
+	batch_t *batch;
+	int idx;
+
+	/* Illegal word, skip it as the tree would do */
+	if ((idx = char_class[(unsigned char)token->word[0]]) < 0) {
+		return ERR_SUCCESS;
+	}
+
+	if (token->len > BATCH_TEXT_SIZE) {
+		printf("The batch is too small to accommodate a long word\n");
+		return ERR_BAD_PARAM;
+	}
+
+	idx %= pipe->inserters_num;
+	ins = &pipe->inserters[idx];
+	batch = cur[idx];
+
+	if (batch && (batch->num == TOKENS_BATCH ||
+				  batch->used + token->len > BATCH_TEXT_SIZE)) {
+		if (wait_push(pipe, &ins->full, batch, &pipe->tokenizer) < 0) {
+			return __atomic_load_n(&pipe->err, __ATOMIC_RELAXED);
+		}
+
+		batch = cur[idx] = NULL;
+	}
+
+	if (!batch && !(batch = cur[idx] = wait_pop(pipe, &ins->free,
+												&pipe->tokenizer))) {
+		return __atomic_load_n(&pipe->err, __ATOMIC_RELAXED);
+	}
+
+	memcpy(batch->text + batch->used, token->word, token->len);
+	batch->tokens[batch->num].word = batch->text + batch->used;
+	batch->tokens[batch->num].len = token->len;
+	batch->used += token->len;
+	batch->num++;
+
+	return ERR_SUCCESS;
+}
+
+static void *tokenizer(void *arg)
+{
+	pipeline_t *pipe = (pipeline_t *)arg;
+	stage_t *stage = &pipe->tokenizer;
+	token_t tokens[TOKENS_BATCH], gram;
+	batch_t *cur[pipe->inserters_num];
+	const token_t *token;
+	const char *pos, *end;
+	buffer_t *buf;
+	int num, i, ret;
+
+	stage->begin = get_ns();
+	memset(cur, 0, sizeof(cur));
+
+	while ((buf = wait_pop(pipe, &pipe->full, stage)) != NULL) {
+		pos = buf->data;
+		end = buf->data + buf->len;
+
+		while ((num = tokenize(&pos, end, tokens, TOKENS_BATCH)) > 0) {
+			for (i = 0; i < num; i++) {
+				token = &tokens[i];
+
+				/* The n-gram ending in the word, which may start buffers ago */
+				if (pipe->ngram.n > 1) {
+					if ((ret = ngram_push(&pipe->ngram, token->word,
+										  token->len)) < 0) {
+						fail(pipe, ERR_NO_MEM);
+						goto out;
+					} else if (ret == 0) {
+						continue;
+					}
+
+					gram.word = pipe->ngram.buf;
+					gram.len = pipe->ngram.len;
+					token = &gram;
+				}
+
+				if ((ret = dispatch(pipe, cur, token)) != ERR_SUCCESS) {
+					fail(pipe, ret);
+					goto out;
+				}
+			}
+
+			stage->items += num;
+		}
+
+		stage->rounds++;
+
+		/* The free ring has room for all buffers */
+		ring_push(&pipe->free, buf);
+	}
+
+	for (i = 0; i < pipe->inserters_num; i++) {
+		if (cur[i] && cur[i]->num > 0) {
+			wait_push(pipe, &pipe->inserters[i].full, cur[i], stage);
+		}
+	}
+
+out:
+	for (i = 0; i < pipe->inserters_num; i++) {
+		ring_close(&pipe->inserters[i].full);
+	}
+
+	stage->end = get_ns();
+
+	return NULL;
+}
+
+static errcode_t count_word(void *arg, const char *word, const int len,
+							const int cnt)
+{
+	inserter_t *ins = (inserter_t *)arg;
+
+	return setup_node_cnt(&ins->arena, ins->root, word, len, cnt);
+}
+
+static void *inserter(void *arg)
+{
+	inserter_t *ins = (inserter_t *)arg;
+	pipeline_t *pipe = ins->parent;
+	stage_t *stage = &ins->stage;
+	batch_t *batch;
+	errcode_t ret = ERR_SUCCESS;
+	int i;
+
+	stage->begin = get_ns();
+
+	while ((batch = wait_pop(pipe, &ins->full, stage)) != NULL) {
+		for (i = 0; i < batch->num && ret == ERR_SUCCESS; i++) {
+			if (ins->cached == 1) {
+				ret = cache_insert(&ins->cache, batch->tokens[i].word,
+								   batch->tokens[i].len);
+			} else {
+				ret = setup_node(&ins->arena, ins->root, batch->tokens[i].word,
+								 batch->tokens[i].len);
+			}
+		}
+
+		if (ret != ERR_SUCCESS) {
+			fail(pipe, ret);
+			break;
+		}
+
+		stage->items += batch->num;
+		stage->rounds++;
+
+		/* The free ring has room for all batches */
+		batch->num = 0;
+		batch->used = 0;
+		ring_push(&ins->free, batch);
+	}
+
+	if (ins->cached == 1 && (ret = cache_flush(&ins->cache)) != ERR_SUCCESS) {
+		fail(pipe, ret);
+	}
+
+	stage->end = get_ns();
+
+	return NULL;
+}
+
+/*
+ * Set up a pipeline reading from fd with the given number of inserters,
+ * counting n-grams of the given number of words, half of the memory cap
+ * is shared by the buffers and the other half by the batches of all
+ * inserters
+ */
+pipeline_t *pipeline_create(const int fd, const int inserters_num,
+							const size_t mem_cap, const int cache_slots,
+							const int n)
+{
+	pipeline_t *pipe;
+	inserter_t *ins;
+	int i, j;
+
+	if (!(pipe = (pipeline_t *)calloc(1, sizeof(pipeline_t)))) {
+		return NULL;
+	}
+
+	pipe->fd = fd;
+	pipe->inserters_num = inserters_num;
+	ngram_init(&pipe->ngram, n);
+
+	/* A buffer MUST be able to hold the longest word */
+	if ((pipe->buf_size = mem_cap / 2 / PIPELINE_BUFS) < BATCH_TEXT_SIZE) {
+		pipe->buf_size = BATCH_TEXT_SIZE;
+	}
+
+	if ((pipe->batches_num = mem_cap / 2 / inserters_num /
+							 sizeof(batch_t)) < 2) {
+		pipe->batches_num = 2;
+	}
+
+	if (ring_init(&pipe->full, PIPELINE_BUFS) < 0 ||
+		ring_init(&pipe->free, PIPELINE_BUFS) < 0) {
+		goto failed;
+	}
+
+	for (i = 0; i < PIPELINE_BUFS; i++) {
+		if (!(pipe->bufs[i].data = (char *)malloc(pipe->buf_size))) {
+			goto failed;
+		}
+
+		ring_push(&pipe->free, &pipe->bufs[i]);
+	}
+
+	if (!(pipe->inserters = (inserter_t *)calloc(inserters_num,
+												 sizeof(inserter_t)))) {
+		goto failed;
+	}
+
+	for (i = 0; i < inserters_num; i++) {
+		ins = &pipe->inserters[i];
+		ins->parent = pipe;
+		arena_init(&ins->arena);
+
+		if (!(ins->root = create_node(&ins->arena)) ||
+			!(ins->batches = (batch_t *)malloc(sizeof(batch_t) *
+											   pipe->batches_num)) ||
+			ring_init(&ins->full, pipe->batches_num) < 0 ||
+			ring_init(&ins->free, pipe->batches_num) < 0) {
+			goto failed;
+		}
+
+		for (j = 0; j < pipe->batches_num; j++) {
+			ins->batches[j].num = 0;
+			ins->batches[j].used = 0;
+			ring_push(&ins->free, &ins->batches[j]);
+		}
+
+		if (cache_slots > 0) {
+			if (cache_init(&ins->cache, cache_slots, count_word,
+						   ins) != ERR_SUCCESS) {
+				goto failed;
+			}
+
+			ins->cached = 1;
+		}
+	}
+
+	return pipe;
+
+failed:
+	pipeline_destroy(pipe);
+	return NULL;
+}
+
+/*
+ * NOTE: nodes merged from the private trees are released along with
+ * the arenas of the inserters here
+ */
+void pipeline_destroy(pipeline_t *pipe)
+{
+	inserter_t *ins;
+	int i;
+
+	if (!pipe) {
+		return;
+	}
+
+	if (pipe->inserters) {
+		for (i = 0; i < pipe->inserters_num; i++) {
+			ins = &pipe->inserters[i];
+
+			cache_cleanup(&ins->cache);
+			ring_cleanup(&ins->full);
+			ring_cleanup(&ins->free);
+			arena_release(&ins->arena);
+
+			if (ins->batches) {
+				free(ins->batches);
+			}
+		}
+
+		free(pipe->inserters);
+	}
+
+	ngram_cleanup(&pipe->ngram);
+
+	for (i = 0; i < PIPELINE_BUFS; i++) {
+		if (pipe->bufs[i].data) {
+			free(pipe->bufs[i].data);
+		}
+	}
+
+	ring_cleanup(&pipe->full);
+	ring_cleanup(&pipe->free);
+
+	free(pipe);
+}
+
+/*
+ * Run all stages until the end of the input or the first error
+ */
+errcode_t pipeline_run(pipeline_t *pipe)
+{
+	int i, started = 0;
+
+	if (pthread_create(&pipe->reader.id, NULL, reader, pipe) != 0) {
+		return ERR_NO_MEM;
+	}
+
+	if (pthread_create(&pipe->tokenizer.id, NULL, tokenizer, pipe) != 0) {
+		fail(pipe, ERR_NO_MEM);
+		goto join;
+	}
+
+	for (started = 0; started < pipe->inserters_num; started++) {
+		if (pthread_create(&pipe->inserters[started].stage.id, NULL, inserter,
+						   &pipe->inserters[started]) != 0) {
+			fail(pipe, ERR_NO_MEM);
+			break;
+		}
+	}
+
+	for (i = 0; i < started; i++) {
+		pthread_join(pipe->inserters[i].stage.id, NULL);
+	}
+
+	pthread_join(pipe->tokenizer.id, NULL);
+
+join:
+	pthread_join(pipe->reader.id, NULL);
+
+	return pipe->err;
+}
+
+/*
+ * Graft the private trees of all inserters onto the given root, which
+ * never overlap since each inserter owns different initial letters
+ */
+errcode_t pipeline_merge(pipeline_t *pipe, arena_t *arena, node_t *root)
+{
+	int i, ret;
+
+	for (i = 0; i < pipe->inserters_num; i++) {
+		if ((ret = merge_node(arena, root,
+							  pipe->inserters[i].root)) != ERR_SUCCESS) {
+			return ret;
+		}
+	}
+
+	return ERR_SUCCESS;
+}
+
+static void stage_stats(const stage_t *stage, const char *name,
+						const char *items, const char *suffix)
+{
+	uint64_t busy = stage->end - stage->begin - stage->wait;
+
+	fprintf(stderr, "%s_%s%s=%zu\n%s_rounds%s=%zu\n"
+			"%s_busy_ms%s=%.3f\n%s_wait_ms%s=%.3f\n%s_%s_per_s%s=%.0f\n",
+			name, items, suffix, stage->items, name, suffix, stage->rounds,
+			name, suffix, busy / 1e6, name, suffix, stage->wait / 1e6,
+			name, items, suffix, busy ? stage->items * 1e9 / busy : 0.0);
+}
+
+void pipeline_stats(const pipeline_t *pipe)
+{
+	const inserter_t *ins;
+	char suffix[16];
+	int i;
+
+	fprintf(stderr, "pipeline_buffer_size=%zu\npipeline_buffers=%d\n"
+			"pipeline_batches=%d\n",
+			pipe->buf_size, PIPELINE_BUFS,
+			pipe->batches_num * pipe->inserters_num);
+
+	stage_stats(&pipe->reader, "reader", "bytes", "");
+	stage_stats(&pipe->tokenizer, "tokenizer", "words", "");
+
+	for (i = 0; i < pipe->inserters_num; i++) {
+		ins = &pipe->inserters[i];
+		snprintf(suffix, sizeof(suffix), ".%d", i);
+		stage_stats(&ins->stage, "inserter", "words", suffix);
+
+		if (ins->cached == 1) {
+			fprintf(stderr, "cache_hit_rate.%d=%.3f\n", i,
+					cache_hit_rate(&ins->cache));
+		}
+	}
+}
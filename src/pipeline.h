@@ -0,0 +1,112 @@
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "node.h"
+#include "token.h"
+#include "cache.h"
+#include "ring.h"
+#include "ngram.h"
+
+/*
+ * Analyse the input in three stages running in parallel, connected by
+ * lock-free rings between each pair of neighbouring stages:
+ *
+ *	reader		fills fixed buffers from the input, carrying over the
+ *				word cut across by the end of each buffer
+ *	tokenizer	splits buffers into words, or n-grams of the words in
+ *				a window carried over from buffer to buffer, and copies
+ *				them into batches, one for each inserter, then gives the
+ *				buffers back
+ *	inserters	count words of their own batches in private trees, each
+ *				owning the subtrees of a fixed set of initial letters
+ *
+ * Buffers and batches go round in circles, so the memory used by the
+ * pipeline itself never exceeds the cap given in advance.
+ */
+
+/* The number of buffers between the reader and the tokenizer */
+#define PIPELINE_BUFS		4
+
+/* The default cap on the memory of buffers and batches */
+#define PIPELINE_MEM_CAP_DEF	(16UL << 20)
+
+/* The room for words in a batch, which limits the longest word */
+#define BATCH_TEXT_SIZE		4096
+
+typedef struct batch {
+	int num;
+	size_t used;
+	token_t tokens[TOKENS_BATCH];
+	char text[BATCH_TEXT_SIZE];
+} batch_t;
+
+typedef struct buffer {
+	/* The number of bytes of complete words at the start of data */
+	size_t len;
+	char *data;
+} buffer_t;
+
+/*
+ * Counters of a stage. Items are bytes for the reader, words for the
+ * tokenizer and the inserters. The time waiting on a ring either empty
+ * or full is accounted separately from the time working
+ */
+typedef struct stage {
+	pthread_t id;
+	uint64_t begin, end, wait;
+	size_t items, rounds;
+} stage_t;
+
+struct pipeline;
+
+typedef struct inserter {
+	stage_t stage;
+
+	/* Batches from and back to the tokenizer */
+	ring_t full, free;
+	batch_t *batches;
+
+	/* The private tree and the arena to allocate its nodes */
+	arena_t arena;
+	node_t *root;
+
+	/* The cache of hot words in front of the tree, if enabled */
+	cache_t cache;
+	int cached;
+
+	struct pipeline *parent;
+} inserter_t;
+
+typedef struct pipeline {
+	int fd;
+
+	/* Buffers from the reader to the tokenizer and back */
+	buffer_t bufs[PIPELINE_BUFS];
+	size_t buf_size;
+	ring_t full, free;
+
+	stage_t reader, tokenizer;
+
+	/* The window of the tokenizer if n-grams are counted */
+	ngram_t ngram;
+
+	inserter_t *inserters;
+	int inserters_num;
+	int batches_num;
+
+	/* Set by the first stage running into an error, stopping all */
+	int failed;
+	errcode_t err;
+} pipeline_t;
+
+pipeline_t *pipeline_create(const int fd, const int inserters_num,
+							const size_t mem_cap, const int cache_slots,
+							const int n);
+void pipeline_destroy(pipeline_t *pipe);
+errcode_t pipeline_run(pipeline_t *pipe);
+errcode_t pipeline_merge(pipeline_t *pipe, arena_t *arena, node_t *root);
+void pipeline_stats(const pipeline_t *pipe);
+
+#endif	/* _PIPELINE_H */
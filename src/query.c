@@ -0,0 +1,668 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "query.h"
+#include "topk.h"
+
+/* The most connections waiting to be accepted */
+#define QUERY_BACKLOG		8
+
+/* The most clients served at once */
+#define QUERY_CONNS_MAX		64
+
+/*
+ * The time a client may take to read any of its reply, in ms, before it
+ * is dropped rather than keeping its reply in memory
+ */
+#define QUERY_SEND_TIMEOUT	5000
+
+static const char *kind_names[QUERY_KINDS] = {
+	"count", "prefix", "top"
+};
+
+/*
+ * A client with the part of its requests read so far, and the part of
+ * its reply not written out yet, until when no more requests are read
+ */
+typedef struct conn {
+	int fd;
+	char line[QUERY_LINE_MAX + 1];
+	size_t len;
+
+	out_t out;
+	size_t sent;
+
+	/* When the reply last went out, in ns */
+	uint64_t progress;
+} conn_t;
+
+/*
+ * The words under the node of a prefix are visited as if they started
+ * from the last letter of the prefix, the rest of which is put in front
+ */
+typedef struct prefix {
+	out_t *out;
+	const char *word;
+	int len;
+} prefix_t;
+
+/*
+ * Turn the given word into the letters of the tree in place, return the
+ * index of its first letter, or -1 if any of its letters is illegal
+ */
+static int fold_word(char *word, const int len)
+{
+	int i, idx, first = -1;
+
+	for (i = 0; i < len; i++) {
+		if ((idx = char_symbol(word[i])) < 0) {
+			return -1;
+		}
+
+		word[i] = INDEX_CHAR(idx);
+
+		if (i == 0) {
+			first = idx;
+		}
+	}
+
+	return first;
+}
+
+/*
+ * Return the node of the given folded word in the subtree of its first
+ * letter, or NULL if it is not there yet
+ */
+static const node_t *find_node(const node_t *node, const char *word,
+							   const int len)
+{
+	int i;
+
+	for (i = 1; i < len && node; i++) {
+		node = node_child(node, char_symbol(word[i]));
+	}
+
+	return node;
+}
+
+static errcode_t answer_count(query_t *query, char *word, const int len,
+							  out_t *out)
+{
+	const node_t *node;
+	root_t *root;
+	int idx, cnt = 0;
+
+	if ((idx = fold_word(word, len)) >= 0) {
+		root = query->roots[idx];
+
+		if (tsync_reader_entry(&root->sync) < 0) {
+			return ERR_BAD_PARAM;
+		}
+
+		if ((node = find_node(root->n, word, len)) != NULL) {
+			cnt = node->cnt;
+		}
+
+		tsync_reader_exit(&root->sync);
+	}
+
+	return out_word(out, word, len, cnt);
+}
+
+static errcode_t visit_prefix(void *arg, const char *word, const int len,
+							  const int cnt)
+{
+	prefix_t *prefix = (prefix_t *)arg;
+	errcode_t ret;
+
+	if ((ret = out_bytes(prefix->out, prefix->word,
+						 prefix->len - 1)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	return out_word(prefix->out, word, len, cnt);
+}
+
+static errcode_t answer_prefix(query_t *query, char *word, const int len,
+							   out_t *out)
+{
+	prefix_t prefix = { out, word, len };
+	const node_t *node;
+	root_t *root;
+	errcode_t ret = ERR_SUCCESS;
+	int idx;
+
+	if ((idx = fold_word(word, len)) < 0) {
+		return ERR_SUCCESS;
+	}
+
+	root = query->roots[idx];
+
+	if (tsync_reader_entry(&root->sync) < 0) {
+		return ERR_BAD_PARAM;
+	}
+
+	if ((node = find_node(root->n, word, len)) != NULL) {
+		ret = walk_node(node, char_symbol(word[len - 1]),
+						visit_prefix, &prefix);
+	}
+
+	tsync_reader_exit(&root->sync);
+
+	return ret;
+}
+
+/*
+ * Each subtree is read as it is when its turn comes, so the top K may
+ * not be that of one single moment
+ */
+static errcode_t answer_top(query_t *query, const int k, out_t *out)
+{
+	root_t *root;
+	topk_t top;
+	errcode_t ret;
+	int i;
+
+	if ((ret = topk_init(&top, k)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	for (i = 0; i < AVAILABLE_CHARS && ret == ERR_SUCCESS; i++) {
+		root = query->roots[i];
+
+		if (tsync_reader_entry(&root->sync) < 0) {
+			ret = ERR_BAD_PARAM;
+			break;
+		}
+
+		ret = walk_node(root->n, i, topk_insert, &top);
+		tsync_reader_exit(&root->sync);
+	}
+
+	if (ret == ERR_SUCCESS) {
+		ret = topk_output(&top, out);
+	}
+
+	topk_cleanup(&top);
+
+	return ret;
+}
+
+/*
+ * Format the answer to the given request, which is not NULL-terminated,
+ * and tell its kind unless it is malformed
+ */
+static errcode_t answer(query_t *query, char *line, int len, out_t *out,
+						query_kind_t *kind)
+{
+	char *arg;
+	int k;
+
+	/* Tolerate the line endings of telnet and the like */
+	while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == ' ')) {
+		len--;
+	}
+
+	*kind = QUERY_KINDS;
+
+	if (!(arg = memchr(line, ' ', len))) {
+		return ERR_BAD_FILE;
+	}
+
+	*arg++ = '\0';
+	len -= arg - line;
+
+	if (len <= 0) {
+		return ERR_BAD_FILE;
+	}
+
+	for (*kind = 0; *kind < QUERY_KINDS; (*kind)++) {
+		if (strcmp(line, kind_names[*kind]) == 0) {
+			break;
+		}
+	}
+
+	switch (*kind) {
+	case QUERY_COUNT:
+		return answer_count(query, arg, len, out);
+	case QUERY_PREFIX:
+		return answer_prefix(query, arg, len, out);
+	case QUERY_TOP:
+		arg[len] = '\0';
+
+		if ((k = atoi(arg)) <= 0 || k > QUERY_TOP_MAX) {
+			*kind = QUERY_KINDS;
+			return ERR_BAD_FILE;
+		}
+
+		return answer_top(query, k, out);
+	default:
+		return ERR_BAD_FILE;
+	}
+}
+
+static void record_latency(latency_t *lat, const uint64_t ns)
+{
+	uint64_t *p;
+	size_t size;
+
+	if (lat->num == lat->size) {
+		size = lat->size ? lat->size * 2 : 1024;
+
+		if (!(p = (uint64_t *)realloc(lat->ns, sizeof(uint64_t) * size))) {
+			return;
+		}
+
+		lat->ns = p;
+		lat->size = size;
+	}
+
+	lat->ns[lat->num++] = ns;
+}
+
+/*
+ * Format the answer to the given request of the given client after the
+ * reply not written out yet, if any. The room right after the request
+ * MUST be available
+ */
+static errcode_t reply(query_t *query, conn_t *conn, char *line,
+					   const int len)
+{
+	out_t *out = &conn->out;
+	query_kind_t kind;
+	const char *reason;
+	uint64_t begin;
+	size_t start = out->len;
+	errcode_t ret;
+
+	begin = get_ns();
+
+	if ((ret = answer(query, line, len, out, &kind)) != ERR_SUCCESS) {
+		switch (ret) {
+		case ERR_BAD_FILE:
+			reason = "bad request";
+			break;
+		case ERR_BAD_PARAM:
+			reason = "shutting down";
+			break;
+		default:
+			reason = "out of memory";
+			break;
+		}
+
+		out->len = start;
+		out_bytes(out, "error: ", 7);
+		out_bytes(out, reason, strlen(reason));
+		out_bytes(out, "\n", 1);
+	}
+
+	ret = out_bytes(out, "\n", 1);
+
+	/* Malformed requests are not worth the statistics */
+	if (kind < QUERY_KINDS) {
+		record_latency(&query->lat[kind], get_ns() - begin);
+	}
+
+	return ret;
+}
+
+/*
+ * Write out as much of the reply to the given client as it takes without
+ * blocking, return -1 if the client is gone
+ */
+static int send_reply(conn_t *conn)
+{
+	ssize_t n;
+
+	while (conn->sent < conn->out.len) {
+		n = write(conn->fd, conn->out.buf + conn->sent,
+				  conn->out.len - conn->sent);
+
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+
+		conn->sent += n;
+		conn->progress = get_ns();
+	}
+
+	/* A large reply doesn't keep its buffer once written out */
+	out_cleanup(&conn->out);
+	out_init(&conn->out, -1, NULL, 0);
+	conn->sent = 0;
+
+	return 0;
+}
+
+/*
+ * Answer the requests read from the given client in turn, until one of
+ * the replies can't be written out at once, return -1 if the client is
+ * to be dropped
+ */
+static int serve_lines(query_t *query, conn_t *conn)
+{
+	char *nl;
+
+	while (conn->out.len == 0 &&
+		   (nl = memchr(conn->line, '\n', conn->len)) != NULL) {
+		if (reply(query, conn, conn->line, nl - conn->line) != ERR_SUCCESS ||
+			send_reply(conn) < 0) {
+			return -1;
+		}
+
+		conn->len -= nl + 1 - conn->line;
+		memmove(conn->line, nl + 1, conn->len);
+	}
+
+	/* A request too long */
+	if (conn->len == QUERY_LINE_MAX &&
+		!memchr(conn->line, '\n', conn->len)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Serve the given client polled ready, return -1 if it has hung up, or
+ * is to be dropped
+ */
+static int serve_conn(query_t *query, conn_t *conn)
+{
+	ssize_t n;
+
+	if (conn->out.len > 0) {
+		if (send_reply(conn) < 0) {
+			return -1;
+		}
+	} else {
+		n = read(conn->fd, conn->line + conn->len,
+				 QUERY_LINE_MAX - conn->len);
+
+		if (n < 0) {
+			return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+		} else if (n == 0) {
+			return -1;
+		}
+
+		conn->len += n;
+	}
+
+	return serve_lines(query, conn);
+}
+
+static void close_conn(conn_t *conn)
+{
+	close(conn->fd);
+	out_cleanup(&conn->out);
+}
+
+static int accept_conn(query_t *query, conn_t *conn)
+{
+	int fd, flags;
+
+	if ((fd = accept(query->fd, NULL, NULL)) < 0) {
+		return -1;
+	}
+
+	if ((flags = fcntl(fd, F_GETFL)) < 0 ||
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	memset(conn, 0, sizeof(conn_t));
+	conn->fd = fd;
+	out_init(&conn->out, -1, NULL, 0);
+
+	return 0;
+}
+
+/*
+ * Poll the clients, each for its request or for the room to write out
+ * its reply, along with the listening socket while there is room for
+ * one more client, and the wake-up pipe
+ */
+static int poll_conns(query_t *query, const conn_t *conns, const int num,
+					  struct pollfd *fds)
+{
+	uint64_t now = get_ns(), deadline;
+	int i, timeout = -1, left;
+
+	fds[0].fd = query->wake[0];
+	fds[0].events = POLLIN;
+	fds[1].fd = query->fd;
+	fds[1].events = num < QUERY_CONNS_MAX ? POLLIN : 0;
+
+	for (i = 0; i < num; i++) {
+		fds[i + 2].fd = conns[i].fd;
+		fds[i + 2].events = conns[i].out.len > 0 ? POLLOUT : POLLIN;
+
+		if (conns[i].out.len == 0) {
+			continue;
+		}
+
+		deadline = conns[i].progress + QUERY_SEND_TIMEOUT * 1000000ULL;
+		left = deadline > now ? (deadline - now + 999999) / 1000000 : 0;
+
+		if (timeout < 0 || left < timeout) {
+			timeout = left;
+		}
+	}
+
+	return poll(fds, num + 2, timeout);
+}
+
+static void *serve(void *arg)
+{
+	query_t *query = (query_t *)arg;
+	conn_t conns[QUERY_CONNS_MAX];
+	struct pollfd fds[QUERY_CONNS_MAX + 2];
+	uint64_t now;
+	int num = 0, i;
+
+	for (;;) {
+		if (poll_conns(query, conns, num, fds) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			break;
+		}
+
+		if (fds[0].revents != 0) {
+			break;
+		}
+
+		now = get_ns();
+
+		/* The last one takes the place of one dropped */
+		for (i = num - 1; i >= 0; i--) {
+			if ((fds[i + 2].revents != 0 &&
+				 serve_conn(query, &conns[i]) < 0) ||
+				(conns[i].out.len > 0 && fds[i + 2].revents == 0 &&
+				 now - conns[i].progress >=
+				 QUERY_SEND_TIMEOUT * 1000000ULL)) {
+				close_conn(&conns[i]);
+				conns[i] = conns[--num];
+			}
+		}
+
+		if (fds[1].revents != 0 && num < QUERY_CONNS_MAX &&
+			accept_conn(query, &conns[num]) == 0) {
+			num++;
+		}
+	}
+
+	for (i = 0; i < num; i++) {
+		close_conn(&conns[i]);
+	}
+
+	return NULL;
+}
+
+static void close_query(query_t *query)
+{
+	int i;
+
+	if (query->fd >= 0) {
+		close(query->fd);
+		unlink(query->path);
+		query->fd = -1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (query->wake[i] >= 0) {
+			close(query->wake[i]);
+			query->wake[i] = -1;
+		}
+	}
+}
+
+/*
+ * Listen on a Unix socket of the given path and start the query thread
+ * answering requests against the given subtrees
+ */
+errcode_t query_start(query_t *query, const char *path, root_t **roots)
+{
+	struct sockaddr_un addr;
+	struct stat statbuf;
+	int fd;
+
+	memset(query, 0, sizeof(query_t));
+	query->roots = roots;
+	query->path = path;
+	query->fd = query->wake[0] = query->wake[1] = -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		return ERR_BAD_PARAM;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	/* A socket left behind by a previous run is replaced */
+	if (lstat(path, &statbuf) == 0 && S_ISSOCK(statbuf.st_mode)) {
+		unlink(path);
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		return ERR_IO;
+	}
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return ERR_IO;
+	}
+
+	query->fd = fd;
+
+	if (listen(fd, QUERY_BACKLOG) < 0 || pipe(query->wake) < 0) {
+		close_query(query);
+		return ERR_IO;
+	}
+
+	/* A client gone away is told by write() failing, not by a signal */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (pthread_create(&query->id, NULL, serve, query) != 0) {
+		close_query(query);
+		return ERR_NO_MEM;
+	}
+
+	query->started = 1;
+
+	return ERR_SUCCESS;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Shut down every subtree for reading, waiting for any request in the
+ * middle of reading one, then stop the query thread. The subtrees are
+ * made available again in the end
+ */
+void query_stop(query_t *query)
+{
+	int i;
+
+	if (query->started == 1) {
+		for (i = 0; i < AVAILABLE_CHARS; i++) {
+			tsync_shutdown_entry(&query->roots[i]->sync);
+		}
+
+		if (write(query->wake[1], "", 1) != 1) {
+			printf("Failed to wake up the query thread\n");
+		}
+
+		pthread_join(query->id, NULL);
+		query->started = 0;
+
+		for (i = 0; i < QUERY_KINDS; i++) {
+			qsort(query->lat[i].ns, query->lat[i].num, sizeof(uint64_t),
+				  compare_u64);
+		}
+
+		for (i = 0; i < AVAILABLE_CHARS; i++) {
+			tsync_shutdown_revoke(&query->roots[i]->sync);
+		}
+	}
+
+	close_query(query);
+}
+
+/*
+ * Report the number of requests of each kind answered and the 50th and
+ * 99th percentiles of their latency, the query thread MUST have been
+ * stopped
+ */
+void query_stats(const query_t *query)
+{
+	const latency_t *lat;
+	int i;
+
+	for (i = 0; i < QUERY_KINDS; i++) {
+		lat = &query->lat[i];
+
+		fprintf(stderr, "query_requests.%s=%zu\n", kind_names[i], lat->num);
+
+		if (lat->num == 0) {
+			continue;
+		}
+
+		fprintf(stderr, "query_p50_us.%s=%.1f\nquery_p99_us.%s=%.1f\n"
+				"query_max_us.%s=%.1f\n",
+				kind_names[i], lat->ns[(lat->num * 50 + 99) / 100 - 1] / 1e3,
+				kind_names[i], lat->ns[(lat->num * 99 + 99) / 100 - 1] / 1e3,
+				kind_names[i], lat->ns[lat->num - 1] / 1e3);
+	}
+}
+
+void query_cleanup(query_t *query)
+{
+	int i;
+
+	for (i = 0; i < QUERY_KINDS; i++) {
+		free(query->lat[i].ns);
+	}
+
+	memset(query->lat, 0, sizeof(query->lat));
+}
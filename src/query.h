@@ -0,0 +1,68 @@
+#ifndef _QUERY_H
+#define _QUERY_H
+
+#include <pthread.h>
+#include "node.h"
+
+/*
+ * Answer queries on a local Unix socket against the shared subtrees
+ * while they are still being built up, serving many clients in turn as
+ * they are ready with a request or for its reply. Each request is a
+ * line of:
+ *
+ *	count <word>	the occurences of the given word
+ *	prefix <p>		every word starting with p and its occurences
+ *	top <K>			the K most frequent words so far
+ *
+ * answered by lines of "<word> : <occurences>" as in the output, or a
+ * line of "error: <reason>", followed by an empty line.
+ *
+ * A subtree is read with the readers side of its tsync taken, whereas
+ * threads inserting words take the writers side for every change they
+ * make. Replies are formatted in memory and only written out once the
+ * subtree is left, without blocking, so a slow client never holds up the
+ * inserters nor other clients, and is dropped if it doesn't read its
+ * reply for a while.
+ */
+
+/* The longest request line */
+#define QUERY_LINE_MAX		256
+
+/* The most words a top request may ask for */
+#define QUERY_TOP_MAX		10000
+
+typedef enum {
+	QUERY_COUNT = 0,
+	QUERY_PREFIX,
+	QUERY_TOP,
+	QUERY_KINDS
+} query_kind_t;
+
+/* The time taken by each request of a kind answered so far, in ns */
+typedef struct latency {
+	uint64_t *ns;
+	size_t num, size;
+} latency_t;
+
+typedef struct query {
+	root_t **roots;
+
+	/* The listening socket and its path */
+	int fd;
+	const char *path;
+
+	/* The pipe to wake up the query thread when it is to stop */
+	int wake[2];
+
+	pthread_t id;
+	int started;
+
+	latency_t lat[QUERY_KINDS];
+} query_t;
+
+errcode_t query_start(query_t *query, const char *path, root_t **roots);
+void query_stop(query_t *query);
+void query_stats(const query_t *query);
+void query_cleanup(query_t *query);
+
+#endif	/* _QUERY_H */
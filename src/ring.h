@@ -0,0 +1,104 @@
+#ifndef _RING_H
+#define _RING_H
+
+#include <stdlib.h>
+
+/*
+ * A lock-free ring of pointers between one producer and one consumer.
+ *
+ * The producer only ever writes tail and the consumer only ever writes
+ * head, each on its own cache line, so they never contend. A slot is
+ * published by the release store to tail and given back by the release
+ * store to head.
+ */
+typedef struct ring {
+	void **slots;
+	unsigned long mask;
+
+	/* The next slot to pop, written by the consumer */
+	unsigned long head __attribute__((aligned(64)));
+
+	/* The next slot to push, written by the producer */
+	unsigned long tail __attribute__((aligned(64)));
+
+	/* Set by the producer once nothing more is to be pushed */
+	int closed;
+} ring_t;
+
+/*
+ * Set up a ring of at least the given number of slots, rounded up to
+ * a power of 2
+ */
+static inline int ring_init(ring_t *ring, const unsigned long slots_num)
+{
+	unsigned long size = 1;
+
+	while (size < slots_num) {
+		size <<= 1;
+	}
+
+	if (!(ring->slots = (void **)calloc(size, sizeof(void *)))) {
+		return -1;
+	}
+
+	ring->mask = size - 1;
+	ring->head = ring->tail = 0;
+	ring->closed = 0;
+
+	return 0;
+}
+
+static inline void ring_cleanup(ring_t *ring)
+{
+	if (ring->slots) {
+		free(ring->slots);
+		ring->slots = NULL;
+	}
+}
+
+/*
+ * Return 0 on success, or -1 if the ring is full
+ */
+static inline int ring_push(ring_t *ring, void *p)
+{
+	unsigned long tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+	if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) > ring->mask) {
+		return -1;
+	}
+
+	ring->slots[tail & ring->mask] = p;
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*
+ * Return the oldest pointer in the ring, or NULL if it is empty
+ */
+static inline void *ring_pop(ring_t *ring)
+{
+	unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	void *p;
+
+	if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+
+	p = ring->slots[head & ring->mask];
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	return p;
+}
+
+static inline void ring_close(ring_t *ring)
+{
+	__atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+}
+
+static inline int ring_closed(ring_t *ring)
+{
+	return __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);
+}
+
+#endif	/* _RING_H */
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sched.h"
+
+sched_t *sched_create(const int workers_num, const int tasks_num)
+{
+	return sched_create_shares(workers_num, tasks_num, NULL);
+}
+
+/*
+ * Hand the tasks from heads[i] up to heads[i + 1] to the ith worker
+ * initially, the last worker up to the last task. The heads MUST be in
+ * ascending order, or NULL for equal shares
+ */
+sched_t *sched_create_shares(const int workers_num, const int tasks_num,
+							 const int *heads)
+{
+	sched_t *sched;
+	queue_t *q;
+	int i;
+
+	if (!(sched = (sched_t *)malloc(sizeof(sched_t)))) {
+		return NULL;
+	}
+
+	if (posix_memalign((void **)&sched->queues, sizeof(queue_t),
+					   sizeof(queue_t) * workers_num) != 0) {
+		free(sched);
+		return NULL;
+	}
+
+	sched->workers_num = workers_num;
+
+	for (i = 0; i < workers_num; i++) {
+		q = &sched->queues[i];
+		memset(q, 0, sizeof(queue_t));
+
+		if (heads) {
+			q->head = heads[i];
+			q->tail = (i + 1 < workers_num) ? heads[i + 1] : tasks_num;
+		} else {
+			q->head = (long)tasks_num * i / workers_num;
+			q->tail = (long)tasks_num * (i + 1) / workers_num;
+		}
+
+		pthread_mutex_init(&q->mutex, NULL);
+	}
+
+	return sched;
+}
+
+void sched_destroy(sched_t *sched)
+{
+	int i;
+
+	if (!sched) {
+		return;
+	}
+
+	for (i = 0; i < sched->workers_num; i++) {
+		pthread_mutex_destroy(&sched->queues[i].mutex);
+	}
+
+	free(sched->queues);
+	free(sched);
+}
+
+/*
+ * Move half of the tasks left to the busiest worker onto the given one,
+ * return 0 on success, -1 if no task is left anywhere
+ *
+ * NOTE: tasks are never added to any worker but by stealing, so once
+ * all workers are seen empty there is no more task to come
+ */
+static int steal(sched_t *sched, const int worker)
+{
+	queue_t *own = &sched->queues[worker], *victim;
+	int i, left, busiest, most, head, tail;
+
+	do {
+		for (i = 0, busiest = -1, most = 0; i < sched->workers_num; i++) {
+			victim = &sched->queues[i];
+			left = __atomic_load_n(&victim->tail, __ATOMIC_RELAXED) -
+				   __atomic_load_n(&victim->head, __ATOMIC_RELAXED);
+
+			if (i != worker && left > most) {
+				busiest = i;
+				most = left;
+			}
+		}
+
+		if (busiest < 0) {
+			return -1;
+		}
+
+		victim = &sched->queues[busiest];
+
+		pthread_mutex_lock(&victim->mutex);
+		tail = victim->tail;
+		head = tail - (tail - victim->head + 1) / 2;
+		__atomic_store_n(&victim->tail, head, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&victim->mutex);
+	} while (head >= tail);	/* The victim ran out of tasks in between */
+
+	pthread_mutex_lock(&own->mutex);
+	__atomic_store_n(&own->head, head, __ATOMIC_RELAXED);
+	__atomic_store_n(&own->tail, tail, __ATOMIC_RELAXED);
+	own->steals++;
+	pthread_mutex_unlock(&own->mutex);
+
+	return 0;
+}
+
+/*
+ * Return the next task for the given worker, or -1 if all are done
+ */
+int sched_next(sched_t *sched, const int worker)
+{
+	queue_t *own = &sched->queues[worker];
+	int task;
+
+	do {
+		pthread_mutex_lock(&own->mutex);
+
+		if (own->head < own->tail) {
+			task = own->head;
+			__atomic_store_n(&own->head, task + 1, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&own->mutex);
+			return task;
+		}
+
+		pthread_mutex_unlock(&own->mutex);
+	} while (steal(sched, worker) == 0);
+
+	return -1;
+}
@@ -0,0 +1,34 @@
+#ifndef _TASK_SCHED_H
+#define _TASK_SCHED_H
+
+#include <pthread.h>
+
+/*
+ * A scheduler of tasks numbered from 0 onwards among a fixed number of
+ * workers. Initially each worker owns a share of consecutive tasks,
+ * equal unless told otherwise, and takes them from the front. Once it
+ * runs out of tasks, it steals half of what is left from the back of
+ * the busiest worker.
+ */
+typedef struct queue {
+	/* The tasks owned by the worker, in the range of [head, tail) */
+	int head, tail;
+
+	/* The number of times the worker has stolen tasks from others */
+	int steals;
+
+	pthread_mutex_t mutex;
+} __attribute__((aligned(64))) queue_t;
+
+typedef struct sched {
+	int workers_num;
+	queue_t *queues;
+} sched_t;
+
+sched_t *sched_create(const int workers_num, const int tasks_num);
+sched_t *sched_create_shares(const int workers_num, const int tasks_num,
+							 const int *heads);
+void sched_destroy(sched_t *sched);
+int sched_next(sched_t *sched, const int worker);
+
+#endif	/* _TASK_SCHED_H */
@@ -0,0 +1,462 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "dawg.h"
+
+/* The longest node, with all children present */
+#define SNAP_NODE_MAX		(1 + SNAP_BITMAP_WORDS + AVAILABLE_CHARS)
+
+/*
+ * A node being saved, with the offsets of its children saved so far
+ */
+typedef struct wframe {
+	/* NULL for the root, which stands for no alphabet */
+	const node_t *node;
+	int next, num;
+	unsigned char idx[AVAILABLE_CHARS];
+	uint64_t offs[AVAILABLE_CHARS];
+} wframe_t;
+
+typedef struct writer {
+	out_t out;
+
+	/* The offset of the next node in the file */
+	uint64_t off;
+
+	snap_header_t hdr;
+} writer_t;
+
+static errcode_t grow(void **frames, int *depth, const size_t size)
+{
+	void *p;
+
+	if (!(p = realloc(*frames, size * *depth * 2))) {
+		return ERR_NO_MEM;
+	}
+
+	*frames = p;
+	*depth *= 2;
+
+	return ERR_SUCCESS;
+}
+
+static errcode_t write_node(writer_t *w, const wframe_t *f, uint64_t *off)
+{
+	uint32_t rec[SNAP_NODE_MAX], *bitmap = rec + 1;
+	uint64_t rel;
+	int i, n = 1 + SNAP_BITMAP_WORDS;
+	errcode_t ret;
+
+	memset(rec, 0, sizeof(uint32_t) * n);
+	rec[0] = f->node ? f->node->cnt : 0;
+
+	for (i = 0; i < f->num; i++) {
+		bitmap[f->idx[i] / 32] |= 1U << (f->idx[i] % 32);
+
+		if ((rel = (w->off - f->offs[i]) / sizeof(uint32_t)) > UINT32_MAX) {
+			printf("The snapshot is too large\n");
+			return ERR_BAD_PARAM;
+		}
+
+		rec[n++] = rel;
+	}
+
+	if ((ret = out_bytes(&w->out, rec, sizeof(uint32_t) * n)) != 0) {
+		return ret;
+	}
+
+	*off = w->off;
+	w->off += sizeof(uint32_t) * n;
+
+	w->hdr.nodes++;
+
+	if (rec[0]) {
+		w->hdr.words++;
+		w->hdr.total += rec[0];
+	}
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Save the tree made of the given subtrees, one for each alphabet and
+ * NULL if absent, walking down the tree in post-order
+ */
+static errcode_t write_tree(writer_t *w, node_t *const subtrees[])
+{
+	wframe_t *frames, *f, *parent;
+	const node_t *child;
+	int depth = WORD_LEN_MAX, top = 0;
+	uint64_t off;
+	errcode_t ret = ERR_SUCCESS;
+
+	if (!(frames = (wframe_t *)malloc(sizeof(wframe_t) * depth))) {
+		return ERR_NO_MEM;
+	}
+
+	frames[0].node = NULL;
+	frames[0].next = frames[0].num = 0;
+
+	while (top >= 0) {
+		f = &frames[top];
+
+		if (f->node) {
+			child = node_next(f->node, &f->next);
+		} else {
+			for (child = NULL; !child && f->next < AVAILABLE_CHARS; ) {
+				child = subtrees[f->next++];
+			}
+		}
+
+		if (child) {
+			if (top + 1 == depth &&
+				(ret = grow((void **)&frames, &depth,
+							sizeof(wframe_t))) != ERR_SUCCESS) {
+				break;
+			}
+
+			f = &frames[++top];
+			f->node = child;
+			f->next = f->num = 0;
+			continue;
+		}
+
+		if ((ret = write_node(w, f, &off)) != ERR_SUCCESS) {
+			break;
+		}
+
+		if (top == 0) {
+			w->hdr.root = off;
+		} else {
+			parent = &frames[top - 1];
+			parent->idx[parent->num] = parent->next - 1;
+			parent->offs[parent->num++] = off;
+		}
+
+		top--;
+	}
+
+	free(frames);
+
+	return ret;
+}
+
+errcode_t snapshot_save(const char *path,
+						node_t *const subtrees[AVAILABLE_CHARS])
+{
+	char buf[OUTPUT_BUF_SIZE];
+	char temp[PATH_MAX];
+	writer_t w;
+	int fd;
+	errcode_t ret;
+
+	if ((fd = out_create(path, temp, sizeof(temp))) < 0) {
+		return ERR_IO;
+	}
+
+	memset(&w, 0, sizeof(writer_t));
+	out_init(&w.out, fd, buf, sizeof(buf));
+
+	/* The header is filled up in the end */
+	if ((ret = out_bytes(&w.out, &w.hdr, sizeof(w.hdr))) != ERR_SUCCESS) {
+		goto out;
+	}
+
+	w.off = sizeof(w.hdr);
+
+	if ((ret = write_tree(&w, subtrees)) != ERR_SUCCESS ||
+		(ret = out_flush(&w.out)) != ERR_SUCCESS) {
+		goto out;
+	}
+
+	memcpy(w.hdr.magic, SNAP_MAGIC, sizeof(w.hdr.magic));
+	w.hdr.version = SNAP_VERSION;
+	w.hdr.chars = AVAILABLE_CHARS;
+	w.hdr.size = w.off;
+
+	if (pwrite(fd, &w.hdr, sizeof(w.hdr), 0) != sizeof(w.hdr)) {
+		ret = ERR_IO;
+	}
+
+out:
+	return out_replace(fd, temp, path, ret);
+}
+
+errcode_t snapshot_open(snapshot_t *snap, const char *path)
+{
+	const snap_header_t *hdr;
+	struct stat statbuf;
+	void *data;
+	int fd;
+
+	memset(snap, 0, sizeof(snapshot_t));
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return ERR_IO;
+	}
+
+	if (fstat(fd, &statbuf) < 0 || statbuf.st_size < sizeof(snap_header_t)) {
+		close(fd);
+		return ERR_BAD_FILE;
+	}
+
+	data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		return ERR_IO;
+	}
+
+	hdr = (const snap_header_t *)data;
+
+	if (memcmp(hdr->magic, SNAP_MAGIC, sizeof(hdr->magic)) != 0 ||
+		hdr->version != SNAP_VERSION || hdr->chars != AVAILABLE_CHARS ||
+		hdr->size != statbuf.st_size || hdr->root < sizeof(snap_header_t) ||
+		hdr->root + sizeof(uint32_t) * (1 + SNAP_BITMAP_WORDS) > hdr->size ||
+		hdr->root % sizeof(uint32_t) != 0) {
+		munmap(data, statbuf.st_size);
+		return ERR_BAD_FILE;
+	}
+
+	snap->data = (const char *)data;
+	snap->size = statbuf.st_size;
+	snap->hdr = hdr;
+
+	return ERR_SUCCESS;
+}
+
+void snapshot_close(snapshot_t *snap)
+{
+	if (snap->data) {
+		munmap((void *)snap->data, snap->size);
+		snap->data = NULL;
+	}
+}
+
+static inline const uint32_t *snap_root(const snapshot_t *snap)
+{
+	return (const uint32_t *)(snap->data + snap->hdr->root);
+}
+
+static inline const uint32_t *snap_child(const uint32_t *node, const int idx)
+{
+	const uint32_t *bitmap = node + 1;
+	int i, pos = 0;
+
+	if (!(bitmap[idx / 32] & (1U << (idx % 32)))) {
+		return NULL;
+	}
+
+	for (i = 0; i < idx / 32; i++) {
+		pos += __builtin_popcount(bitmap[i]);
+	}
+
+	pos += __builtin_popcount(bitmap[idx / 32] & ((1U << (idx % 32)) - 1));
+
+	return node - node[1 + SNAP_BITMAP_WORDS + pos];
+}
+
+/*
+ * Return the occurence of the given word, 0 if never seen
+ */
+int snapshot_count(const snapshot_t *snap, const char *word, const int len)
+{
+	const uint32_t *node = snap_root(snap);
+	int i, idx;
+
+	for (i = 0; i < len && node; i++) {
+		if ((idx = char_symbol(word[i])) < 0) {
+			return 0;
+		}
+
+		node = snap_child(node, idx);
+	}
+
+	return node ? node[0] : 0;
+}
+
+typedef struct rframe {
+	const uint32_t *node;
+
+	/* The index and the position of the next child to visit */
+	int next, pos;
+} rframe_t;
+
+/*
+ * Visit every word in the snapshot in alphabetical order, the same as
+ * walk_node() on the tree saved
+ */
+errcode_t snapshot_walk(const snapshot_t *snap, visit_t visit, void *arg)
+{
+	rframe_t *frames, *f;
+	const uint32_t *bitmap;
+	char *path, *p;
+	uint32_t bits;
+	int depth = WORD_LEN_MAX, top = 0, idx;
+	errcode_t ret = ERR_SUCCESS;
+
+	frames = (rframe_t *)malloc(sizeof(rframe_t) * depth);
+	path = (char *)malloc(depth);
+
+	if (!frames || !path) {
+		ret = ERR_NO_MEM;
+		goto out;
+	}
+
+	frames[0].node = snap_root(snap);
+	frames[0].next = frames[0].pos = 0;
+
+	while (top >= 0) {
+		f = &frames[top];
+		bitmap = f->node + 1;
+
+		/* Find the next present child, if any */
+		for (idx = -1; f->next < AVAILABLE_CHARS; ) {
+			if ((bits = bitmap[f->next / 32] & (~0U << (f->next % 32)))) {
+				idx = (f->next & ~31) + __builtin_ctz(bits);
+				break;
+			}
+
+			f->next = (f->next | 31) + 1;
+		}
+
+		if (idx < 0 || idx >= AVAILABLE_CHARS) {
+			top--;
+			continue;
+		}
+
+		if (top + 1 == depth) {
+			if ((ret = grow((void **)&frames, &depth,
+							sizeof(rframe_t))) != ERR_SUCCESS) {
+				goto out;
+			}
+
+			if (!(p = (char *)realloc(path, depth))) {
+				ret = ERR_NO_MEM;
+				goto out;
+			}
+
+			path = p;
+		}
+
+		f = &frames[top];
+		f->next = idx + 1;
+		path[top] = INDEX_CHAR(idx);
+
+		frames[top + 1].node = f->node - f->node[1 + SNAP_BITMAP_WORDS +
+												 f->pos++];
+		frames[top + 1].next = frames[top + 1].pos = 0;
+		top++;
+
+		if (frames[top].node[0] &&
+			(ret = visit(arg, path, top, frames[top].node[0])) != 0) {
+			goto out;
+		}
+	}
+
+out:
+	free(frames);
+	free(path);
+
+	return ret;
+}
+
+/*
+ * Parse the output of a previous run, "word : cnt" on each line
+ */
+static errcode_t parse_counts(const char *data, const size_t size,
+							  visit_t visit, void *arg)
+{
+	const char *p = data, *end = data + size, *eol, *sep, *q;
+	long cnt;
+	errcode_t ret;
+
+	for (; p < end; p = eol + 1) {
+		if (!(eol = memchr(p, '\n', end - p))) {
+			eol = end;
+		}
+
+		/* A word never contains ':' which is a delimiter */
+		if (!(sep = memchr(p, ':', eol - p)) || sep - p < 2 ||
+			sep[-1] != ' ' || eol - sep < 3 || sep[1] != ' ') {
+			return ERR_BAD_FILE;
+		}
+
+		for (cnt = 0, q = sep + 2; q < eol && *q >= '0' && *q <= '9'; q++) {
+			cnt = cnt * 10 + *q - '0';
+
+			if (cnt > INT32_MAX) {
+				return ERR_BAD_FILE;
+			}
+		}
+
+		if (q == sep + 2 || q != eol) {
+			return ERR_BAD_FILE;
+		}
+
+		if ((ret = visit(arg, p, sep - 1 - p, cnt)) != ERR_SUCCESS) {
+			return ret;
+		}
+	}
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Feed every word and its occurence saved by a previous run to the given
+ * visitor, either from a snapshot, a frozen DAWG or the output of the run
+ */
+errcode_t load_counts(const char *path, visit_t visit, void *arg)
+{
+	snapshot_t snap;
+	dawg_t dawg;
+	struct stat statbuf;
+	char *data;
+	int fd;
+	errcode_t ret;
+
+	if (snapshot_open(&snap, path) == ERR_SUCCESS) {
+		ret = snapshot_walk(&snap, visit, arg);
+		snapshot_close(&snap);
+		return ret;
+	}
+
+	if (dawg_open(&dawg, path) == ERR_SUCCESS) {
+		ret = dawg_walk(&dawg, -1, visit, arg);
+		dawg_cleanup(&dawg);
+		return ret;
+	}
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return ERR_IO;
+	}
+
+	if (fstat(fd, &statbuf) < 0) {
+		close(fd);
+		return ERR_IO;
+	}
+
+	/* Nothing counted before */
+	if (statbuf.st_size == 0) {
+		close(fd);
+		return ERR_SUCCESS;
+	}
+
+	data = map_file(fd, statbuf.st_size);
+	close(fd);
+
+	if (!data) {
+		return ERR_IO;
+	}
+
+	ret = parse_counts(data, statbuf.st_size, visit, arg);
+	unmap_file(data, statbuf.st_size);
+
+	return ret;
+}
@@ -0,0 +1,61 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <stdint.h>
+#include "node.h"
+
+/*
+ * A snapshot is the tree saved in a file, which could be mapped and
+ * queried straight away without being loaded into nodes.
+ *
+ * Following the header, nodes are laid out in post-order so that all
+ * children of a node come before it, and the root is the last one.
+ * A node is a sequence of 32-bit words in the native byte order:
+ *
+ *	cnt					occurence of the word it represents
+ *	bitmap[]			SNAP_BITMAP_WORDS words, one bit for each child
+ *	rel[]				one for each present child, in the order of
+ *						their alphabets
+ *
+ * A child is rel[i] 32-bit words before its parent, so that the whole
+ * file could be mapped anywhere without fixing up any reference.
+ */
+#define SNAP_MAGIC			"WORDTRIE"
+#define SNAP_VERSION		1
+
+#define SNAP_BITMAP_WORDS	((AVAILABLE_CHARS + 31) / 32)
+
+typedef struct snap_header {
+	char magic[8];
+	uint32_t version;
+
+	/* The number of alphabets, which fixes the size of bitmap */
+	uint32_t chars;
+
+	/* The size of the whole file and the offset of the root */
+	uint64_t size;
+	uint64_t root;
+
+	/* The number of nodes, distinct words and all words */
+	uint64_t nodes;
+	uint64_t words;
+	uint64_t total;
+
+	uint64_t reserved;
+} snap_header_t;
+
+typedef struct snapshot {
+	const char *data;
+	size_t size;
+	const snap_header_t *hdr;
+} snapshot_t;
+
+errcode_t snapshot_save(const char *path,
+						node_t *const subtrees[AVAILABLE_CHARS]);
+errcode_t snapshot_open(snapshot_t *snap, const char *path);
+void snapshot_close(snapshot_t *snap);
+int snapshot_count(const snapshot_t *snap, const char *word, const int len);
+errcode_t snapshot_walk(const snapshot_t *snap, visit_t visit, void *arg);
+errcode_t load_counts(const char *path, visit_t visit, void *arg);
+
+#endif	/* _SNAPSHOT_H */
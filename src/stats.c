@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <string.h>
+#include "stats.h"
+#include "topk.h"
+
+static const char *phase_names[PHASE_NUM] = {
+	"load", "read", "tokenize", "insert", "count", "merge", "freeze",
+	"dump", "output", "save"
+};
+
+void stats_phases(const uint64_t phases[PHASE_NUM])
+{
+	int i;
+
+	for (i = 0; i < PHASE_NUM; i++) {
+		fprintf(stderr, "phase_%s_ms=%.3f\n", phase_names[i], phases[i] / 1e6);
+	}
+}
+
+/*
+ * Report the most frequent words in the given top K and the share of
+ * all occurences taken by the top 1, 10, 100 and 1000 of them
+ */
+static void stats_hot(topk_t *top, const size_t total)
+{
+	const entry_t *e;
+	size_t sum;
+	int i, n;
+
+	topk_sort(top);
+
+	for (i = 0; i < top->num && i < STATS_HOT_WORDS; i++) {
+		e = &top->entries[i];
+		fprintf(stderr, "hot_word.%d=%.*s:%d\n", i + 1, e->len, e->word,
+				e->cnt);
+	}
+
+	for (i = 0, n = 1, sum = 0; i < top->num; i++) {
+		sum += top->entries[i].cnt;
+
+		if (i + 1 == n) {
+			fprintf(stderr, "hot_share.%d=%.4f\n", n,
+					total ? (double)sum / total : 0.0);
+			n *= 10;
+		}
+	}
+}
+
+/*
+ * Report the depth histogram of the given trees, whose roots are at the
+ * given depth: either the root of a whole tree at 0, or the subtrees of
+ * every alphabet in their order at 1. And how the occurences are spread
+ * over distinct words
+ */
+errcode_t stats_tree(node_t *const nodes[], const int num, const int depth,
+					 tree_stats_t *stats)
+{
+	topk_t top;
+	errcode_t ret = ERR_SUCCESS;
+	int i;
+
+	memset(stats, 0, sizeof(tree_stats_t));
+
+	for (i = 0; i < num; i++) {
+		count_node(nodes[i], depth, stats);
+	}
+
+	for (i = 0; i <= TREE_DEPTH_MAX; i++) {
+		if (stats->depths[i] > 0) {
+			fprintf(stderr, "depth_nodes.%d=%zu\n", i, stats->depths[i]);
+		}
+	}
+
+	if ((ret = topk_init(&top, STATS_HOT_MAX)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	for (i = 0; i < num && ret == ERR_SUCCESS; i++) {
+		ret = walk_node(nodes[i], depth ? i : -1, topk_insert, &top);
+	}
+
+	if (ret == ERR_SUCCESS) {
+		stats_hot(&top, stats->total);
+	}
+
+	topk_cleanup(&top);
+
+	return ret;
+}
+
+/*
+ * Report the load of the given sorted tables and how far their words
+ * are from their home buckets, and the same as above how the occurences
+ * are spread over distinct words
+ */
+errcode_t stats_table(const table_t *const tables[], const int num,
+					  table_stats_t *stats)
+{
+	topk_t top;
+	errcode_t ret;
+	int i;
+
+	memset(stats, 0, sizeof(table_stats_t));
+
+	for (i = 0; i < num; i++) {
+		table_count(tables[i], stats);
+	}
+
+	fprintf(stderr, "table_buckets=%zu\ntable_load=%.3f\n"
+			"table_inline_words=%zu\ntable_probe_avg=%.2f\n"
+			"table_probe_max=%zu\n",
+			stats->buckets,
+			stats->buckets ? (double)stats->words / stats->buckets : 0.0,
+			stats->inline_words,
+			stats->words ? (double)stats->dist_sum / stats->words : 0.0,
+			stats->dist_max);
+
+	if ((ret = topk_init(&top, STATS_HOT_MAX)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	if ((ret = table_walk(tables, num, -1, topk_insert,
+						  &top)) == ERR_SUCCESS) {
+		stats_hot(&top, stats->total);
+	}
+
+	topk_cleanup(&top);
+
+	return ret;
+}
+
+/*
+ * Report the size of the given DAWG, and the same as above how the
+ * occurences are spread over distinct words
+ */
+errcode_t stats_dawg(const dawg_t *dawg)
+{
+	topk_t top;
+	errcode_t ret;
+
+	fprintf(stderr, "dawg_states=%zu\ndawg_edges=%zu\ndawg_bytes=%zu\n",
+			dawg->states_num, dawg->edges_num, dawg_bytes(dawg));
+
+	if ((ret = topk_init(&top, STATS_HOT_MAX)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	if ((ret = dawg_walk(dawg, -1, topk_insert, &top)) == ERR_SUCCESS) {
+		stats_hot(&top, dawg->total);
+	}
+
+	topk_cleanup(&top);
+
+	return ret;
+}
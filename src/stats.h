@@ -0,0 +1,46 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include "node.h"
+#include "table.h"
+#include "dawg.h"
+
+/*
+ * Helpers shared by the --stats report of analysis_s and analysis_m,
+ * which is printed on stderr as lines of key=value, with a suffix of
+ * .N for the Nth thread, letter, depth or rank
+ */
+
+/* The number of the most frequent words listed by name */
+#define STATS_HOT_WORDS		10
+
+/* The most frequent words whose share of all occurences is reported */
+#define STATS_HOT_MAX		1000
+
+/*
+ * Phases of a run. Reading, tokenizing and inserting are interleaved
+ * while counting, so each of them is summed up over all threads, in
+ * contrast to the others in wall time
+ */
+typedef enum {
+	PHASE_LOAD = 0,		/* Counts of a previous run loaded */
+	PHASE_READ,			/* Input files read in or mapped */
+	PHASE_TOKENIZE,		/* Words picked up */
+	PHASE_INSERT,		/* Words counted by the tree */
+	PHASE_COUNT,		/* All words counted, including the three above */
+	PHASE_MERGE,		/* Private trees merged */
+	PHASE_FREEZE,		/* Words frozen into a DAWG */
+	PHASE_DUMP,			/* Words formatted, or the top K picked up */
+	PHASE_OUTPUT,		/* Formatted words written out */
+	PHASE_SAVE,			/* Snapshot saved */
+	PHASE_NUM
+} phase_t;
+
+void stats_phases(const uint64_t phases[PHASE_NUM]);
+errcode_t stats_tree(node_t *const nodes[], const int num, const int depth,
+					 tree_stats_t *stats);
+errcode_t stats_table(const table_t *const tables[], const int num,
+					  table_stats_t *stats);
+errcode_t stats_dawg(const dawg_t *dawg);
+
+#endif	/* _STATS_H */
@@ -0,0 +1,290 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "stream.h"
+#include "ngram.h"
+
+/*
+ * Return 1 if the given file should be read as a stream, which is "-"
+ * for stdin, a FIFO, a character device or a socket, 0 if it is a
+ * regular file (whose stat is saved in statbuf), or -1 if it can't be
+ * analysed at all
+ */
+int stream_probe(const char *file, struct stat *statbuf)
+{
+	if (strcmp(file, "-") == 0) {
+		return 1;
+	}
+
+	if (lstat(file, statbuf) < 0) {
+		return -1;
+	}
+
+	if (S_ISFIFO(statbuf->st_mode) || S_ISCHR(statbuf->st_mode) ||
+		S_ISSOCK(statbuf->st_mode)) {
+		return 1;
+	}
+
+	if (S_ISREG(statbuf->st_mode) == 0 || statbuf->st_size == 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Read into buf until it is full or the end of the input is reached,
+ * return the number of bytes read or -1 on error
+ */
+static ssize_t fill(const int fd, char *buf, const size_t size)
+{
+	ssize_t ret;
+	size_t done;
+
+	/* A pipe returns no more than what is available at the moment */
+	for (done = 0; done < size; done += ret) {
+		if ((ret = read(fd, buf + done, size - done)) < 0) {
+			return -1;
+		} else if (ret == 0) {
+			break;
+		}
+	}
+
+	return done;
+}
+
+/*
+ * Fill the given buffer of size bytes with the fragment carried over
+ * from the previous buffer followed by what is read from fd, and cut it
+ * right after the last delimiter unless the end of input is reached.
+ * The length of complete words is returned in len, and the fragment
+ * cut off is carried over to the next call in frag and frag_len
+ *
+ * NOTE: the fragment stays in the previous buffer, which MUST NOT be
+ * refilled before this one
+ */
+errcode_t stream_read(const int fd, char *buf, const size_t size,
+					  const char **frag, size_t *frag_len, size_t *len,
+					  int *eof)
+{
+	ssize_t ret;
+	char *p;
+
+	memmove(buf, *frag, *frag_len);
+
+	if ((ret = fill(fd, buf + *frag_len, size - *frag_len)) < 0) {
+		return ERR_IO;
+	}
+
+	*len = *frag_len + ret;
+	*frag_len = 0;
+
+	if (*len < size) {
+		*eof = 1;
+		return ERR_SUCCESS;
+	}
+
+	/* Save the last word which may be cut across */
+	for (p = buf + *len - 1; p >= buf && is_delimiter(*p) == 0; p--);
+
+	if (p < buf) {
+		printf("The buffer size is too small to accommodate a long word\n");
+		return ERR_BAD_PARAM;
+	}
+
+	*frag = p + 1;
+	*frag_len = buf + *len - *frag;
+	*len -= *frag_len;
+
+	return ERR_SUCCESS;
+}
+
+static void *reader(void *arg)
+{
+	stream_t *stream = (stream_t *)arg;
+	stream_buf_t *buf;
+	const char *frag = NULL, *p;
+	size_t frag_len = 0, len, lead = 0;
+	int eof = 0;
+	errcode_t err = ERR_SUCCESS;
+
+	while (eof == 0) {
+		buf = &stream->bufs[stream->filled % stream->bufs_num];
+
+		pthread_mutex_lock(&stream->mutex);
+		while (buf->full == 1) {
+			pthread_cond_wait(&stream->cond, &stream->mutex);
+		}
+		pthread_mutex_unlock(&stream->mutex);
+
+		if ((err = stream_read(stream->fd, buf->data, stream->size, &frag,
+							   &frag_len, &len, &eof)) != ERR_SUCCESS) {
+			break;
+		}
+
+		buf->lead = lead;
+
+		/* The last words are carried over along with the fragment */
+		if (stream->overlap > 0 && eof == 0) {
+			p = ngram_lead(buf->data, frag, stream->overlap);
+			lead = frag - p;
+
+			if (frag_len + lead >= stream->size / 2) {
+				printf("The buffer size is too small to accommodate the "
+					   "words overlapped\n");
+				err = ERR_BAD_PARAM;
+				break;
+			}
+
+			frag = p;
+			frag_len += lead;
+		}
+
+		pthread_mutex_lock(&stream->mutex);
+		buf->len = len;
+		buf->full = 1;
+		stream->filled++;
+		pthread_cond_broadcast(&stream->cond);
+		pthread_mutex_unlock(&stream->mutex);
+	}
+
+	pthread_mutex_lock(&stream->mutex);
+	stream->eof = 1;
+	stream->err = err;
+	pthread_cond_broadcast(&stream->cond);
+	pthread_mutex_unlock(&stream->mutex);
+
+	return NULL;
+}
+
+/*
+ * Start reading from the given file descriptor into bufs_num buffers
+ * of size bytes each, at least 2 of them so that reading could go on
+ * while one is being analysed, each repeating the given number of words
+ * at the end of the previous one
+ */
+errcode_t stream_open(stream_t *stream, const int fd, const int bufs_num,
+					  const size_t size, const int overlap)
+{
+	int i;
+
+	memset(stream, 0, sizeof(stream_t));
+	stream->fd = fd;
+	stream->size = size;
+	stream->overlap = overlap;
+	stream->bufs_num = bufs_num < 2 ? 2 : bufs_num;
+
+	if (!(stream->bufs = (stream_buf_t *)calloc(stream->bufs_num,
+												sizeof(stream_buf_t)))) {
+		return ERR_NO_MEM;
+	}
+
+	for (i = 0; i < stream->bufs_num; i++) {
+		if (!(stream->bufs[i].data = (char *)malloc(size))) {
+			goto failed;
+		}
+	}
+
+	pthread_mutex_init(&stream->mutex, NULL);
+	pthread_cond_init(&stream->cond, NULL);
+
+	if (pthread_create(&stream->reader, NULL, reader, stream) != 0) {
+		pthread_cond_destroy(&stream->cond);
+		pthread_mutex_destroy(&stream->mutex);
+		goto failed;
+	}
+
+	return ERR_SUCCESS;
+
+failed:
+	for (i = 0; i < stream->bufs_num; i++) {
+		free(stream->bufs[i].data);
+	}
+
+	free(stream->bufs);
+	stream->bufs = NULL;
+
+	return ERR_NO_MEM;
+}
+
+/*
+ * Wait for the reader to stop and release all buffers, return the
+ * error encountered by the reader if any
+ *
+ * NOTE: all buffers taken MUST have been put back
+ */
+errcode_t stream_close(stream_t *stream)
+{
+	int i;
+
+	if (!stream->bufs) {
+		return ERR_SUCCESS;
+	}
+
+	/* Drain what is left so that the reader could come to the end */
+	while ((i = stream_get(stream, NULL, NULL, NULL)) >= 0) {
+		stream_put(stream, i);
+	}
+
+	pthread_join(stream->reader, NULL);
+	pthread_cond_destroy(&stream->cond);
+	pthread_mutex_destroy(&stream->mutex);
+
+	for (i = 0; i < stream->bufs_num; i++) {
+		free(stream->bufs[i].data);
+	}
+
+	free(stream->bufs);
+	stream->bufs = NULL;
+
+	return stream->err;
+}
+
+/*
+ * Take the next buffer filled by the reader and return its index, or
+ * -1 if the end of the input is reached or the reader has failed. The
+ * words repeated from the previous buffer, if any, are in [lead, data).
+ * It is safe to be called by multiple consumers at the same time
+ */
+int stream_get(stream_t *stream, const char **lead, const char **data,
+			   size_t *len)
+{
+	stream_buf_t *buf;
+	int idx = -1;
+
+	pthread_mutex_lock(&stream->mutex);
+
+	while (stream->taken == stream->filled && stream->eof == 0) {
+		pthread_cond_wait(&stream->cond, &stream->mutex);
+	}
+
+	if (stream->taken < stream->filled && stream->err == ERR_SUCCESS) {
+		idx = stream->taken++ % stream->bufs_num;
+		buf = &stream->bufs[idx];
+
+		if (data) {
+			*data = buf->data + buf->lead;
+			*len = buf->len - buf->lead;
+		}
+
+		if (lead) {
+			*lead = buf->data;
+		}
+	}
+
+	pthread_mutex_unlock(&stream->mutex);
+
+	return idx;
+}
+
+/*
+ * Give the buffer of the given index back to the reader
+ */
+void stream_put(stream_t *stream, const int idx)
+{
+	pthread_mutex_lock(&stream->mutex);
+	stream->bufs[idx].full = 0;
+	pthread_cond_broadcast(&stream->cond);
+	pthread_mutex_unlock(&stream->mutex);
+}
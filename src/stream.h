@@ -0,0 +1,75 @@
+#ifndef _STREAM_H
+#define _STREAM_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "lib.h"
+
+/*
+ * Read an input of unknown length, such as a pipe or stdin, through a
+ * fixed number of buffers, so that memory use stays flat however long
+ * the input is. A reader thread fills the buffers in turn while the
+ * consumers are analysing the ones filled before.
+ *
+ * Every buffer handed over ends at a delimiter (unless it is the last
+ * one), the fragment of a word cut across by the end of a buffer is
+ * carried over to the start of the next one. So are the given number of
+ * words before it, if buffers are to overlap, so that n-grams ending in
+ * the first words of a buffer could be made up from the buffer alone.
+ */
+
+/* The default size of each buffer, which MUST hold the longest word */
+#define STREAM_BUF_SIZE		(1 << 20)
+
+typedef struct stream_buf {
+	char *data;
+
+	/* The number of bytes of complete words at the start of data */
+	size_t len;
+
+	/* The number of bytes among them repeated from the previous buffer */
+	size_t lead;
+
+	/* Whether the buffer is filled and not consumed yet */
+	int full;
+} stream_buf_t;
+
+typedef struct stream {
+	int fd;
+
+	/* The buffers, each of size bytes, filled and consumed in turn */
+	stream_buf_t *bufs;
+	int bufs_num;
+	size_t size;
+
+	/* The number of words each buffer repeats from the previous one */
+	int overlap;
+
+	/*
+	 * The number of buffers filled by the reader so far and the number
+	 * of those taken by consumers
+	 */
+	long filled, taken;
+
+	/* Set by the reader when it stops, with an error code if any */
+	int eof;
+	errcode_t err;
+
+	pthread_t reader;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} stream_t;
+
+int stream_probe(const char *file, struct stat *statbuf);
+errcode_t stream_read(const int fd, char *buf, const size_t size,
+					  const char **frag, size_t *frag_len, size_t *len,
+					  int *eof);
+errcode_t stream_open(stream_t *stream, const int fd, const int bufs_num,
+					  const size_t size, const int overlap);
+errcode_t stream_close(stream_t *stream);
+int stream_get(stream_t *stream, const char **lead, const char **data,
+			   size_t *len);
+void stream_put(stream_t *stream, const int idx);
+
+#endif	/* _STREAM_H */
@@ -0,0 +1,486 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "table.h"
+
+/* Grow once more than 7/8 of the buckets are taken */
+#define TABLE_LOAD_NUM		7
+#define TABLE_LOAD_DEN		8
+
+/* The longest word that could be kept in one slab of the arena */
+#define TABLE_WORD_MAX		(ARENA_SLAB_SIZE - sizeof(slab_t))
+
+static const char *engine_names[ENGINE_NUM] = {
+	"trie", "hash"
+};
+
+/*
+ * Return the engine of the given name, or ENGINE_NUM if there is none
+ */
+engine_t table_engine(const char *name)
+{
+	engine_t engine;
+
+	for (engine = 0; engine < ENGINE_NUM; engine++) {
+		if (strcmp(name, engine_names[engine]) == 0) {
+			break;
+		}
+	}
+
+	return engine;
+}
+
+/*
+ * Mix in 8 bytes at a time rather than byte by byte as FNV-1a does,
+ * since n-grams and IDs are much longer than words. The hash is never
+ * 0, which marks an empty bucket
+ */
+static inline uint32_t hash(const char *word, int len)
+{
+	uint64_t h = len * 0x9e3779b97f4a7c15ULL, w;
+
+	for (; len >= 8; word += 8, len -= 8) {
+		memcpy(&w, word, 8);
+		h = (h ^ w) * 0xbf58476d1ce4e5b9ULL;
+		h ^= h >> 31;
+	}
+
+	if (len > 0) {
+		w = 0;
+		memcpy(&w, word, len);
+		h = (h ^ w) * 0xbf58476d1ce4e5b9ULL;
+	}
+
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+
+	return (uint32_t)h ? (uint32_t)h : 1;
+}
+
+static inline const char *bucket_word(const bucket_t *bucket)
+{
+	const char *p;
+
+	if (bucket->len <= TABLE_INLINE_MAX) {
+		return bucket->word;
+	}
+
+	memcpy(&p, bucket->word, sizeof(p));
+
+	return p;
+}
+
+/* The distance of the bucket at pos from its home */
+static inline uint32_t distance(const table_t *table, const uint32_t pos,
+								const uint32_t h)
+{
+	return (pos - h) & table->mask;
+}
+
+void table_init(table_t *table)
+{
+	memset(table, 0, sizeof(table_t));
+	arena_init(&table->arena);
+}
+
+void table_cleanup(table_t *table)
+{
+	free(table->buckets);
+	free(table->key);
+	free(table->items);
+	arena_release(&table->arena);
+	table_init(table);
+}
+
+/*
+ * Forget all words counted so far but keep the buckets and the slabs
+ * of the arena for reuse
+ */
+void table_reset(table_t *table)
+{
+	if (table->buckets) {
+		memset(table->buckets, 0, sizeof(bucket_t) * (table->mask + 1));
+	}
+
+	free(table->items);
+	table->items = NULL;
+	table->num = 0;
+
+	arena_reset(&table->arena);
+}
+
+/*
+ * Put the given bucket at pos or after it, moving on any bucket closer
+ * to its home than the given one would be
+ */
+static void place(table_t *table, uint32_t pos, bucket_t *bucket)
+{
+	bucket_t *slot, tmp;
+	uint32_t dist, d;
+
+	dist = distance(table, pos, bucket->hash);
+
+	for (;; pos = (pos + 1) & table->mask, dist++) {
+		slot = &table->buckets[pos];
+
+		if (slot->hash == 0) {
+			*slot = *bucket;
+			return;
+		}
+
+		if ((d = distance(table, pos, slot->hash)) < dist) {
+			tmp = *slot;
+			*slot = *bucket;
+			*bucket = tmp;
+			dist = d;
+		}
+	}
+}
+
+/*
+ * Double the buckets, or set up the first ones, and put every word in
+ * its new place
+ */
+static errcode_t grow(table_t *table)
+{
+	bucket_t *old = table->buckets, *bucket;
+	uint32_t size = old ? (table->mask + 1) * 2 : TABLE_SIZE_MIN;
+	uint32_t i, old_mask = table->mask;
+
+	if (old && old_mask + 1 > UINT32_MAX / 2) {
+		return ERR_NO_MEM;
+	}
+
+	if (!(table->buckets = (bucket_t *)calloc(size, sizeof(bucket_t)))) {
+		table->buckets = old;
+		return ERR_NO_MEM;
+	}
+
+	table->mask = size - 1;
+
+	if (old) {
+		for (i = 0; i <= old_mask; i++) {
+			bucket = &old[i];
+
+			if (bucket->hash) {
+				place(table, bucket->hash & table->mask, bucket);
+			}
+		}
+
+		free(old);
+		table->grows++;
+	}
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Fold the given word into the key buffer the same as the tree does,
+ * return -1 if it has any byte never found in the tree
+ */
+static int fold(table_t *table, const char *word, const int len)
+{
+	char *key;
+	int i, idx;
+
+	if (len > table->key_size) {
+		if (!(key = (char *)realloc(table->key, len * 2))) {
+			return ERR_NO_MEM;
+		}
+
+		table->key = key;
+		table->key_size = len * 2;
+	}
+
+	for (i = 0; i < len; i++) {
+		if ((idx = char_symbol(word[i])) < 0) {
+			return -1;
+		}
+
+		table->key[i] = INDEX_CHAR(idx);
+	}
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Count cnt occurences of the given word of len bytes, which is not
+ * necessarily NULL-terminated. The same as the tree, words with any
+ * illegal byte are skipped
+ */
+errcode_t table_insert_cnt(table_t *table, const char *word, const int len,
+						   const int cnt)
+{
+	bucket_t *slot, bucket;
+	uint32_t h, pos, dist;
+	char *p;
+	int ret;
+
+	assert(table && word && len > 0);
+
+	if ((ret = fold(table, word, len)) != ERR_SUCCESS) {
+		return ret < 0 ? ERR_SUCCESS : ret;
+	}
+
+	if (!table->buckets && (ret = grow(table)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	h = hash(table->key, len);
+
+	for (pos = h & table->mask, dist = 0;; pos = (pos + 1) & table->mask,
+		 dist++) {
+		slot = &table->buckets[pos];
+
+		/* An empty bucket, or one richer than the word would be */
+		if (slot->hash == 0 || distance(table, pos, slot->hash) < dist) {
+			break;
+		}
+
+		if (slot->hash == h && slot->len == len &&
+			memcmp(bucket_word(slot), table->key, len) == 0) {
+			slot->cnt += cnt;
+			return ERR_SUCCESS;
+		}
+	}
+
+	memset(&bucket, 0, sizeof(bucket_t));
+	bucket.hash = h;
+	bucket.cnt = cnt;
+	bucket.len = len;
+
+	if (len <= TABLE_INLINE_MAX) {
+		memcpy(bucket.word, table->key, len);
+	} else if (len > TABLE_WORD_MAX) {
+		printf("A word of %d bytes is too long for the hash table\n", len);
+		return ERR_BAD_PARAM;
+	} else {
+		if (!(p = (char *)arena_alloc(&table->arena, len))) {
+			return ERR_NO_MEM;
+		}
+
+		memcpy(p, table->key, len);
+		memcpy(bucket.word, &p, sizeof(p));
+	}
+
+	/* Any room made by growing is somewhere else */
+	if ((table->num + 1) * TABLE_LOAD_DEN >
+		(size_t)(table->mask + 1) * TABLE_LOAD_NUM) {
+		if ((ret = grow(table)) != ERR_SUCCESS) {
+			return ret;
+		}
+
+		pos = h & table->mask;
+	}
+
+	place(table, pos, &bucket);
+	table->num++;
+
+	return ERR_SUCCESS;
+}
+
+errcode_t table_insert(table_t *table, const char *word, const int len)
+{
+	return table_insert_cnt(table, word, len, 1);
+}
+
+/*
+ * Compare two words in the order of the tree, in which a word comes
+ * before those it is a prefix of. No byte of a word is 0, so the same
+ * prefix means the same word if it is no longer than 8 bytes
+ */
+static int compare_items(const void *a, const void *b)
+{
+	const item_t *x = (const item_t *)a, *y = (const item_t *)b;
+	int ret;
+
+	if (x->prefix != y->prefix) {
+		return x->prefix < y->prefix ? -1 : 1;
+	}
+
+	if (x->len > 8 && y->len > 8 &&
+		(ret = memcmp(x->word + 8, y->word + 8,
+					  (x->len < y->len ? x->len : y->len) - 8)) != 0) {
+		return ret;
+	}
+
+	return (x->len > y->len) - (x->len < y->len);
+}
+
+/*
+ * Sort all words of the given table into the order of the tree, which
+ * leaves the table read only until it is reset, since the sorted view
+ * points to the words in their buckets
+ */
+errcode_t table_sort(table_t *table)
+{
+	const bucket_t *bucket;
+	unsigned char bytes[8];
+	item_t *item;
+	uint32_t i;
+	size_t n;
+	int idx, j;
+
+	free(table->items);
+
+	/* Left with no word to walk through if it fails */
+	if (!(table->items = (item_t *)malloc(sizeof(item_t) *
+										  (table->num + 1)))) {
+		memset(table->firsts, 0, sizeof(table->firsts));
+		return ERR_NO_MEM;
+	}
+
+	for (i = 0, item = table->items; table->buckets && i <= table->mask;
+		 i++) {
+		bucket = &table->buckets[i];
+
+		if (bucket->hash == 0) {
+			continue;
+		}
+
+		item->word = bucket_word(bucket);
+		item->len = bucket->len;
+		item->cnt = bucket->cnt;
+
+		memset(bytes, 0, sizeof(bytes));
+		memcpy(bytes, item->word, item->len < 8 ? item->len : 8);
+
+		for (j = 0, item->prefix = 0; j < 8; j++) {
+			item->prefix = (item->prefix << 8) | bytes[j];
+		}
+
+		item++;
+	}
+
+	qsort(table->items, table->num, sizeof(item_t), compare_items);
+
+	/* Words starting with the same symbol are next to each other */
+	for (idx = 0, n = 0; idx < AVAILABLE_CHARS; idx++) {
+		while (n < table->num &&
+			   char_symbol(table->items[n].word[0]) < idx) {
+			n++;
+		}
+
+		table->firsts[idx] = n;
+	}
+
+	table->firsts[AVAILABLE_CHARS] = table->num;
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Visit every word starting with the symbol idx, or every word if idx
+ * is -1, in the given sorted tables in the order of the tree, with the
+ * occurences of the same word in different tables added up, stopping
+ * at the first error of the visitor
+ */
+errcode_t table_walk(const table_t *const tables[], const int num,
+					 const int idx, visit_t visit, void *arg)
+{
+	const item_t *cur[num], *end[num], *min;
+	int i, cnt, ret;
+
+	for (i = 0; i < num; i++) {
+		cur[i] = tables[i]->items + tables[i]->firsts[idx < 0 ? 0 : idx];
+		end[i] = tables[i]->items +
+				 tables[i]->firsts[idx < 0 ? AVAILABLE_CHARS : idx + 1];
+	}
+
+	for (;;) {
+		for (i = 0, min = NULL; i < num; i++) {
+			if (cur[i] < end[i] &&
+				(!min || compare_items(cur[i], min) < 0)) {
+				min = cur[i];
+			}
+		}
+
+		if (!min) {
+			break;
+		}
+
+		/* Take the word off the head of every table it is found in */
+		for (i = 0, cnt = 0; i < num; i++) {
+			if (cur[i] < end[i] &&
+				(cur[i] == min || compare_items(cur[i], min) == 0)) {
+				cnt += cur[i]++->cnt;
+			}
+		}
+
+		if ((ret = visit(arg, min->word, min->len, cnt)) != 0) {
+			return ret;
+		}
+	}
+
+	return ERR_SUCCESS;
+}
+
+static errcode_t visit_out(void *arg, const char *word, const int len,
+						   const int cnt)
+{
+	return out_word((out_t *)arg, word, len, cnt);
+}
+
+errcode_t table_output(out_t *out, const table_t *const tables[],
+					   const int num, const int idx)
+{
+	return table_walk(tables, num, idx, visit_out, out);
+}
+
+/*
+ * Output every word of the given table on stdout, in the order of the
+ * tree
+ */
+void table_dump(table_t *table)
+{
+	const table_t *tables[1] = { table };
+	char buf[OUTPUT_BUF_SIZE];
+	out_t out;
+
+	/* Anything printed before MUST go out first */
+	fflush(stdout);
+
+	out_init(&out, STDOUT_FILENO, buf, sizeof(buf));
+
+	if (table_sort(table) != ERR_SUCCESS ||
+		table_output(&out, tables, 1, -1) != ERR_SUCCESS ||
+		out_flush(&out) != ERR_SUCCESS) {
+		printf("Failed to output the table\n");
+	}
+}
+
+/*
+ * Accumulate the shape of the given table
+ */
+void table_count(const table_t *table, table_stats_t *stats)
+{
+	const bucket_t *bucket;
+	uint32_t i, dist;
+
+	stats->buckets += table->buckets ? table->mask + 1 : 0;
+	stats->allocated += table->arena.allocated +
+						(table->buckets ? sizeof(bucket_t) *
+						 (table->mask + 1) : 0);
+	stats->used += table->arena.used + sizeof(bucket_t) * table->num;
+
+	for (i = 0; table->buckets && i <= table->mask; i++) {
+		bucket = &table->buckets[i];
+
+		if (bucket->hash == 0) {
+			continue;
+		}
+
+		stats->words++;
+		stats->total += bucket->cnt;
+		stats->inline_words += (bucket->len <= TABLE_INLINE_MAX);
+
+		dist = distance(table, i, bucket->hash);
+		stats->dist_sum += dist;
+
+		if (dist > stats->dist_max) {
+			stats->dist_max = dist;
+		}
+	}
+}
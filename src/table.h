@@ -0,0 +1,126 @@
+#ifndef _TABLE_H
+#define _TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lib.h"
+#include "arena.h"
+#include "node.h"
+
+/*
+ * An open-addressing hash table counting words, as an alternative to
+ * the tree which takes one node for every distinct prefix, so that on
+ * input of many long distinct words such as IDs or n-grams each word
+ * only takes one bucket and its bytes.
+ *
+ * Collisions are resolved by Robin Hood hashing on linear probing: a
+ * word being inserted takes the bucket of any word closer to its home
+ * bucket than the new one is, which then moves on. So the distance of
+ * every word from its home stays short and even, and a lookup stops as
+ * soon as it meets a word closer to its home than it would be.
+ *
+ * Words are folded the same as by the tree before they are hashed, so
+ * that the same words are counted as one, and output the same.
+ *
+ * A table is not thread safe, each thread should have its own one and
+ * the tables of all threads are only brought together by their sorted
+ * views once all words are counted.
+ */
+
+/* Words no longer than this are kept in their buckets, to make one 32 bytes */
+#define TABLE_INLINE_MAX	20
+
+/* The number of buckets to start with */
+#define TABLE_SIZE_MIN		1024
+
+typedef struct bucket {
+	/* The hash of the word, 0 if the bucket is empty */
+	uint32_t hash;
+
+	/* Occurence of the word */
+	int cnt;
+
+	uint32_t len;
+
+	/*
+	 * The word itself, or if longer the pointer to it in the arena,
+	 * copied in and out as it is not aligned. Not a 32-bit reference, so
+	 * that slabs of tables need not take up the pool of all slabs
+	 */
+	char word[TABLE_INLINE_MAX];
+} bucket_t;
+
+/*
+ * A word in the sorted view of a table, whose first 8 bytes are kept
+ * in the big endian order so that most comparisons are made without
+ * reaching the word itself
+ */
+typedef struct item {
+	uint64_t prefix;
+	const char *word;
+	int len, cnt;
+} item_t;
+
+typedef struct table {
+	/* The array of buckets, whose size is a power of 2 */
+	bucket_t *buckets;
+	uint32_t mask;
+
+	/* The number of distinct words */
+	size_t num;
+
+	/* The arena to keep words too long to fit in their buckets */
+	arena_t arena;
+
+	/* The word being counted, folded the same as by the tree */
+	char *key;
+	int key_size;
+
+	/*
+	 * All words in the order of the tree once sorted, and where those
+	 * starting with each symbol begin, the last one being the end
+	 */
+	item_t *items;
+	size_t firsts[AVAILABLE_CHARS + 1];
+
+	/* The number of times the buckets are doubled */
+	int grows;
+} table_t;
+
+/*
+ * The shape of a table: the number of buckets, of words, of their
+ * occurences and of those kept in their buckets, and the distance of
+ * words from their home buckets
+ */
+typedef struct table_stats {
+	size_t buckets, words, total, inline_words;
+	size_t dist_sum, dist_max;
+	size_t allocated, used;
+} table_stats_t;
+
+/*
+ * The counting engines to pick from by --engine
+ */
+typedef enum {
+	ENGINE_TRIE = 0,
+	ENGINE_HASH,
+	ENGINE_NUM
+} engine_t;
+
+engine_t table_engine(const char *name);
+
+void table_init(table_t *table);
+void table_cleanup(table_t *table);
+void table_reset(table_t *table);
+errcode_t table_insert(table_t *table, const char *word, const int len);
+errcode_t table_insert_cnt(table_t *table, const char *word, const int len,
+						   const int cnt);
+errcode_t table_sort(table_t *table);
+errcode_t table_walk(const table_t *const tables[], const int num,
+					 const int idx, visit_t visit, void *arg);
+errcode_t table_output(out_t *out, const table_t *const tables[],
+					   const int num, const int idx);
+void table_dump(table_t *table);
+void table_count(const table_t *table, table_stats_t *stats);
+
+#endif	/* _TABLE_H */
@@ -0,0 +1,229 @@
+/*
+ * Split a range of input into words in one pass, which are handed out
+ * in batches of (pointer, length) pairs, and the input is never written
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "lib.h"
+#include "token.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
+
+const char *tokenizer_names[TOKENIZER_NUM] = {
+	"scalar", "sse2", "avx2"
+};
+
+/* The implementation picked up for the current CPU */
+static tokenizer_t tokenizer = TOKENIZER_SCALAR;
+
+/*
+ * A tokenizer stops either when the batch is full or when the end of
+ * the range is reached, and in the former case it stops right after a
+ * word so that the next call could start from a clean state
+ */
+#define EMIT(start, stop)							\
+	do {											\
+		tokens[n].word = (const char *)(start);		\
+		tokens[n].len = (stop) - (start);			\
+		if (++n == max) {							\
+			*pos = (const char *)(stop);			\
+			return n;								\
+		}											\
+	} while (0)
+
+/*
+ * Look after the bytes in [p, end) one by one, with the given word
+ * carried over from the previous block if it is not NULL
+ */
+static int tokenize_tail(const unsigned char *p, const unsigned char *end,
+						 const unsigned char *word, const char **pos,
+						 token_t *tokens, int n, const int max)
+{
+	for (; p < end; p++) {
+		if (char_class[*p] == CHAR_DELIMITER) {
+			if (word) {
+				EMIT(word, p);
+				word = NULL;
+			}
+		} else if (!word) {
+			word = p;
+		}
+	}
+
+	if (word) {
+		EMIT(word, end);
+	}
+
+	*pos = (const char *)end;
+	return n;
+}
+
+static int tokenize_scalar(const char **pos, const char *end,
+						   token_t *tokens, const int max)
+{
+	return tokenize_tail((const unsigned char *)*pos,
+						 (const unsigned char *)end, NULL, pos, tokens, 0, max);
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * Given the mask of delimiters in a block of width bytes starting from
+ * base, emit all words ending inside the block and return where the
+ * word still going on at the end of the block starts, or NULL
+ */
+#define SCAN_BLOCK(delims, width)									\
+	do {															\
+		uint64_t d = (delims), w, prev, starts, events;				\
+		int i;														\
+																	\
+		w = ~d & (((uint64_t)1 << (width)) - 1);					\
+		prev = (w << 1) | (word ? 1 : 0);							\
+		starts = w & ~prev;											\
+		events = starts | (d & prev);								\
+																	\
+		while (events) {											\
+			i = __builtin_ctzll(events);							\
+			events &= events - 1;									\
+																	\
+			if (starts & ((uint64_t)1 << i)) {						\
+				word = p + i;										\
+			} else {												\
+				EMIT(word, p + i);									\
+				word = NULL;										\
+			}														\
+		}															\
+	} while (0)
+
+static __m128i sse2_delimiters[16];
+
+static int tokenize_sse2(const char **pos, const char *end,
+						 token_t *tokens, const int max)
+{
+	const unsigned char *p = (const unsigned char *)*pos;
+	const unsigned char *e = (const unsigned char *)end;
+	const unsigned char *word = NULL;
+	__m128i block, hits;
+	int n = 0, i;
+
+	for (; e - p >= 16; p += 16) {
+		block = _mm_loadu_si128((const __m128i *)p);
+		hits = _mm_cmpeq_epi8(block, sse2_delimiters[0]);
+
+		for (i = 1; i < DELIMITER_NUM; i++) {
+			hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, sse2_delimiters[i]));
+		}
+
+		SCAN_BLOCK((uint32_t)_mm_movemask_epi8(hits), 16);
+	}
+
+	return tokenize_tail(p, e, word, pos, tokens, n, max);
+}
+
+/*
+ * Every delimiter is below 0x40, so its high nibble is one of 0 to 3.
+ * A byte is a delimiter if the bit for its high nibble is set in the
+ * entry for its low nibble
+ */
+static unsigned char nibble_lo[16], nibble_hi[16];
+
+__attribute__((target("avx2")))
+static int tokenize_avx2(const char **pos, const char *end,
+						 token_t *tokens, const int max)
+{
+	const unsigned char *p = (const unsigned char *)*pos;
+	const unsigned char *e = (const unsigned char *)end;
+	const unsigned char *word = NULL;
+	__m256i lo_table, hi_table, low_mask, block, lo, hi, hits;
+	int n = 0;
+
+	lo_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)nibble_lo));
+	hi_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)nibble_hi));
+	low_mask = _mm256_set1_epi8(0x0f);
+
+	for (; e - p >= 32; p += 32) {
+		block = _mm256_loadu_si256((const __m256i *)p);
+		lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(block, low_mask));
+		hi = _mm256_shuffle_epi8(hi_table, _mm256_and_si256(
+										_mm256_srli_epi16(block, 4), low_mask));
+		hits = _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi),
+								 _mm256_setzero_si256());
+
+		SCAN_BLOCK(~(uint32_t)_mm256_movemask_epi8(hits), 32);
+	}
+
+	return tokenize_tail(p, e, word, pos, tokens, n, max);
+}
+#endif
+
+/*
+ * Set up the SIMD lookup tables from DELIMITER and pick up the fastest
+ * implementation supported by the current CPU before main() starts
+ */
+__attribute__((constructor))
+static void tokenizer_init(void)
+{
+#ifdef HAVE_X86_SIMD
+	unsigned char c;
+	int i, nibbles = 1;
+
+	if (DELIMITER_NUM > 16) {
+		return;
+	}
+
+	for (i = 0; i < DELIMITER_NUM; i++) {
+		c = DELIMITER[i];
+		sse2_delimiters[i] = _mm_set1_epi8(c);
+
+		if (c >= 0x40) {
+			nibbles = 0;
+		} else {
+			nibble_lo[c & 0x0f] |= 1 << (c >> 4);
+		}
+	}
+
+	for (i = 0; i < 4; i++) {
+		nibble_hi[i] = 1 << i;
+	}
+
+	tokenizer = TOKENIZER_SSE2;
+
+	__builtin_cpu_init();
+	if (nibbles == 1 && __builtin_cpu_supports("avx2")) {
+		tokenizer = TOKENIZER_AVX2;
+	}
+#endif
+}
+
+tokenizer_t tokenizer_best(void)
+{
+	return tokenizer;
+}
+
+/*
+ * Fill in at most max tokens found in the range of [*pos, end) with
+ * the given implementation, and move *pos past the last of them.
+ * Return the number of tokens, 0 if the whole range is consumed
+ */
+int tokenize_with(const tokenizer_t impl, const char **pos, const char *end,
+				  token_t *tokens, const int max)
+{
+	switch (impl) {
+#ifdef HAVE_X86_SIMD
+	case TOKENIZER_AVX2:
+		return tokenize_avx2(pos, end, tokens, max);
+	case TOKENIZER_SSE2:
+		return tokenize_sse2(pos, end, tokens, max);
+#endif
+	default:
+		return tokenize_scalar(pos, end, tokens, max);
+	}
+}
+
+int tokenize(const char **pos, const char *end, token_t *tokens, const int max)
+{
+	return tokenize_with(tokenizer, pos, end, tokens, max);
+}
@@ -0,0 +1,33 @@
+#ifndef _TOKEN_H
+#define _TOKEN_H
+
+/*
+ * A word picked up from the input, which is NOT NULL-terminated
+ */
+typedef struct token {
+	const char *word;
+	int len;
+} token_t;
+
+/* The number of tokens that fit in a cache-friendly batch */
+#define TOKENS_BATCH		256
+
+/*
+ * Implementations of the tokenizer, the ones with SIMD instructions
+ * find word boundaries in a block of 16 or 32 bytes at a time
+ */
+typedef enum {
+	TOKENIZER_SCALAR = 0,
+	TOKENIZER_SSE2,
+	TOKENIZER_AVX2,
+	TOKENIZER_NUM
+} tokenizer_t;
+
+extern const char *tokenizer_names[TOKENIZER_NUM];
+
+int tokenize(const char **pos, const char *end, token_t *tokens, const int max);
+int tokenize_with(const tokenizer_t impl, const char **pos, const char *end,
+				  token_t *tokens, const int max);
+tokenizer_t tokenizer_best(void);
+
+#endif	/* _TOKEN_H */
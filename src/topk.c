@@ -0,0 +1,248 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "topk.h"
+
+errcode_t topk_init(topk_t *top, const int k)
+{
+	top->k = k;
+	top->num = 0;
+
+	if (!(top->entries = (entry_t *)calloc(k, sizeof(entry_t)))) {
+		return ERR_NO_MEM;
+	}
+
+	return ERR_SUCCESS;
+}
+
+void topk_cleanup(topk_t *top)
+{
+	int i;
+
+	if (!top->entries) {
+		return;
+	}
+
+	for (i = 0; i < top->k; i++) {
+		free(top->entries[i].word);
+	}
+
+	free(top->entries);
+	top->entries = NULL;
+}
+
+/*
+ * Forget all words seen so far but keep their buffers for reuse
+ */
+void topk_reset(topk_t *top)
+{
+	top->num = 0;
+}
+
+/*
+ * Return non-zero if the given word ranks lower than the entry
+ */
+static inline int lower(const int cnt, const char *word, const int len,
+						const entry_t *e)
+{
+	int ret;
+
+	if (cnt != e->cnt) {
+		return cnt < e->cnt;
+	}
+
+	ret = memcmp(word, e->word, len < e->len ? len : e->len);
+
+	return ret > 0 || (ret == 0 && len > e->len);
+}
+
+static inline void swap(entry_t *a, entry_t *b)
+{
+	entry_t tmp = *a;
+
+	*a = *b;
+	*b = tmp;
+}
+
+static void sift_up(topk_t *top, int i)
+{
+	entry_t *e = top->entries;
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+
+		if (!lower(e[i].cnt, e[i].word, e[i].len, &e[parent])) {
+			break;
+		}
+
+		swap(&e[i], &e[parent]);
+		i = parent;
+	}
+}
+
+static void sift_down(topk_t *top, int i, const int num)
+{
+	entry_t *e = top->entries;
+	int child, least;
+
+	while ((child = 2 * i + 1) < num) {
+		least = i;
+
+		if (lower(e[child].cnt, e[child].word, e[child].len, &e[least])) {
+			least = child;
+		}
+
+		if (child + 1 < num &&
+			lower(e[child + 1].cnt, e[child + 1].word, e[child + 1].len,
+				  &e[least])) {
+			least = child + 1;
+		}
+
+		if (least == i) {
+			break;
+		}
+
+		swap(&e[i], &e[least]);
+		i = least;
+	}
+}
+
+/*
+ * Save a copy of the given word in the entry, whose room for words is
+ * reused whenever it is large enough
+ */
+static errcode_t set_entry(entry_t *e, const char *word, const int len,
+						   const int cnt)
+{
+	char *p;
+
+	if (len > e->size) {
+		if (!(p = (char *)realloc(e->word, len))) {
+			return ERR_NO_MEM;
+		}
+
+		e->word = p;
+		e->size = len;
+	}
+
+	memcpy(e->word, word, len);
+	e->len = len;
+	e->cnt = cnt;
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Offer the given word to the top K, which is compatible with visit_t
+ */
+errcode_t topk_insert(void *arg, const char *word, const int len,
+					  const int cnt)
+{
+	topk_t *top = (topk_t *)arg;
+	errcode_t ret;
+
+	if (top->num < top->k) {
+		if ((ret = set_entry(&top->entries[top->num], word, len,
+							 cnt)) != ERR_SUCCESS) {
+			return ret;
+		}
+
+		sift_up(top, top->num++);
+		return ERR_SUCCESS;
+	}
+
+	/* Most words are turned away by the first comparison */
+	if (top->k == 0 || cnt < top->entries[0].cnt ||
+		lower(cnt, word, len, &top->entries[0])) {
+		return ERR_SUCCESS;
+	}
+
+	if ((ret = set_entry(&top->entries[0], word, len, cnt)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	sift_down(top, 0, top->num);
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Offer every word in src to dst
+ */
+errcode_t topk_merge(topk_t *dst, const topk_t *src)
+{
+	const entry_t *e;
+	errcode_t ret;
+	int i;
+
+	for (i = 0; i < src->num; i++) {
+		e = &src->entries[i];
+
+		if ((ret = topk_insert(dst, e->word, e->len, e->cnt)) != ERR_SUCCESS) {
+			return ret;
+		}
+	}
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Sort the top K words from the most frequent one downwards. The heap
+ * is sorted in place and so can't be used any more afterwards
+ */
+void topk_sort(topk_t *top)
+{
+	int i;
+
+	/* Move the least frequent one to the end each time */
+	for (i = top->num - 1; i > 0; i--) {
+		swap(&top->entries[0], &top->entries[i]);
+		sift_down(top, 0, i);
+	}
+}
+
+/*
+ * Output the top K words from the most frequent one downwards, the same
+ * as topk_sort() the heap can't be used any more afterwards
+ */
+errcode_t topk_output(topk_t *top, out_t *out)
+{
+	const entry_t *e;
+	errcode_t ret;
+	int i;
+
+	topk_sort(top);
+
+	for (i = 0; i < top->num; i++) {
+		e = &top->entries[i];
+
+		if ((ret = out_word(out, e->word, e->len, e->cnt)) != ERR_SUCCESS) {
+			return ret;
+		}
+	}
+
+	return ERR_SUCCESS;
+}
+
+/*
+ * Output the top K words on stdout
+ */
+errcode_t topk_dump(topk_t *top)
+{
+	char buf[OUTPUT_BUF_SIZE];
+	out_t out;
+	errcode_t ret;
+
+	/* Anything printed before MUST go out first */
+	fflush(stdout);
+
+	out_init(&out, STDOUT_FILENO, buf, sizeof(buf));
+
+	if ((ret = topk_output(top, &out)) != ERR_SUCCESS) {
+		return ret;
+	}
+
+	return out_flush(&out);
+}
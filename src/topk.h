@@ -0,0 +1,36 @@
+#ifndef _TOPK_H
+#define _TOPK_H
+
+#include "lib.h"
+#include "output.h"
+
+/*
+ * The K most frequent words seen so far, kept in a min-heap whose root
+ * is the least frequent of them, so that a word could be told whether
+ * it makes into the top K by one comparison against the root.
+ *
+ * Among words of the same occurence, the alphabetically smaller ones
+ * come first.
+ */
+typedef struct entry {
+	int cnt;
+	int len, size;
+	char *word;
+} entry_t;
+
+typedef struct topk {
+	int k, num;
+	entry_t *entries;
+} topk_t;
+
+errcode_t topk_init(topk_t *top, const int k);
+void topk_cleanup(topk_t *top);
+void topk_reset(topk_t *top);
+errcode_t topk_insert(void *arg, const char *word, const int len,
+					  const int cnt);
+errcode_t topk_merge(topk_t *dst, const topk_t *src);
+void topk_sort(topk_t *top);
+errcode_t topk_output(topk_t *top, out_t *out);
+errcode_t topk_dump(topk_t *top);
+
+#endif	/* _TOPK_H */
@@ -41,6 +41,35 @@
 /*
  * tsync structure should be embedded in another hosting structure
  */
+#ifdef FUTEX_TSYNC
+/* The number of slots the counters of readers are spread over */
+#define TSYNC_SLOTS		16
+
+typedef struct tsync {
+	/* Indicator whether a shutdown begins */
+	int being_shutdown;
+
+	/* The number of writers, running or waiting */
+	int writers;
+
+	/* The futex based mutex among writers */
+	int lock;
+
+	/* Bumped up by a reader leaving while a writer or a shutdown waits */
+	int gen;
+
+	/*
+	 * The number of threads waiting for writers to be gone and that for
+	 * readers to leave, who have to be woken up
+	 */
+	int waiters, drainers;
+
+	/* The number of readers running or about to, in the slot of each */
+	struct {
+		int readers;
+	} __attribute__((aligned(64))) slots[TSYNC_SLOTS];
+} tsync_t;
+#else
 typedef struct tsync {
 	/* Indicator whether a shutdown begins */
 	int being_shutdown;
@@ -63,6 +92,7 @@ typedef struct tsync {
 	/* The lock to protect the whole structure */
 	pthread_mutex_t mutex;
 } tsync_t;
+#endif
 
 void tsync_init(tsync_t *sync);
 void tsync_cleanup(tsync_t *sync);
@@ -0,0 +1,244 @@
+/*
+ * The same readers-writer model as tsync.c without any mutex on the way
+ * of readers, built on atomic counters and futexes instead:
+ *	. each reader thread bumps up a counter of its own slot, so readers
+ *	  don't bounce one cache line among them as they do the mutex;
+ *	. a writer announces itself before it waits for the readers running
+ *	  to drain, and no more readers get in until all writers are gone;
+ *	. writers take turns by a futex based mutex among themselves;
+ *	. a shutdown waits for all readers and writers to leave.
+ *
+ * The slot of a reader is that of its thread rather than its CPU, as a
+ * reader could be migrated to another CPU before it exits.
+ */
+
+#include <limits.h>
+#include <string.h>
+#include <linux/futex.h>
+#include "lib.h"
+#include "tsync.h"
+
+/* The slot of the calling thread, assigned when it reads the first time */
+static __thread int own_slot = -1;
+static int next_slot;
+
+static void futex_wait(int *addr, const int val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(int *addr, const int num)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0);
+}
+
+static int *get_slot(tsync_t *sync)
+{
+	if (own_slot < 0) {
+		own_slot = __atomic_fetch_add(&next_slot, 1, __ATOMIC_RELAXED) %
+				   TSYNC_SLOTS;
+	}
+
+	return &sync->slots[own_slot].readers;
+}
+
+/* The number of readers running or about to */
+static int count_readers(const tsync_t *sync)
+{
+	int i, num = 0;
+
+	for (i = 0; i < TSYNC_SLOTS; i++) {
+		num += __atomic_load_n(&sync->slots[i].readers, __ATOMIC_SEQ_CST);
+	}
+
+	return num;
+}
+
+/*
+ * Lock the mutex among writers, which is 0 if unlocked, 1 if locked and
+ * 2 if some other writer may be sleeping on it
+ */
+static void lock_writers(tsync_t *sync)
+{
+	int c = 0;
+
+	if (__atomic_compare_exchange_n(&sync->lock, &c, 1, 0, __ATOMIC_ACQUIRE,
+									__ATOMIC_RELAXED)) {
+		return;
+	}
+
+	if (c != 2) {
+		c = __atomic_exchange_n(&sync->lock, 2, __ATOMIC_ACQUIRE);
+	}
+
+	while (c != 0) {
+		futex_wait(&sync->lock, 2);
+		c = __atomic_exchange_n(&sync->lock, 2, __ATOMIC_ACQUIRE);
+	}
+}
+
+static void unlock_writers(tsync_t *sync)
+{
+	if (__atomic_exchange_n(&sync->lock, 0, __ATOMIC_RELEASE) == 2) {
+		futex_wake(&sync->lock, 1);
+	}
+}
+
+/*
+ * Wait for all readers running to leave, sleeping on the generation of
+ * readers leaving, which is only bumped up by readers leaving while
+ * anyone is waiting for them, so readers don't make any syscall unless
+ * they have to
+ */
+static void wait_readers(tsync_t *sync)
+{
+	int gen;
+
+	if (count_readers(sync) == 0) {
+		return;
+	}
+
+	__atomic_fetch_add(&sync->drainers, 1, __ATOMIC_SEQ_CST);
+
+	for (;;) {
+		gen = __atomic_load_n(&sync->gen, __ATOMIC_SEQ_CST);
+
+		if (count_readers(sync) == 0) {
+			break;
+		}
+
+		futex_wait(&sync->gen, gen);
+	}
+
+	__atomic_fetch_sub(&sync->drainers, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Wait for all writers to leave, and the same as above, the last writer
+ * leaving only makes a syscall if anyone is waiting for it
+ */
+static void wait_writers(tsync_t *sync)
+{
+	int writers;
+
+	__atomic_fetch_add(&sync->waiters, 1, __ATOMIC_SEQ_CST);
+
+	while ((writers = __atomic_load_n(&sync->writers, __ATOMIC_SEQ_CST)) > 0) {
+		futex_wait(&sync->writers, writers);
+	}
+
+	__atomic_fetch_sub(&sync->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Drop the given writer, the last one wakes up all waiting for writers
+ * to be gone
+ */
+static void drop_writer(tsync_t *sync)
+{
+	if (__atomic_sub_fetch(&sync->writers, 1, __ATOMIC_SEQ_CST) == 0 &&
+		__atomic_load_n(&sync->waiters, __ATOMIC_SEQ_CST) > 0) {
+		futex_wake(&sync->writers, INT_MAX);
+	}
+}
+
+void tsync_init(tsync_t *sync)
+{
+	memset(sync, 0, sizeof(tsync_t));
+}
+
+void tsync_cleanup(tsync_t *sync)
+{
+}
+
+/*
+ * Raise the shutdown flag and waiting for the completion of any
+ * existing readers or writers
+ *
+ * NOTE: Only one thread can actually shut down an object while
+ * other threads with same intention will end up with object
+ * unavailable to avoid segfault caused by double-free
+ */
+int tsync_shutdown_entry(tsync_t *sync)
+{
+	if (__atomic_exchange_n(&sync->being_shutdown, 1, __ATOMIC_SEQ_CST) == 1) {
+		return -1;
+	}
+
+	/* Writers are waited for first as they hold back readers */
+	wait_writers(sync);
+	wait_readers(sync);
+
+	return 0;
+}
+
+/*
+ * Reset the shutdown flag and make relevant object available again
+ */
+void tsync_shutdown_revoke(tsync_t *sync)
+{
+	__atomic_store_n(&sync->being_shutdown, 0, __ATOMIC_SEQ_CST);
+}
+
+int tsync_writer_entry(tsync_t *sync)
+{
+	/*
+	 * NOTE: the writer is counted before the shutdown flag is checked,
+	 * and the other way around by a shutdown, so that at least one of
+	 * them sees the other
+	 */
+	__atomic_fetch_add(&sync->writers, 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&sync->being_shutdown, __ATOMIC_SEQ_CST) == 1) {
+		drop_writer(sync);
+		return -1;
+	}
+
+	lock_writers(sync);
+
+	/* No more readers get in, wait for those running to leave */
+	wait_readers(sync);
+
+	return 0;
+}
+
+void tsync_writer_exit(tsync_t *sync)
+{
+	unlock_writers(sync);
+
+	/* The last writer lets in readers and any shutdown waiting */
+	drop_writer(sync);
+}
+
+int tsync_reader_entry(tsync_t *sync)
+{
+	int *readers = get_slot(sync);
+
+	for (;;) {
+		/* Same as a writer, the reader is counted before any check */
+		__atomic_fetch_add(readers, 1, __ATOMIC_SEQ_CST);
+
+		if (__atomic_load_n(&sync->being_shutdown, __ATOMIC_SEQ_CST) == 1) {
+			tsync_reader_exit(sync);
+			return -1;
+		}
+
+		if (__atomic_load_n(&sync->writers, __ATOMIC_SEQ_CST) == 0) {
+			return 0;
+		}
+
+		/* Back off in favour of writers until all of them are gone */
+		tsync_reader_exit(sync);
+		wait_writers(sync);
+	}
+}
+
+void tsync_reader_exit(tsync_t *sync)
+{
+	__atomic_fetch_sub(get_slot(sync), 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&sync->drainers, __ATOMIC_SEQ_CST) > 0) {
+		__atomic_fetch_add(&sync->gen, 1, __ATOMIC_SEQ_CST);
+		futex_wake(&sync->gen, INT_MAX);
+	}
+}